@@ -0,0 +1,85 @@
+#include <stdio.h>
+
+#include "../src/bmp.h"
+#include "timing.h"
+#define THREADS 4
+#define JOBS 25
+
+char const* assets[] = {"img/cache_background.bmp", "img/cache_sprite.bmp", "img/cache_logo.bmp"};
+
+typedef struct Worker {
+    BmpCache* cache;
+    u64       count;
+} Worker;
+
+// every job composes the same background, sprite and logo into a new image
+void* compose(void* arg) {
+    Worker* worker = arg;
+    for (i32 job = 0; job < JOBS; job++) {
+        BMP* out = create_bmp(1920, 1080, PIXEL_BLACK);
+        for (i32 i = 0; i < 3; i++) {
+            BmpAsset* asset = NULL;
+            BMP*      source;
+            if (worker->cache != NULL) {
+                if (bmp_cache_acquire(worker->cache, assets[i], &asset) != BMP_ERROR_NONE) {
+                    continue;
+                }
+                source = asset->bmp;
+            } else if (read_bmp(assets[i], &source) != BMP_ERROR_NONE) {
+                continue;
+            }
+
+            worker->count += bmp_copy(out, i * 200, i * 100, source->header->info_header.width,
+                                      source->header->info_header.height, source, 0, 0);
+            if (asset != NULL) {
+                bmp_cache_release(worker->cache, asset);
+            } else {
+                Bmp.free(source);
+            }
+        }
+        Bmp.free(out);
+    }
+    return NULL;
+}
+
+u64 run(BmpCache* cache) {
+    pthread_t threads[THREADS];
+    Worker    workers[THREADS];
+    for (i32 i = 0; i < THREADS; i++) {
+        workers[i] = (Worker){cache, 0};
+        pthread_create(&threads[i], NULL, compose, &workers[i]);
+    }
+
+    u64 count = 0;
+    for (i32 i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        count += workers[i].count;
+    }
+    return count;
+}
+
+i32 main() {
+    u32 sizes[][2] = {{1920, 1080}, {256, 256}, {128, 64}};
+    for (i32 i = 0; i < 3; i++) {
+        BMP* bmp = create_bmp(sizes[i][0], sizes[i][1], RGBA(0x3060C0FF + i * 0x20202000));
+        Bmp.save(bmp, assets[i], 8, 8, 8, 0);
+        Bmp.free(bmp);
+    }
+
+    char tag_1[64];
+    sprintf(tag_1, "%d jobs, read every asset", THREADS * JOBS);
+    timing_start(tag_1);
+    u64 count = run(NULL);
+    printf("%s: %Lg ms, %" PRIu64 " pixels\n", tag_1, timing_check(tag_1), count);
+
+    char tag_2[64];
+    sprintf(tag_2, "%d jobs, asset cache", THREADS * JOBS);
+    timing_start(tag_2);
+    BmpCache* cache = bmp_cache_create(64 << 20);
+    count = run(cache);
+    printf("%s: %Lg ms, %" PRIu64 " pixels, %" PRIu64 " hits, %" PRIu64 " misses\n", tag_2,
+           timing_check(tag_2), count, cache->hits, cache->misses);
+
+    bmp_cache_free(cache);
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <stdio.h>
+
+#include "../src/bmp.h"
+#include "timing.h"
+#define WIDTH 1920
+#define HEIGHT 1080
+#define FRAMES 30
+
+// the per-pixel floating-point conversion of a BT.601 4:2:0 frame, over bmp->pixels
+void naive_yuv420(BMP* bmp, u8* y, u8* u, u8* v) {
+    for (i32 row = 0; row < HEIGHT; row++) {
+        for (i32 x = 0; x < WIDTH; x++) {
+            Pixel* p = bmp->pixels[row][x];
+            f64    luma = 0.299 * p->red + 0.587 * p->green + 0.114 * p->blue;
+            y[row * WIDTH + x] = (u8)(16 + luma * 219 / 255 + 0.5);
+            if (row % 2 == 0 && x % 2 == 0) {
+                i32 chroma = row / 2 * (WIDTH / 2) + x / 2;
+                u[chroma] = (u8)(128 + (p->blue - luma) / 1.772 * 224 / 255 + 0.5);
+                v[chroma] = (u8)(128 + (p->red - luma) / 1.402 * 224 / 255 + 0.5);
+            }
+        }
+    }
+}
+
+i32 main() {
+    BMP* bmp = create_bmp(WIDTH, HEIGHT, PIXEL_WHITE);
+    for (i32 i = 0; i < 32; i++) {
+        Bmp.circle(bmp, i * 61 % WIDTH, i * 37 % HEIGHT, 200, RGB(0x102030 * i));
+    }
+
+    u8* y = malloc(WIDTH * HEIGHT);
+    u8* u = malloc(WIDTH * HEIGHT);
+    u8* v = malloc(WIDTH * HEIGHT);
+
+    char tag_1[64];
+    sprintf(tag_1, "naive YUV 4:2:0 for %d frames", FRAMES);
+    timing_start(tag_1);
+    for (i32 i = 0; i < FRAMES; i++) {
+        naive_yuv420(bmp, y, u, v);
+    }
+    printf("%s: %Lg ms\n", tag_1, timing_check(tag_1));
+
+    char tag_2[64];
+    sprintf(tag_2, "bmp_to_yuv 4:2:0 for %d frames", FRAMES);
+    timing_start(tag_2);
+    for (i32 i = 0; i < FRAMES; i++) {
+        bmp_to_yuv(bmp, y, u, v, BMP_YUV_601, true);
+    }
+    printf("%s: %Lg ms\n", tag_2, timing_check(tag_2));
+
+    char tag_3[64];
+    sprintf(tag_3, "bmp_to_gray for %d frames", FRAMES);
+    timing_start(tag_3);
+    for (i32 i = 0; i < FRAMES; i++) {
+        bmp_to_gray(bmp, y);
+    }
+    printf("%s: %Lg ms\n", tag_3, timing_check(tag_3));
+
+    char tag_4[64];
+    sprintf(tag_4, "bmp_to_hsv for %d frames", FRAMES);
+    timing_start(tag_4);
+    for (i32 i = 0; i < FRAMES; i++) {
+        bmp_to_hsv(bmp, y, u, v);
+    }
+    printf("%s: %Lg ms\n", tag_4, timing_check(tag_4));
+
+    // rotate the hue by a third of a turn
+    for (i32 i = 0; i < WIDTH * HEIGHT; i++) {
+        y[i] += 85;
+    }
+    bmp_from_hsv(bmp, y, u, v);
+    Bmp.save(bmp, "img/convert_hue.bmp", 8, 8, 8, 0);
+
+    bmp_to_gray(bmp, y);
+    bmp_from_gray(bmp, y);
+    Bmp.save(bmp, "img/convert_gray.bmp", 8, 8, 8, 0);
+
+    free(y), free(u), free(v);
+    Bmp.free(bmp);
+    return 0;
+}
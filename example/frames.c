@@ -0,0 +1,73 @@
+#include <stdio.h>
+
+#include "../src/bmp.h"
+#include "timing.h"
+#define WIDTH 1920
+#define HEIGHT 1080
+#define FRAMES 120
+
+// a dashboard where a marker moves along a sine wave and a counter ticks, the rest is static
+void draw_frame(BMP* bmp, i32 frame) {
+    if (frame == 0) {
+        Bmp.fill(bmp, PIXEL_WHITE);
+        for (i64 x = 0; x < WIDTH; x += 120) {
+            Bmp.rect(bmp, x, 0, 1, HEIGHT, RGB(0xDDDDDD));
+        }
+        for (i64 y = 0; y < HEIGHT; y += 120) {
+            Bmp.rect(bmp, 0, y, WIDTH, 1, RGB(0xDDDDDD));
+        }
+        Bmp.text(bmp, NULL, 40, 40, 36, PIXEL_BLACK, "Dashboard");
+    }
+
+    i64 x = 100 + frame * 14, y = HEIGHT / 2 + (i64)(300 * sin(frame * 0.1));
+    Bmp.circle(bmp, x, y, 6, PIXEL_BLUE);
+
+    char label[32];
+    sprintf(label, "frame %03d", frame);
+    Bmp.rect(bmp, WIDTH - 240, 40, 200, 36, PIXEL_WHITE);
+    Bmp.text(bmp, NULL, WIDTH - 240, 40, 36, PIXEL_RED, label);
+}
+
+bool count_frame(BMP* bmp, u64 index, BmpRect const* changes, u32 count, void* ctx) {
+    if (index == FRAMES - 1) {
+        Bmp.save(bmp, "img/frames.bmp", 8, 8, 8, 0);
+    }
+    for (u32 i = 0; i < count; i++) {
+        *(u64*)ctx += (u64)changes[i].width * changes[i].height;
+    }
+    return true;
+}
+
+i32 main() {
+    char tag_1[64];
+    sprintf(tag_1, "full BMP for %d frames", FRAMES);
+    timing_start(tag_1);
+    BMP* bmp = create_bmp(WIDTH, HEIGHT, PIXEL_WHITE);
+    for (i32 frame = 0; frame < FRAMES; frame++) {
+        draw_frame(bmp, frame);
+        Bmp.save(bmp, "img/frames_full.bmp", 8, 8, 8, 0);
+    }
+    printf("%s: %Lg ms, %" PRIu64 " MB\n", tag_1, timing_check(tag_1),
+           (u64)FRAMES * WIDTH * HEIGHT * 3 >> 20);
+    Bmp.free(bmp);
+
+    char tag_2[64];
+    sprintf(tag_2, "delta stream for %d frames", FRAMES);
+    timing_start(tag_2);
+    BmpFrames* frames = bmp_frames_create(WIDTH, HEIGHT, PIXEL_WHITE, "img/frames.delta");
+    for (i32 frame = 0; frame < FRAMES; frame++) {
+        draw_frame(frames->canvas, frame);
+        bmp_frames_commit(frames);
+    }
+    printf("%s: %Lg ms, %" PRIu64 " MB\n", tag_2, timing_check(tag_2), frames->bytes >> 20);
+    bmp_frames_free(frames);
+
+    char* tag_3 = "replay delta stream";
+    timing_start(tag_3);
+    u64 changed = 0;
+    bmp_frames_replay("img/frames.delta", count_frame, &changed);
+    printf("%s: %Lg ms, %" PRIu64 " changed pixels\n", tag_3, timing_check(tag_3), changed);
+
+    remove("img/frames.delta");
+    return 0;
+}
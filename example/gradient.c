@@ -84,5 +84,36 @@ i32 main() {
     qsort(pixels, pixels_size, sizeof(Pixel), &rand_cmp);
 
     printf("%s: %Lg ms\n", tag, timing_check(tag));
+
+    BMP* canvas = create_bmp(WIDTH * 8, HEIGHT * 8, PIXEL_WHITE);
+
+    char* tag_blend = "blend per pixel";
+    timing_start(tag_blend);
+    for (i32 y = 0; y < HEIGHT * 8; y++) {
+        for (i32 x = 0; x < WIDTH * 8; x++) {
+            *canvas->pixels[y][x] = blend(PIXEL_RED, PIXEL_BLUE, (f64)x / (WIDTH * 8 - 1));
+        }
+    }
+    printf("%s: %Lg ms\n", tag_blend, timing_check(tag_blend));
+
+    char* tag_linear = "linear gradient";
+    timing_start(tag_linear);
+    BmpStop      stops[] = {{0, PIXEL_RED}, {0.5, PIXEL_YELLOW}, {1, PIXEL_BLUE}};
+    BmpGradient* linear = bmp_gradient_linear(stops, 3, BMP_SPREAD_PAD, 0, 0, WIDTH * 8, 0);
+    Bmp.gradient(canvas, linear, 0, 0, WIDTH * 8, HEIGHT * 8);
+    printf("%s: %Lg ms\n", tag_linear, timing_check(tag_linear));
+
+    char* tag_radial = "radial gradient";
+    timing_start(tag_radial);
+    BmpStop      glow[] = {{0, RGBA(0xFFFFFFC0)}, {1, PIXEL_TRANSPARENT}};
+    BmpGradient* radial = bmp_gradient_radial(glow, 2, BMP_SPREAD_PAD, WIDTH * 4, HEIGHT * 4,
+                                              HEIGHT * 4);
+    Bmp.gradient(canvas, radial, 0, 0, WIDTH * 8, HEIGHT * 8);
+    printf("%s: %Lg ms\n", tag_radial, timing_check(tag_radial));
+
+    Bmp.save(canvas, "img/gradient.bmp", 8, 8, 8, 0);
+    bmp_gradient_free(linear), bmp_gradient_free(radial);
+    Bmp.free(canvas);
+    free(pixels);
     return 0;
 }
@@ -0,0 +1,53 @@
+#include <stdio.h>
+
+#include "../src/bmp.h"
+#include "timing.h"
+#define SIZE 4096
+#define RUNS 10
+
+// a dashboard that is regenerated every run, but only changes on the last run
+void render(BMP* bmp, i32 run) {
+    Bmp.fill(bmp, PIXEL_WHITE);
+    for (i32 i = 0; i < 64; i++) {
+        Bmp.circle(bmp, i * 61 % SIZE, i * 127 % SIZE, 300, RGBA(0x3060C080 + i));
+    }
+    if (run == RUNS - 1) {
+        Bmp.text(bmp, NULL, 100, 100, 0, PIXEL_RED, "alert");
+    }
+}
+
+i32 main() {
+    BMP* bmp = create_bmp(SIZE, SIZE, PIXEL_WHITE);
+
+    char tag_1[64];
+    sprintf(tag_1, "hash %dx%d", SIZE, SIZE);
+    timing_start(tag_1);
+    u64 hash = bmp_hash(bmp);
+    long double elapsed = timing_check(tag_1);
+    printf("%s: %Lg ms, %Lg GB/s, %016" PRIx64 "\n", tag_1, elapsed,
+           (long double)SIZE * SIZE * sizeof(Pixel) / elapsed / 1e6, hash);
+
+    char tag_2[64];
+    sprintf(tag_2, "%d runs, always write", RUNS);
+    timing_start(tag_2);
+    for (i32 run = 0; run < RUNS; run++) {
+        render(bmp, run);
+        Bmp.save(bmp, "img/hash.bmp", 8, 8, 8, 0);
+    }
+    printf("%s: %Lg ms\n", tag_2, timing_check(tag_2));
+
+    char tag_3[64];
+    sprintf(tag_3, "%d runs, write when changed", RUNS);
+    timing_start(tag_3);
+    u64 digest = 0, writes = 0;
+    for (i32 run = 0; run < RUNS; run++) {
+        render(bmp, run);
+        u64 previous = digest;
+        write_bmp_changed(bmp, "img/hash.bmp", 8, 8, 8, 0, &digest);
+        writes += digest != previous;
+    }
+    printf("%s: %Lg ms, %" PRIu64 " writes\n", tag_3, timing_check(tag_3), writes);
+
+    Bmp.free(bmp);
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include <stdio.h>
+
+#include "../src/bmp.h"
+#include "timing.h"
+#define SIZE 4096
+
+i32 main() {
+    BMP* bmp = create_bmp(SIZE, SIZE, PIXEL_WHITE);
+    for (i32 i = 0; i < 64; i++) {
+        Bmp.circle(bmp, i * 61 % SIZE, i * 127 % SIZE, 300, RGBA(0x3060C080 + i));
+    }
+
+    char* names[] = {"bottom-up", "top-down"};
+    char* paths[] = {"img/io_bottom_up.bmp", "img/io_top_down.bmp"};
+    for (i32 top_down = 0; top_down < 2; top_down++) {
+        char tag[64];
+        sprintf(tag, "write %dx%d 8888 %s", SIZE, SIZE, names[top_down]);
+        timing_start(tag);
+        if (top_down) {
+            write_bmp_top_down(bmp, paths[top_down], 8, 8, 8, 8);
+        } else {
+            Bmp.save(bmp, paths[top_down], 8, 8, 8, 8);
+        }
+        printf("%s: %Lg ms\n", tag, timing_check(tag));
+    }
+
+    for (i32 top_down = 0; top_down < 2; top_down++) {
+        char tag[64];
+        sprintf(tag, "read %dx%d 8888 %s", SIZE, SIZE, names[top_down]);
+        timing_start(tag);
+        BMP* read;
+        Bmp.read(paths[top_down], &read);
+        printf("%s: %Lg ms\n", tag, timing_check(tag));
+        Bmp.free(read);
+    }
+
+    char tag_1[64];
+    sprintf(tag_1, "write %dx%d 8888 parallel", SIZE, SIZE);
+    timing_start(tag_1);
+    write_bmp_parallel(bmp, "img/io_parallel.bmp", 8, 8, 8, 8);
+    printf("%s: %Lg ms\n", tag_1, timing_check(tag_1));
+
+    char tag_2[64];
+    sprintf(tag_2, "read %dx%d 8888 parallel", SIZE, SIZE);
+    timing_start(tag_2);
+    BMP* read;
+    read_bmp_parallel("img/io_parallel.bmp", &read);
+    printf("%s: %Lg ms\n", tag_2, timing_check(tag_2));
+    Bmp.free(read);
+
+    Bmp.free(bmp);
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/bmp.h"
+#include "timing.h"
+#define SIZE 2048
+#define COAST 8
+#define SHALLOW 32
+
+// one pass grows the land by one pixel toward its 4 neighbours
+BmpMask* grow(BmpMask* mask) {
+    BmpMask* result = bmp_mask_create(mask->width, mask->height);
+    for (i64 y = 0; y < mask->height; y++) {
+        for (i64 x = 0; x < mask->width; x++) {
+            if (bmp_mask_get(mask, x, y) || (x > 0 && bmp_mask_get(mask, x - 1, y)) ||
+                (y > 0 && bmp_mask_get(mask, x, y - 1)) ||
+                (x + 1 < mask->width && bmp_mask_get(mask, x + 1, y)) ||
+                (y + 1 < mask->height && bmp_mask_get(mask, x, y + 1))) {
+                bmp_mask_set(result, x, y);
+            }
+        }
+    }
+    bmp_mask_free(mask);
+    return result;
+}
+
+i32 main() {
+    srand(SIZE);
+    BMP* bmp = create_bmp(SIZE, SIZE, PIXEL_TRANSPARENT);
+    for (i32 i = 0; i < 400; i++) {
+        Bmp.circle(bmp, rand() % SIZE, rand() % SIZE, rand() % 48 + 8, PIXEL_BLACK);
+    }
+    BmpMask* land = bmp_mask_alpha(bmp, 0x80);
+
+    char tag_1[64];
+    sprintf(tag_1, "%d passes of 4 neighbours", SHALLOW);
+    timing_start(tag_1);
+    BmpMask* grown = bmp_mask_copy(land);
+    for (i32 i = 0; i < SHALLOW; i++) {
+        grown = grow(grown);
+    }
+    printf("%s: %Lg ms\n", tag_1, timing_check(tag_1));
+    bmp_mask_free(grown);
+
+    char tag_2[64];
+    sprintf(tag_2, "distance transform %dx%d", SIZE, SIZE);
+    timing_start(tag_2);
+    float* distances = bmp_mask_distance(land);
+    printf("%s: %Lg ms\n", tag_2, timing_check(tag_2));
+    free(distances);
+
+    char* elements[] = {"rect", "disk"};
+    BmpMask* shallow = NULL;
+    BmpMask* coast = NULL;
+    for (u8 element = BMP_ELEMENT_RECT; element <= BMP_ELEMENT_DISK; element++) {
+        char tag[64];
+        sprintf(tag, "dilate %s radius %d", elements[element], SHALLOW);
+        timing_start(tag);
+        BmpMask* dilated = bmp_mask_dilate(land, element, SHALLOW, SHALLOW);
+        printf("%s: %Lg ms\n", tag, timing_check(tag));
+
+        sprintf(tag, "close %s radius %d", elements[element], COAST);
+        timing_start(tag);
+        BmpMask* closed = bmp_mask_close(land, element, COAST, COAST);
+        printf("%s: %Lg ms\n", tag, timing_check(tag));
+
+        bmp_mask_free(shallow), bmp_mask_free(coast);
+        shallow = dilated, coast = closed;
+    }
+
+    // shallow water around the islands, then beaches that fill the narrow straits, then the land
+    Bmp.fill(bmp, RGB(0x1E3A8A));
+    bmp_mask_draw(bmp, shallow, RGB(0x3B82F6));
+    bmp_mask_draw(bmp, coast, RGB(0xFDE68A));
+    BmpMask* inland = bmp_mask_erode(land, BMP_ELEMENT_DISK, COAST, COAST);
+    bmp_mask_draw(bmp, land, RGB(0x65A30D));
+    bmp_mask_draw(bmp, inland, RGB(0x166534));
+    Bmp.save(bmp, "img/morphology.bmp", 8, 8, 8, 0);
+
+    bmp_mask_free(land), bmp_mask_free(shallow), bmp_mask_free(coast), bmp_mask_free(inland);
+    Bmp.free(bmp);
+    return 0;
+}
@@ -85,32 +85,46 @@ i32 main() {
     char* tag = "Drawing";
     timing_start(tag);
 
-    BMP* bmp = create_bmp(WIDTH, HEIGHT, PIXEL_WHITE);
+    BmpLayers* layers = bmp_layers_create(WIDTH, HEIGHT);
+    BMP*       grid = bmp_layers_add(layers, 0xFF, BMP_BLEND_NORMAL);
+    BMP*       series = bmp_layers_add(layers, 0xFF, BMP_BLEND_NORMAL);
+    BMP*       legend = bmp_layers_add(layers, 0xFF, BMP_BLEND_NORMAL);
 
     Pixel PIXEL_GRAY = blend(PIXEL_BLACK, PIXEL_WHITE, 0.5);
 
     // draw background
-    Bmp.draw(bmp, PIXEL_YELLOW, &draw_background);
+    Bmp.fill(grid, PIXEL_WHITE);
+    Bmp.draw(grid, PIXEL_YELLOW, &draw_background);
 
     // draw x-axis and y-axis
-    Bmp.line(bmp, 0, Y_OFFSET, WIDTH, Y_OFFSET, LINE_WIDTH / 2, PIXEL_GRAY);
-    Bmp.line(bmp, X_OFFSET, 0, X_OFFSET, HEIGHT, LINE_WIDTH / 2, PIXEL_GRAY);
+    Bmp.line(grid, 0, Y_OFFSET, WIDTH, Y_OFFSET, LINE_WIDTH / 2, PIXEL_GRAY);
+    Bmp.line(grid, X_OFFSET, 0, X_OFFSET, HEIGHT, LINE_WIDTH / 2, PIXEL_GRAY);
 
     // draw sine and cosine
-    Bmp.draw(bmp, PIXEL_CYAN, &draw_sine);
-    Bmp.draw(bmp, PIXEL_MAGENTA, &draw_cosine);
+    Bmp.draw(series, PIXEL_CYAN, &draw_sine);
+    Bmp.draw(series, PIXEL_MAGENTA, &draw_cosine);
 
     // draw tan and cot
-    Bmp.draw(bmp, blend(PIXEL_CYAN, PIXEL_YELLOW, 0.5), &draw_tan);
-    Bmp.draw(bmp, blend(PIXEL_MAGENTA, PIXEL_YELLOW, 0.5), &draw_cot);
+    Bmp.draw(series, blend(PIXEL_CYAN, PIXEL_YELLOW, 0.5), &draw_tan);
+    Bmp.draw(series, blend(PIXEL_MAGENTA, PIXEL_YELLOW, 0.5), &draw_cot);
 
     // draw sec and csc
-    Bmp.draw(bmp, blend(PIXEL_CYAN, PIXEL_BLUE, 0.5), &draw_sec);
-    Bmp.draw(bmp, blend(PIXEL_MAGENTA, PIXEL_BLUE, 0.5), &draw_csc);
-
+    Bmp.draw(series, blend(PIXEL_CYAN, PIXEL_BLUE, 0.5), &draw_sec);
+    Bmp.draw(series, blend(PIXEL_MAGENTA, PIXEL_BLUE, 0.5), &draw_csc);
+
+    // draw legend
+    Bmp.text(legend, NULL, 20, 20, 27, PIXEL_CYAN, "sin");
+    Bmp.text(legend, NULL, 20, 53, 27, PIXEL_MAGENTA, "cos");
+    Bmp.text(legend, NULL, 20, 86, 27, blend(PIXEL_CYAN, PIXEL_YELLOW, 0.5), "tan");
+    Bmp.text(legend, NULL, 20, 119, 27, blend(PIXEL_MAGENTA, PIXEL_YELLOW, 0.5), "cot");
+    Bmp.text(legend, NULL, 20, 152, 27, blend(PIXEL_CYAN, PIXEL_BLUE, 0.5), "sec");
+    Bmp.text(legend, NULL, 20, 185, 27, blend(PIXEL_MAGENTA, PIXEL_BLUE, 0.5), "csc");
+
+    BMP* bmp = bmp_layers_flatten(layers);
     Bmp.save(bmp, "img/plot.bmp", 8, 8, 8, 0);
 
     Bmp.free(bmp);
+    bmp_layers_free(layers);
 
     printf("%s: %Lg ms\n", tag, timing_check(tag));
     return EXIT_SUCCESS;
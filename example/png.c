@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "../src/bmp.h"
+#include "timing.h"
+#define SIZE 4096
+
+i64 file_size(char const* path) {
+    struct stat info;
+    return stat(path, &info) == 0 ? info.st_size : -1;
+}
+
+i32 main() {
+    BMP* bmp = create_bmp(SIZE, SIZE, PIXEL_WHITE);
+    for (i32 i = 0; i < 64; i++) {
+        Bmp.circle(bmp, i * 61 % SIZE, i * 127 % SIZE, 300, RGBA(0x3060C080 + i));
+    }
+    for (i32 i = 0; i < 256; i++) {
+        Bmp.text(bmp, NULL, i * 37 % SIZE, i * 97 % SIZE, 0, PIXEL_BLACK, "png");
+    }
+
+    char tag_1[64];
+    sprintf(tag_1, "write %dx%d bmp", SIZE, SIZE);
+    timing_start(tag_1);
+    Bmp.save(bmp, "img/png.bmp", 8, 8, 8, 0);
+    printf("%s: %Lg ms, %" PRIi64 " bytes\n", tag_1, timing_check(tag_1), file_size("img/png.bmp"));
+
+    u8 levels[] = {0, 1, 6, 9};
+    for (u64 i = 0; i < sizeof(levels); i++) {
+        char tag[64];
+        sprintf(tag, "write %dx%d png level %d", SIZE, SIZE, levels[i]);
+        timing_start(tag);
+        write_png(bmp, "img/png.png", false, levels[i]);
+        printf("%s: %Lg ms, %" PRIi64 " bytes\n", tag, timing_check(tag), file_size("img/png.png"));
+    }
+
+    Bmp.free(bmp);
+    return 0;
+}
@@ -0,0 +1,50 @@
+#include <stdio.h>
+
+#include "../src/bmp.h"
+#include "timing.h"
+#define FILES 1000
+#define SIZE 256
+
+i32 main() {
+    char** paths = malloc(FILES * sizeof(char*));
+    BMP*   bmp = create_bmp(SIZE, SIZE, PIXEL_WHITE);
+    for (i32 i = 0; i < FILES; i++) {
+        paths[i] = malloc(64);
+        sprintf(paths[i], "img/probe_%04d.bmp", i);
+        Bmp.rect(bmp, 0, 0, i % SIZE, 1, PIXEL_BLUE);
+        Bmp.save(bmp, paths[i], 8, 8, 8, i % 2 ? 8 : 0);
+    }
+    Bmp.free(bmp);
+
+    char tag_1[64];
+    sprintf(tag_1, "read %d files for their size", FILES);
+    timing_start(tag_1);
+    u64 pixels = 0;
+    for (i32 i = 0; i < FILES; i++) {
+        BMP* full;
+        if (Bmp.read(paths[i], &full) == BMP_ERROR_NONE) {
+            pixels += (u64)full->header->info_header.width * full->header->info_header.height;
+            Bmp.free(full);
+        }
+    }
+    printf("%s: %Lg ms, %" PRIu64 " pixels\n", tag_1, timing_check(tag_1), pixels);
+
+    char tag_2[64];
+    sprintf(tag_2, "index %d files", FILES);
+    timing_start(tag_2);
+    BmpInfo* table = malloc(FILES * sizeof(BmpInfo));
+    u64      valid = bmp_index((char const* const*)paths, FILES, table);
+    pixels = 0;
+    for (i32 i = 0; i < FILES; i++) {
+        pixels += table[i].error == BMP_ERROR_NONE ? (u64)table[i].width * table[i].height : 0;
+    }
+    printf("%s: %Lg ms, %" PRIu64 " valid, %" PRIu64 " pixels\n", tag_2, timing_check(tag_2),
+           valid, pixels);
+
+    for (i32 i = 0; i < FILES; i++) {
+        remove(paths[i]);
+        free(paths[i]);
+    }
+    free(paths), free(table);
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <stdio.h>
+
+#include "../src/bmp.h"
+#include "timing.h"
+#define SIZE 2048
+#define THUMBNAIL 256
+
+bool save_level(BMP* level, u32 index, void* ctx) {
+    char path[64];
+    sprintf(path, "img/resize_level_%" PRIu32 ".bmp", index);
+    Bmp.save(level, path, 8, 8, 8, 0);
+    *(u32*)ctx += 1;
+    return false;
+}
+
+i32 main() {
+    BMP* bmp = create_bmp(SIZE, SIZE, PIXEL_WHITE);
+    for (i32 i = 0; i < 64; i++) {
+        Bmp.circle(bmp, SIZE / 2, SIZE / 2, SIZE / 2 - i * SIZE / 128,
+                   i % 2 ? PIXEL_WHITE : PIXEL_BLUE);
+    }
+    Bmp.save(bmp, "img/resize_source.bmp", 8, 8, 8, 0);
+
+    char* names[] = {"nearest", "box", "bilinear", "lanczos3"};
+    for (u8 filter = BMP_FILTER_NEAREST; filter <= BMP_FILTER_LANCZOS3; filter++) {
+        char tag[64], path[64];
+        sprintf(tag, "resize %dx%d to %dx%d (%s)", SIZE, SIZE, THUMBNAIL, THUMBNAIL,
+                names[filter]);
+        timing_start(tag);
+        BMP* small = Bmp.resize(bmp, THUMBNAIL, THUMBNAIL, filter);
+        printf("%s: %Lg ms\n", tag, timing_check(tag));
+
+        sprintf(path, "img/resize_%s.bmp", names[filter]);
+        Bmp.save(small, path, 8, 8, 8, 0);
+        Bmp.free(small);
+    }
+
+    char* tag_1 = "read full image";
+    timing_start(tag_1);
+    BMP* full;
+    Bmp.read("img/resize_source.bmp", &full);
+    printf("%s: %Lg ms\n", tag_1, timing_check(tag_1));
+
+    char* tag_2 = "read 1/8 thumbnail";
+    timing_start(tag_2);
+    BMP* thumbnail;
+    Bmp.read_scaled("img/resize_source.bmp", &thumbnail, 8);
+    printf("%s: %Lg ms\n", tag_2, timing_check(tag_2));
+
+    Bmp.save(thumbnail, "img/resize_thumbnail.bmp", 8, 8, 8, 0);
+
+    char* tag_3 = "compare thumbnail with box resize";
+    timing_start(tag_3);
+    BMP*    box = Bmp.resize(full, THUMBNAIL, THUMBNAIL, BMP_FILTER_BOX);
+    BmpDiff diff;
+    bmp_diff(thumbnail, box, &diff);
+    printf("%s: %Lg ms (PSNR %.2f dB, max %d, equal %d)\n", tag_3, timing_check(tag_3), diff.psnr,
+           diff.max, bmp_equal(thumbnail, box));
+
+    char* tag_4 = "box resize every level from the source";
+    timing_start(tag_4);
+    for (u32 size = SIZE / 2; size >= 1; size /= 2) {
+        BMP* level = Bmp.resize(full, size, size, BMP_FILTER_BOX);
+        Bmp.free(level);
+    }
+    printf("%s: %Lg ms\n", tag_4, timing_check(tag_4));
+
+    char* tag_5 = "pyramid, saving every level";
+    timing_start(tag_5);
+    u32 saved = 0;
+    bmp_pyramid(full, 0, false, save_level, &saved);
+    printf("%s: %Lg ms (%" PRIu32 " levels saved)\n", tag_5, timing_check(tag_5), saved);
+
+    char* tag_6 = "gamma-correct pyramid, saving every level";
+    timing_start(tag_6);
+    bmp_pyramid(full, 0, true, save_level, &saved);
+    printf("%s: %Lg ms\n", tag_6, timing_check(tag_6));
+
+    Bmp.free(bmp), Bmp.free(full), Bmp.free(thumbnail), Bmp.free(box);
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+
+#include "../src/bmp.h"
+#include "timing.h"
+#define SIZE 4096
+#define TILE 128
+#define THREADS 8
+#define SHAPES 20000
+
+typedef struct Producer {
+    BMP*             bmp;
+    BmpShared*       shared;
+    pthread_mutex_t* lock;
+    u32              seed;
+    u64              count;
+} Producer;
+
+// every producer scatters circles, lines and labels over the whole image
+void* produce(void* arg) {
+    Producer* producer = arg;
+    char      label[32];
+    for (i32 i = 0; i < SHAPES; i++) {
+        i64   x = rand_r(&producer->seed) % SIZE, y = rand_r(&producer->seed) % SIZE;
+        i64   r = rand_r(&producer->seed) % 24 + 4;
+        Pixel pixel = RGBA(0xFF000000 | rand_r(&producer->seed));
+        sprintf(label, "#%d", i);
+        if (producer->shared == NULL) {
+            pthread_mutex_lock(producer->lock);
+            producer->count += Bmp.circle(producer->bmp, x, y, r, pixel);
+            producer->count += Bmp.line(producer->bmp, x, y, x + r, y - r, 1, PIXEL_BLACK);
+            producer->count += Bmp.text(producer->bmp, NULL, x, y, 0, PIXEL_WHITE, label);
+            pthread_mutex_unlock(producer->lock);
+        } else {
+            BmpShared* shared = producer->shared;
+            producer->count += bmp_shared_circle(shared, x, y, r, pixel);
+            producer->count += bmp_shared_line(shared, x, y, x + r, y - r, 1, PIXEL_BLACK);
+            producer->count += bmp_shared_text(shared, NULL, x, y, 0, PIXEL_WHITE, label);
+        }
+    }
+    return NULL;
+}
+
+u64 run(BMP* bmp, BmpShared* shared) {
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_t       threads[THREADS];
+    Producer        producers[THREADS];
+    for (i32 i = 0; i < THREADS; i++) {
+        producers[i] = (Producer){bmp, shared, &lock, i + 1, 0};
+        pthread_create(&threads[i], NULL, produce, &producers[i]);
+    }
+
+    u64 count = 0;
+    for (i32 i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        count += producers[i].count;
+    }
+    return count;
+}
+
+i32 main() {
+    BMP* bmp = create_bmp(SIZE, SIZE, PIXEL_BLACK);
+
+    char tag_1[64];
+    sprintf(tag_1, "%d threads, one lock", THREADS);
+    timing_start(tag_1);
+    u64 count = run(bmp, NULL);
+    printf("%s: %Lg ms, %" PRIu64 " pixels\n", tag_1, timing_check(tag_1), count);
+
+    char tag_2[64];
+    sprintf(tag_2, "%d threads, %dx%d tile locks", THREADS, TILE, TILE);
+    timing_start(tag_2);
+    BmpShared* shared = bmp_shared_create(bmp, TILE);
+    count = run(bmp, shared);
+    printf("%s: %Lg ms, %" PRIu64 " pixels\n", tag_2, timing_check(tag_2), count);
+
+    bmp_shared_free(shared);
+    Bmp.save(bmp, "img/shared.bmp", 8, 8, 8, 0);
+    Bmp.free(bmp);
+    return 0;
+}
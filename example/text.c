@@ -0,0 +1,54 @@
+#include <stdio.h>
+
+#include "../src/bmp.h"
+#include "timing.h"
+#define SIZE 2048
+#define LABELS 20000
+
+// draws every set bit of a glyph as a rect, the way labels were drawn before the text API
+void naive_text(BMP* bmp, i64 x, i64 y, Pixel pixel, char const* text) {
+    for (char const* c = text; *c != '\0'; c++, x += 6) {
+        u8 const* glyph = bmp_font_glyphs + (*c - 32) * 9;
+        for (i64 row = 0; row < 9; row++) {
+            for (i64 column = 0; column < 5; column++) {
+                if ((glyph[row] << column) & 0x80) {
+                    Bmp.rect(bmp, x + column, y + row, 1, 1, pixel);
+                }
+            }
+        }
+    }
+}
+
+i32 main() {
+    BMP* bmp = create_bmp(SIZE, SIZE, PIXEL_WHITE);
+    char label[32];
+
+    char tag_1[64];
+    sprintf(tag_1, "naive %d labels", LABELS);
+    timing_start(tag_1);
+    for (i32 i = 0; i < LABELS; i++) {
+        i64 x = i * 37 % SIZE, y = i * 91 % SIZE;
+        sprintf(label, "(%" PRId64 ", %" PRId64 ")", x, y);
+        naive_text(bmp, x, y, PIXEL_BLACK, label);
+    }
+    printf("%s: %Lg ms\n", tag_1, timing_check(tag_1));
+
+    Bmp.fill(bmp, PIXEL_WHITE);
+
+    char tag_2[64];
+    sprintf(tag_2, "glyph atlas %d labels", LABELS);
+    timing_start(tag_2);
+    for (i32 i = 0; i < LABELS; i++) {
+        i64 x = i * 37 % SIZE, y = i * 91 % SIZE;
+        sprintf(label, "(%" PRId64 ", %" PRId64 ")", x, y);
+        Bmp.text(bmp, NULL, x, y, 0, PIXEL_BLACK, label);
+    }
+    printf("%s: %Lg ms\n", tag_2, timing_check(tag_2));
+
+    Bmp.text(bmp, NULL, 16, 16, 36, RGBA(0x3050C0C0), "Cimple BMP");
+    Bmp.text(bmp, NULL, 16, 64, 13, PIXEL_RED, "smooth edges at 13px");
+
+    Bmp.save(bmp, "img/text.bmp", 8, 8, 8, 0);
+    Bmp.free(bmp);
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include <stdio.h>
+
+#include "../src/bmp.h"
+#include "timing.h"
+#define SIZE 8192
+#define TILE 256
+#define BUDGET (32 << 20)
+#define FEATURES 20000
+
+// a map of lakes, roads and labels, drawn cell by cell in raster order like a map renderer
+u64 draw_map(BMP* bmp, BmpTiled* canvas) {
+    u64  count = 0;
+    char label[32];
+    srand(38);
+    for (i32 i = 0; i < FEATURES; i++) {
+        i64 cell = i / 5, x = cell % (SIZE / 128) * 128 + rand() % 128;
+        i64 y = cell / (SIZE / 128) * 128 + rand() % 128;
+        i64 r = rand() % 40 + 4;
+        sprintf(label, "#%d", i);
+        if (bmp != NULL) {
+            count += Bmp.circle(bmp, x, y, r, RGBA(0x4080C0C0));
+            count += Bmp.line(bmp, x, y, x + rand() % 200 - 100, y + rand() % 200 - 100, 1,
+                              PIXEL_BLACK);
+            count += Bmp.text(bmp, NULL, x, y, 0, PIXEL_RED, label);
+        } else {
+            count += bmp_tiled_circle(canvas, x, y, r, RGBA(0x4080C0C0));
+            count += bmp_tiled_line(canvas, x, y, x + rand() % 200 - 100,
+                                    y + rand() % 200 - 100, 1, PIXEL_BLACK);
+            count += bmp_tiled_text(canvas, NULL, x, y, 0, PIXEL_RED, label);
+        }
+    }
+    return count;
+}
+
+// a PSF 1 font of 8x9 cells whose glyphs ink the last column, at 14 pixels a glyph is 13 wide
+// with an advance of 12, so the last glyph of a label inks past its advance
+BmpFont* wide_font(void) {
+    FILE* file = fopen("img/tiled.psf", "wb");
+    u8    header[4] = {0x36, 0x04, 0, 9};
+    fwrite(header, 1, 4, file);
+    for (i32 c = 0; c < 256; c++) {
+        for (i32 row = 0; row < 9; row++) {
+            u8 bits = c >= 32 && c < 127 ? bmp_font_glyphs[(c - 32) * 9 + row] >> 3 : 0;
+            fputc(bits, file);
+        }
+    }
+    fclose(file);
+    return bmp_font_load("img/tiled.psf");
+}
+
+// the tiled canvas pages in every tile a text inks, so it matches drawing on one image
+bool check_text(void) {
+    BmpFont*  font = wide_font();
+    BMP*      bmp = create_bmp(512, 64, PIXEL_WHITE);
+    BmpTiled* canvas = bmp_tiled_create(512, 64, 16, BUDGET, NULL, PIXEL_WHITE);
+    for (i32 i = 0; i < 40; i++) {
+        Bmp.text(bmp, font, i * 11, i % 4 * 12, 14, PIXEL_BLACK, "AB");
+        bmp_tiled_text(canvas, font, i * 11, i % 4 * 12, 14, PIXEL_BLACK, "AB");
+    }
+
+    BMP* tiled = NULL;
+    bmp_tiled_save(canvas, "img/tiled_text.bmp", 8, 8, 8, 8);
+    read_bmp("img/tiled_text.bmp", &tiled);
+    bool equal = tiled != NULL && bmp_equal(bmp, tiled);
+
+    bmp_tiled_free(canvas), bmp_font_free(font);
+    Bmp.free(bmp), Bmp.free(tiled);
+    return equal;
+}
+
+i32 main() {
+    printf("tiled text matches one image: %s\n", check_text() ? "yes" : "no");
+
+    char tag_1[64];
+    sprintf(tag_1, "in memory %dx%d", SIZE, SIZE);
+    timing_start(tag_1);
+    BMP* bmp = create_bmp(SIZE, SIZE, PIXEL_WHITE);
+    u64  count = draw_map(bmp, NULL);
+    printf("%s: %Lg ms, %" PRIu64 " pixels, %" PRIu64 " MB\n", tag_1, timing_check(tag_1),
+           count, (u64)SIZE * SIZE * (sizeof(Pixel) + sizeof(Pixel*)) >> 20);
+    Bmp.free(bmp);
+
+    char tag_2[64];
+    sprintf(tag_2, "tiled %dx%d", SIZE, SIZE);
+    timing_start(tag_2);
+    BmpTiled* canvas = bmp_tiled_create(SIZE, SIZE, TILE, BUDGET, NULL, PIXEL_WHITE);
+    count = draw_map(NULL, canvas);
+    printf("%s: %Lg ms, %" PRIu64 " pixels, %" PRIu64 " MB, %" PRIu64 " tiles paged in, %" PRIu64
+           " paged out\n",
+           tag_2, timing_check(tag_2), count, canvas->resident >> 20, canvas->reads,
+           canvas->writes);
+
+    char tag_3[64];
+    sprintf(tag_3, "tiled save");
+    timing_start(tag_3);
+    bmp_tiled_save(canvas, "img/tiled.bmp", 5, 6, 5, 0);
+    printf("%s: %Lg ms\n", tag_3, timing_check(tag_3));
+
+    bmp_tiled_free(canvas);
+    return 0;
+}
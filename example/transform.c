@@ -0,0 +1,62 @@
+#include <stdio.h>
+
+#include "../src/bmp.h"
+#include "timing.h"
+#define SIZE 8192
+
+BMP* naive_rotate(BMP* bmp) {
+    i64  width = bmp->header->info_header.width;
+    i64  height = bmp->header->info_header.height;
+    BMP* rotated = create_bmp(height, width, PIXEL_TRANSPARENT);
+    for (i64 y = 0; y < height; y++) {
+        for (i64 x = 0; x < width; x++) {
+            *rotated->pixels[x][height - 1 - y] = *bmp->pixels[y][x];
+        }
+    }
+    return rotated;
+}
+
+i32 main() {
+    BMP* bmp = create_bmp(SIZE, SIZE, PIXEL_WHITE);
+    for (i32 i = 0; i < 16; i++) {
+        Bmp.rect(bmp, i * SIZE / 16, 0, SIZE / 32, SIZE / (i + 1), PIXEL_BLUE);
+    }
+
+    char tag_1[64];
+    sprintf(tag_1, "naive rotate %dx%d by 90", SIZE, SIZE);
+    timing_start(tag_1);
+    BMP* naive = naive_rotate(bmp);
+    printf("%s: %Lg ms\n", tag_1, timing_check(tag_1));
+    Bmp.free(naive);
+
+    char tag_2[64];
+    sprintf(tag_2, "tiled rotate %dx%d by 90", SIZE, SIZE);
+    timing_start(tag_2);
+    BMP* rotated = Bmp.rotate(bmp, 90);
+    printf("%s: %Lg ms\n", tag_2, timing_check(tag_2));
+    Bmp.free(rotated);
+
+    char tag_3[64];
+    sprintf(tag_3, "in place rotate %dx%d by 270", SIZE, SIZE);
+    timing_start(tag_3);
+    bmp_rotate_in_place(bmp, 270);
+    printf("%s: %Lg ms\n", tag_3, timing_check(tag_3));
+
+    char tag_4[64];
+    sprintf(tag_4, "in place flip %dx%d", SIZE, SIZE);
+    timing_start(tag_4);
+    Bmp.flip(bmp, true, true);
+    printf("%s: %Lg ms\n", tag_4, timing_check(tag_4));
+
+    char tag_5[64];
+    sprintf(tag_5, "transpose %dx%d", SIZE, SIZE / 2);
+    BMP* half = Bmp.resize(bmp, SIZE, SIZE / 2, BMP_FILTER_NEAREST);
+    timing_start(tag_5);
+    BMP* transposed = bmp_transpose(half);
+    printf("%s: %Lg ms\n", tag_5, timing_check(tag_5));
+
+    Bmp.save(transposed, "img/transposed.bmp", 8, 8, 8, 0);
+
+    Bmp.free(bmp), Bmp.free(half), Bmp.free(transposed);
+    return 0;
+}
@@ -9,37 +9,35 @@
 #define BLOCK 16
 #define ISLAND_SIZE 64
 
-bool draw_island_core(BMP* img, i64* x, i64* y, u64 count) {
-    if (count > ISLAND_SIZE) {
-        return false;
+u64 draw_island_core(BMP* img, i64* x, i64* y, BmpStep* steps, u64 capacity, u64 count) {
+    u64 size = 0;
+    for (; size < capacity && count + size <= ISLAND_SIZE; size++) {
+        steps[size] = (BmpStep){*x, *y};
+
+        i64 new_x, new_y;
+        do {
+            new_x = *x, new_y = *y;
+            switch (rand() % 4) {
+                case 0:
+                    new_x = *x + BLOCK;
+                    break;
+                case 1:
+                    new_x = *x - BLOCK;
+                    break;
+                case 2:
+                    new_y = *y + BLOCK;
+                    break;
+                case 3:
+                    new_y = *y - BLOCK;
+                    break;
+            }
+        } while (!bmp_safe(img, new_x, new_y));
+
+        *x = new_x;
+        *y = new_y;
     }
 
-    Pixel Forest = blend(PIXEL_GREEN, PIXEL_BLACK, 0.3);
-
-    Bmp.rect(img, *x, *y, BLOCK, BLOCK, Forest);
-
-    i64 new_x, new_y;
-    do {
-        switch (rand() % 4) {
-            case 0:
-                new_x = *x + BLOCK;
-                break;
-            case 1:
-                new_x = *x - BLOCK;
-                break;
-            case 2:
-                new_y = *y + BLOCK;
-                break;
-            case 3:
-                new_y = *y - BLOCK;
-                break;
-        }
-    } while (!bmp_safe(img, new_x, new_y));
-
-    *x = new_x;
-    *y = new_y;
-
-    return true;
+    return size;
 }
 
 bool draw_island(BMP* img, i64 x, i64 y) {
@@ -71,12 +69,13 @@ i32 main() {
     char* tag = "Map Maker";
     timing_start(tag);
 
-    BMP* image = create_bmp(SIZE, SIZE, PIXEL_BLUE);
+    BMP*  image = create_bmp(SIZE, SIZE, PIXEL_BLUE);
+    Pixel Forest = blend(PIXEL_GREEN, PIXEL_BLACK, 0.3);
 
     for (i32 i = 0; rand() % 5; i++) {
         i64 x = rand() % (SIZE / BLOCK) * BLOCK;
         i64 y = rand() % (SIZE / BLOCK) * BLOCK;
-        Bmp.turtle(image, x, y, &draw_island_core);
+        Bmp.turtle_batch(image, x, y, BLOCK, BLOCK, Forest, &draw_island_core);
     }
 
     Bmp.draw(image, PIXEL_GREEN, &draw_island);
@@ -15,11 +15,37 @@
 // #region Headers
 #include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+
+#if defined(__GLIBC__)
+#include <sys/sysinfo.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || \
+    defined(__DragonFly__)
+#include <sys/sysctl.h>
+#include <sys/types.h>
+#define BMP_SYSCTL 1
+#endif
+
+#if defined(__APPLE__)
+#define BMP_MTIME(file) ((file)->st_mtimespec)
+#else
+#define BMP_MTIME(file) ((file)->st_mtim)
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define BMP_SSE2 1
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
 // #endregion
 
 // #region BMP constants and structs.
@@ -33,7 +59,6 @@ typedef struct Mask {
 } __attribute__((packed)) Mask;
 
 static Mask Mask_555 = {0x1FU << 10U, 0x1FU << 5U, 0x1FU << 0U, 0};
-static Mask Mask_565 = {0b1111100000000000U, 0b0000011111100000U, 0b0000000000011111U, 0};
 static Mask Mask_888 = {0xFFU << 16U, 0xFFU << 8U, 0xFFU << 0U, 0};
 static Mask Mask_8888 = {0xFFU << 16U, 0xFFU << 8U, 0xFFU << 0U, 0xFFU << 24U};
 
@@ -93,6 +118,10 @@ typedef struct BITMAPV3INFOHEADER {
 typedef struct BMP {
     BITMAPV3INFOHEADER* header;
     Pixel***            pixels;
+    /** Contiguous top-down pixel storage that `pixels` points into. */
+    Pixel*              data;
+    /** The color channels are premultiplied by alpha, see `bmp_set_premultiplied`. */
+    bool                premultiplied;
 } BMP;
 // #endregion
 
@@ -128,6 +157,15 @@ static inline bool bmp_safe(BMP* bmp, int64_t x, int64_t y) {
     return true;
 }
 
+/**
+ * @brief Get the first pixel of a row, the pixels of a row are contiguous in memory.
+ *
+ * @param bmp the BMP image.
+ * @param y the y coordinate of the row.
+ * @return the pointer to the row.
+ */
+static inline Pixel* bmp_row(BMP* bmp, int64_t y) { return bmp->pixels[y][0]; }
+
 /**
  * @brief Blend two pixels.
  *
@@ -198,7 +236,403 @@ static inline Pixel RGB(uint32_t hex) {
 }
 // #endregion
 
+// #region Parallel.
+/**
+ * Number of threads used by the parallel kernels, 0 means one per online CPU, or a single thread
+ * where the count of CPUs is unknown.
+ */
+static uint32_t bmp_thread_count = 0;
+
+typedef struct BmpTask {
+    void (*run)(void* context, int64_t from, int64_t to);
+    void*   context;
+    int64_t from;
+    int64_t to;
+} BmpTask;
+
+/**
+ * @brief Set the number of threads used by the parallel kernels.
+ *
+ * @param threads the number of threads, 0 to use one per online CPU.
+ */
+void bmp_set_threads(uint32_t threads) { bmp_thread_count = threads; }
+
+/**
+ * @brief Get the number of threads used by the parallel kernels.
+ *
+ * @return the number of threads, at least 1.
+ */
+static inline uint32_t bmp_threads(void) {
+    if (bmp_thread_count > 0) {
+        return bmp_thread_count;
+    }
+
+    int online = 1;
+#if defined(__GLIBC__)
+    online = get_nprocs();
+#elif defined(BMP_SYSCTL)
+    int    name[2] = {CTL_HW, HW_NCPU};
+    size_t size = sizeof(online);
+    if (sysctl(name, 2, &online, &size, NULL, 0) != 0) {
+        online = 1;
+    }
+#endif
+    return online > 0 ? (uint32_t)online : 1;
+}
+
+static void* bmp_task_entry(void* task) {
+    BmpTask const* t = (BmpTask*)task;
+    t->run(t->context, t->from, t->to);
+    return NULL;
+}
+
+/**
+ * @brief Split [0, count) into contiguous bands and run them on multiple threads.
+ *
+ * @param count the number of items, usually rows.
+ * @param grain the minimum number of items per band.
+ * @param run the function to process the items in [from, to).
+ * @param context the context passed to the function.
+ */
+void bmp_parallel(int64_t count, int64_t grain,
+                  void (*run)(void* context, int64_t from, int64_t to), void* context) {
+    if (count <= 0) {
+        return;
+    }
+
+    int64_t workers = bmp_threads();
+    grain = grain < 1 ? 1 : grain;
+    if (workers > (count + grain - 1) / grain) {
+        workers = (count + grain - 1) / grain;
+    }
+
+    if (workers <= 1) {
+        run(context, 0, count);
+        return;
+    }
+
+    BmpTask*   tasks = calloc(workers, sizeof(BmpTask));
+    pthread_t* threads = calloc(workers, sizeof(pthread_t));
+    bool*      started = calloc(workers, sizeof(bool));
+    for (int64_t i = 0; i < workers; i++) {
+        tasks[i] = (BmpTask){run, context, count * i / workers, count * (i + 1) / workers};
+    }
+
+    for (int64_t i = 1; i < workers; i++) {
+        started[i] = pthread_create(&threads[i], NULL, bmp_task_entry, &tasks[i]) == 0;
+    }
+
+    bmp_task_entry(&tasks[0]);
+    for (int64_t i = 1; i < workers; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            bmp_task_entry(&tasks[i]);
+        }
+    }
+
+    free(tasks), free(threads), free(started);
+}
+// #endregion
+
+// #region Masks.
+/** A bit-packed mask, one bit per pixel. */
+typedef struct BmpMask {
+    uint32_t  width;
+    uint32_t  height;
+    /** Number of 64-bit words per row. */
+    uint64_t  stride;
+    uint64_t* bits;
+} BmpMask;
+
+/**
+ * @brief Create an empty mask.
+ *
+ * @param width the width of the mask.
+ * @param height the height of the mask.
+ * @return the mask, release with bmp_mask_free.
+ */
+BmpMask* bmp_mask_create(uint32_t width, uint32_t height) {
+    BmpMask* mask = calloc(1, sizeof(BmpMask));
+    mask->width = width;
+    mask->height = height;
+    mask->stride = (width + 63) / 64;
+    mask->bits = calloc(mask->stride * height + 1, sizeof(uint64_t));
+    return mask;
+}
+
+bool bmp_mask_free(BmpMask* mask) {
+    if (mask == NULL) {
+        return false;
+    }
+
+    free(mask->bits), free(mask);
+    return true;
+}
+
+static inline uint64_t* bmp_mask_row(BmpMask const* mask, int64_t y) {
+    return mask->bits + y * mask->stride;
+}
+
+static inline bool bmp_mask_get(BmpMask const* mask, int64_t x, int64_t y) {
+    return (bmp_mask_row(mask, y)[x >> 6] >> (x & 63)) & 1;
+}
+
+static inline void bmp_mask_set(BmpMask* mask, int64_t x, int64_t y) {
+    bmp_mask_row(mask, y)[x >> 6] |= 1ULL << (x & 63);
+}
+
+/**
+ * @brief Set the bits of a run [from, to) of a row, whole words at a time.
+ */
+static inline void bmp_mask_set_run(BmpMask* mask, int64_t y, int64_t from, int64_t to) {
+    uint64_t* row = bmp_mask_row(mask, y);
+    while (from < to) {
+        int64_t  bits = 64 - (from & 63) < to - from ? 64 - (from & 63) : to - from;
+        uint64_t word = bits == 64 ? ~0ULL : ((1ULL << bits) - 1) << (from & 63);
+        row[from >> 6] |= word;
+        from += bits;
+    }
+}
+
+/**
+ * @brief Find the first bit at or after from that is set, or not set.
+ *
+ * @return the position of the bit, or width when there is none.
+ */
+static inline int64_t bmp_mask_next(uint64_t const* row, int64_t from, int64_t width, bool set) {
+    if (from >= width) {
+        return width;
+    }
+
+    uint64_t const flip = set ? 0 : ~0ULL;
+    int64_t const  words = (width + 63) >> 6;
+    int64_t        index = from >> 6;
+    uint64_t       word = (row[index] ^ flip) & (~0ULL << (from & 63));
+    while (word == 0) {
+        if (++index >= words) {
+            return width;
+        }
+        word = row[index] ^ flip;
+    }
+
+    int64_t x = (index << 6) + __builtin_ctzll(word);
+    return x < width ? x : width;
+}
+// #endregion
+
 // #region Drawing.
+static inline uint32_t bmp_div255(uint32_t value) {
+    return (value + 128 + ((value + 128) >> 8)) >> 8;
+}
+
+/**
+ * @brief The pixel over operation in integer arithmetic, without division over opaque backgrounds.
+ *
+ * @param front the front pixel.
+ * @param back the back pixel.
+ * @return the composited pixel.
+ */
+static inline Pixel bmp_over(Pixel front, Pixel back) {
+    uint32_t front_alpha = front.alpha, back_alpha = back.alpha;
+    if (front_alpha == 0xFF) {
+        return front;
+    }
+    if (back_alpha == 0xFF) {
+        uint32_t keep = 0xFF - front_alpha;
+        return (Pixel){bmp_div255(front.red * front_alpha + back.red * keep),
+                       bmp_div255(front.green * front_alpha + back.green * keep),
+                       bmp_div255(front.blue * front_alpha + back.blue * keep), 0xFF};
+    }
+
+    // both weights are scaled by 255 to keep the division exact
+    uint32_t front_weight = front_alpha * 0xFF, back_weight = back_alpha * (0xFF - front_alpha);
+    uint32_t total = front_weight + back_weight;
+    if (total == 0) {
+        return PIXEL_TRANSPARENT;
+    }
+    return (Pixel){(front.red * front_weight + back.red * back_weight + total / 2) / total,
+                   (front.green * front_weight + back.green * back_weight + total / 2) / total,
+                   (front.blue * front_weight + back.blue * back_weight + total / 2) / total,
+                   (total + 127) / 0xFF};
+}
+
+/** `ceil(255 * 65536 / alpha)`, turns the division of unpremultiplying into an exact multiply. */
+static uint32_t const bmp_unpremultiply_table[256] = {
+    0, 16711680, 8355840, 5570560, 4177920, 3342336, 2785280, 2387383,
+    2088960, 1856854, 1671168, 1519244, 1392640, 1285514, 1193692, 1114112,
+    1044480, 983040, 928427, 879563, 835584, 795795, 759622, 726595,
+    696320, 668468, 642757, 618952, 596846, 576265, 557056, 539087,
+    522240, 506415, 491520, 477477, 464214, 451668, 439782, 428505,
+    417792, 407602, 397898, 388644, 379811, 371371, 363298, 355568,
+    348160, 341055, 334234, 327680, 321379, 315315, 309476, 303849,
+    298423, 293188, 288133, 283249, 278528, 273962, 269544, 265265,
+    261120, 257103, 253208, 249429, 245760, 242199, 238739, 235376,
+    232107, 228928, 225834, 222823, 219891, 217035, 214253, 211541,
+    208896, 206318, 203801, 201346, 198949, 196608, 194322, 192089,
+    189906, 187772, 185686, 183645, 181649, 179696, 177784, 175913,
+    174080, 172286, 170528, 168805, 167117, 165463, 163840, 162250,
+    160690, 159159, 157658, 156184, 154738, 153319, 151925, 150556,
+    149212, 147891, 146594, 145319, 144067, 142835, 141625, 140435,
+    139264, 138114, 136981, 135868, 134772, 133694, 132633, 131589,
+    130560, 129548, 128552, 127571, 126604, 125652, 124715, 123791,
+    122880, 121984, 121100, 120228, 119370, 118523, 117688, 116865,
+    116054, 115253, 114464, 113685, 112917, 112159, 111412, 110674,
+    109946, 109227, 108518, 107818, 107127, 106444, 105771, 105105,
+    104448, 103800, 103159, 102526, 101901, 101283, 100673, 100070,
+    99475, 98886, 98304, 97730, 97161, 96600, 96045, 95496,
+    94953, 94417, 93886, 93362, 92843, 92330, 91823, 91321,
+    90825, 90334, 89848, 89368, 88892, 88422, 87957, 87496,
+    87040, 86590, 86143, 85701, 85264, 84831, 84403, 83979,
+    83559, 83143, 82732, 82324, 81920, 81521, 81125, 80733,
+    80345, 79961, 79580, 79203, 78829, 78459, 78092, 77729,
+    77369, 77013, 76660, 76310, 75963, 75619, 75278, 74941,
+    74606, 74275, 73946, 73620, 73297, 72977, 72660, 72345,
+    72034, 71724, 71418, 71114, 70813, 70514, 70218, 69924,
+    69632, 69344, 69057, 68773, 68491, 68211, 67934, 67659,
+    67386, 67116, 66847, 66581, 66317, 66055, 65795, 65536,
+};
+
+static inline Pixel bmp_premultiply_pixel(Pixel pixel) {
+    if (pixel.alpha == 0xFF) {
+        return pixel;
+    }
+    return (Pixel){bmp_div255(pixel.red * pixel.alpha), bmp_div255(pixel.green * pixel.alpha),
+                   bmp_div255(pixel.blue * pixel.alpha), pixel.alpha};
+}
+
+static inline uint8_t bmp_unpremultiply_channel(uint32_t value, uint32_t reciprocal) {
+    uint32_t straight = (value * reciprocal + 0x8000) >> 16;
+    return straight > 0xFF ? 0xFF : straight;
+}
+
+static inline Pixel bmp_unpremultiply_pixel(Pixel pixel) {
+    if (pixel.alpha == 0xFF || pixel.alpha == 0) {
+        return pixel.alpha ? pixel : PIXEL_TRANSPARENT;
+    }
+    uint32_t reciprocal = bmp_unpremultiply_table[pixel.alpha];
+    return (Pixel){bmp_unpremultiply_channel(pixel.red, reciprocal),
+                   bmp_unpremultiply_channel(pixel.green, reciprocal),
+                   bmp_unpremultiply_channel(pixel.blue, reciprocal), pixel.alpha};
+}
+
+/**
+ * @brief The pixel over operation on premultiplied pixels, a multiply-add per channel.
+ *
+ * @param front the premultiplied front pixel.
+ * @param back the premultiplied back pixel.
+ * @return the composited premultiplied pixel.
+ */
+static inline Pixel bmp_over_premultiplied(Pixel front, Pixel back) {
+    uint32_t keep = 0xFF - front.alpha;
+    return (Pixel){front.red + bmp_div255(back.red * keep),
+                   front.green + bmp_div255(back.green * keep),
+                   front.blue + bmp_div255(back.blue * keep),
+                   front.alpha + bmp_div255(back.alpha * keep)};
+}
+
+/**
+ * @brief Convert a straight pixel into the pixel format of the image.
+ *
+ * @param bmp the image.
+ * @param pixel the straight pixel.
+ * @return the pixel as stored in the image.
+ */
+static inline Pixel bmp_store(BMP const* bmp, Pixel pixel) {
+    return bmp->premultiplied ? bmp_premultiply_pixel(pixel) : pixel;
+}
+
+/**
+ * @brief Premultiply a row of straight pixels in place.
+ *
+ * @param pixels the pixels.
+ * @param width the number of pixels.
+ */
+static inline void bmp_premultiply_row(Pixel* pixels, int64_t width) {
+    int64_t x = 0;
+#if defined(BMP_SSE2)
+    __m128i const zero = _mm_setzero_si128(), bias = _mm_set1_epi16(128);
+    __m128i const colors = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+    __m128i const alphas = _mm_set_epi16(0xFF, 0, 0, 0, 0xFF, 0, 0, 0);
+    for (; x + 4 <= width; x += 4) {
+        __m128i value = _mm_loadu_si128((__m128i const*)(pixels + x));
+        if ((_mm_movemask_epi8(_mm_cmpeq_epi8(value, _mm_set1_epi8(-1))) & 0x8888) == 0x8888) {
+            continue;
+        }
+
+        __m128i halves[2] = {_mm_unpacklo_epi8(value, zero), _mm_unpackhi_epi8(value, zero)};
+        for (int32_t i = 0; i < 2; i++) {
+            // broadcast the alpha of both pixels, and multiply the alpha itself by 255
+            __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(halves[i], 0xFF), 0xFF);
+            alpha = _mm_or_si128(_mm_and_si128(alpha, colors), alphas);
+            __m128i product = _mm_add_epi16(_mm_mullo_epi16(halves[i], alpha), bias);
+            halves[i] = _mm_srli_epi16(_mm_add_epi16(product, _mm_srli_epi16(product, 8)), 8);
+        }
+        _mm_storeu_si128((__m128i*)(pixels + x), _mm_packus_epi16(halves[0], halves[1]));
+    }
+#endif
+    for (; x < width; x++) {
+        pixels[x] = bmp_premultiply_pixel(pixels[x]);
+    }
+}
+
+/**
+ * @brief Convert a row of premultiplied pixels back to straight alpha.
+ *
+ * @param src the premultiplied pixels.
+ * @param dst the straight pixels, can be the same as `src`.
+ * @param width the number of pixels.
+ */
+static inline void bmp_unpremultiply_row(Pixel const* src, Pixel* dst, int64_t width) {
+    int64_t x = 0;
+#if defined(BMP_SSE2)
+    for (; x + 4 <= width; x += 4) {
+        __m128i value = _mm_loadu_si128((__m128i const*)(src + x));
+        if ((_mm_movemask_epi8(_mm_cmpeq_epi8(value, _mm_set1_epi8(-1))) & 0x8888) == 0x8888) {
+            _mm_storeu_si128((__m128i*)(dst + x), value);
+            continue;
+        }
+        for (int64_t i = x; i < x + 4; i++) {
+            dst[i] = bmp_unpremultiply_pixel(src[i]);
+        }
+    }
+#endif
+    for (; x < width; x++) {
+        dst[x] = bmp_unpremultiply_pixel(src[x]);
+    }
+}
+
+static void bmp_convert_rows(void* context, int64_t from, int64_t to) {
+    BMP*    bmp = (BMP*)context;
+    int64_t width = bmp->header->info_header.width;
+    for (int64_t y = from; y < to; y++) {
+        if (bmp->premultiplied) {
+            bmp_unpremultiply_row(bmp_row(bmp, y), bmp_row(bmp, y), width);
+        } else {
+            bmp_premultiply_row(bmp_row(bmp, y), width);
+        }
+    }
+}
+
+/**
+ * @brief Switch the pixel format of the image between straight and premultiplied alpha,
+ * converting the pixels in place. Drawing on a premultiplied image composites without divisions,
+ * and it is converted back to straight alpha when it is saved.
+ *
+ * @param bmp the image.
+ * @param premultiplied true for premultiplied alpha, false for straight alpha.
+ * @return true if the pixels were converted.
+ */
+bool bmp_set_premultiplied(BMP* bmp, bool premultiplied) {
+    if (bmp->premultiplied == premultiplied) {
+        return false;
+    }
+
+    bmp_parallel(bmp->header->info_header.height, 64, bmp_convert_rows, bmp);
+    bmp->premultiplied = premultiplied;
+    return true;
+}
+
 /**
  * @brief Fill the image with a pixel.
  *
@@ -209,6 +643,8 @@ static inline Pixel RGB(uint32_t hex) {
 uint64_t bmp_fill(BMP* bmp, Pixel pixel) {
     uint64_t count = 0;
 
+    pixel = bmp_store(bmp, pixel);
+
     for (int64_t y = 0; y < bmp->header->info_header.height; y++) {
         for (int64_t x = 0; x < bmp->header->info_header.width; x++) {
             if (bmp_safe(bmp, x, y)) {
@@ -245,14 +681,12 @@ uint64_t bmp_copy(BMP* bmp, int64_t from_x, int64_t from_y, int64_t width, int64
         for (int64_t x = 0; x < width; x++) {
             if (bmp_safe(bmp, from_x + x, from_y + y)) {
                 if (bmp_safe(source, source_x + x, source_y + y)) {
-                    bmp->pixels[from_y + y][from_x + x]->red =
-                        source->pixels[source_y + y][source_x + x]->red;
-                    bmp->pixels[from_y + y][from_x + x]->green =
-                        source->pixels[source_y + y][source_x + x]->green;
-                    bmp->pixels[from_y + y][from_x + x]->blue =
-                        source->pixels[source_y + y][source_x + x]->blue;
-                    bmp->pixels[from_y + y][from_x + x]->alpha =
-                        source->pixels[source_y + y][source_x + x]->alpha;
+                    Pixel pixel = *source->pixels[source_y + y][source_x + x];
+                    if (source->premultiplied != bmp->premultiplied) {
+                        pixel = bmp->premultiplied ? bmp_premultiply_pixel(pixel)
+                                                   : bmp_unpremultiply_pixel(pixel);
+                    }
+                    *bmp->pixels[from_y + y][from_x + x] = pixel;
                     count++;
                 }
             }
@@ -262,6 +696,106 @@ uint64_t bmp_copy(BMP* bmp, int64_t from_x, int64_t from_y, int64_t width, int64
     return count;
 }
 
+/**
+ * @brief Composite a pixel over a horizontal span of the image, the bulk kernel behind the shapes.
+ *
+ * @param bmp the image to draw on
+ * @param x the x coordinate of the start of the span
+ * @param y the y coordinate of the span
+ * @param length the length of the span
+ * @param pixel the pixel to composite
+ * @param coverage the coverage of every pixel of the span from 0 to 255, NULL for full coverage
+ * @return the count of pixels that were drawn
+ */
+uint64_t bmp_span(BMP* bmp, int64_t x, int64_t y, int64_t length, Pixel pixel,
+                  uint8_t const* coverage) {
+    int64_t width = bmp->header->info_header.width;
+    if (y < 0 || y >= bmp->header->info_header.height || length <= 0) {
+        return 0;
+    }
+
+    if (x < 0) {
+        coverage = coverage != NULL ? coverage - x : NULL;
+        length += x;
+        x = 0;
+    }
+    if (x + length > width) {
+        length = width - x;
+    }
+    if (length <= 0) {
+        return 0;
+    }
+
+    Pixel*   row = bmp_row(bmp, y) + x;
+    uint64_t count = 0;
+    if (bmp->premultiplied && !(coverage == NULL && pixel.alpha == 0xFF)) {
+        Pixel   front = bmp_premultiply_pixel(pixel);
+        int64_t i = 0;
+#if defined(BMP_SSE2)
+        if (coverage == NULL) {
+            uint32_t      packed;
+            __m128i const zero = _mm_setzero_si128(), bias = _mm_set1_epi16(128);
+            __m128i const keep = _mm_set1_epi16(0xFF - front.alpha);
+            memcpy(&packed, &front, sizeof(uint32_t));
+            __m128i const add = _mm_unpacklo_epi8(_mm_set1_epi32(packed), zero);
+            for (; i + 4 <= length; i += 4) {
+                __m128i value = _mm_loadu_si128((__m128i const*)(row + i));
+                __m128i halves[2] = {_mm_unpacklo_epi8(value, zero),
+                                     _mm_unpackhi_epi8(value, zero)};
+                for (int32_t h = 0; h < 2; h++) {
+                    __m128i product = _mm_add_epi16(_mm_mullo_epi16(halves[h], keep), bias);
+                    product = _mm_srli_epi16(_mm_add_epi16(product, _mm_srli_epi16(product, 8)), 8);
+                    halves[h] = _mm_add_epi16(product, add);
+                }
+                _mm_storeu_si128((__m128i*)(row + i), _mm_packus_epi16(halves[0], halves[1]));
+            }
+            count = i;
+        }
+#endif
+        for (; i < length; i++) {
+            uint32_t amount = coverage != NULL ? coverage[i] : 0xFF;
+            if (amount == 0) {
+                continue;
+            }
+            Pixel covered = front;
+            if (amount != 0xFF) {
+                covered = (Pixel){bmp_div255(front.red * amount),
+                                  bmp_div255(front.green * amount),
+                                  bmp_div255(front.blue * amount),
+                                  bmp_div255(front.alpha * amount)};
+            }
+            row[i] = bmp_over_premultiplied(covered, row[i]);
+            count++;
+        }
+        return count;
+    }
+
+    if (coverage == NULL) {
+        if (pixel.alpha == 0xFF) {
+            for (int64_t i = 0; i < length; i++) {
+                row[i] = pixel;
+            }
+        } else {
+            for (int64_t i = 0; i < length; i++) {
+                row[i] = bmp_over(pixel, row[i]);
+            }
+        }
+        return length;
+    }
+
+    for (int64_t i = 0; i < length; i++) {
+        if (coverage[i] == 0) {
+            continue;
+        }
+        Pixel front = pixel;
+        front.alpha = coverage[i] == 0xFF ? pixel.alpha : bmp_div255(pixel.alpha * coverage[i]);
+        row[i] = bmp_over(front, row[i]);
+        count++;
+    }
+
+    return count;
+}
+
 /**
  * @brief Draw a rectangle on the image.
  *
@@ -277,17 +811,12 @@ uint64_t bmp_rect(BMP* bmp, int64_t from_x, int64_t from_y, int64_t width, int64
                   Pixel pixel) {
     uint64_t count = 0;
 
-    for (int64_t y = 0; y < height; y++) {
-        for (int64_t x = 0; x < width; x++) {
-            if (bmp_safe(bmp, from_x + x, from_y + y)) {
-                Pixel blended = pixel_over(pixel, *bmp->pixels[from_y + y][from_x + x]);
-                bmp->pixels[from_y + y][from_x + x]->red = blended.red;
-                bmp->pixels[from_y + y][from_x + x]->green = blended.green;
-                bmp->pixels[from_y + y][from_x + x]->blue = blended.blue;
-                bmp->pixels[from_y + y][from_x + x]->alpha = blended.alpha;
-                count++;
-            }
-        }
+    int64_t from = from_y < 0 ? 0 : from_y;
+    int64_t to = from_y + height < bmp->header->info_header.height
+                     ? from_y + height
+                     : bmp->header->info_header.height;
+    for (int64_t y = from; y < to; y++) {
+        count += bmp_span(bmp, from_x, y, width, pixel, NULL);
     }
 
     return count;
@@ -306,19 +835,22 @@ uint64_t bmp_rect(BMP* bmp, int64_t from_x, int64_t from_y, int64_t width, int64
 uint64_t bmp_circle(BMP* bmp, int64_t center_x, int64_t center_y, int64_t radius, Pixel pixel) {
     uint64_t count = 0;
 
-    for (int64_t y = center_y - radius; y <= center_y + radius; y++) {
-        for (int64_t x = center_x - radius; x <= center_x + radius; x++) {
-            if (bmp_safe(bmp, x, y) &&
-                ((x - center_x) * (x - center_x) + (y - center_y) * (y - center_y) <=
-                 radius * radius)) {
-                Pixel blended = pixel_over(pixel, *bmp->pixels[y][x]);
-                bmp->pixels[y][x]->red = blended.red;
-                bmp->pixels[y][x]->green = blended.green;
-                bmp->pixels[y][x]->blue = blended.blue;
-                bmp->pixels[y][x]->alpha = blended.alpha;
-                count++;
-            }
+    int64_t from = center_y - radius < 0 ? 0 : center_y - radius;
+    int64_t to = center_y + radius + 1 < bmp->header->info_header.height
+                     ? center_y + radius + 1
+                     : bmp->header->info_header.height;
+    for (int64_t y = from; y < to; y++) {
+        // the widest dx with dx * dx + dy * dy <= radius * radius
+        int64_t rest = radius * radius - (y - center_y) * (y - center_y);
+        int64_t dx = (int64_t)sqrt((double)rest);
+        while (dx * dx > rest) {
+            dx--;
         }
+        while ((dx + 1) * (dx + 1) <= rest) {
+            dx++;
+        }
+
+        count += bmp_span(bmp, center_x - dx, y, 2 * dx + 1, pixel, NULL);
     }
 
     return count;
@@ -379,307 +911,7151 @@ uint64_t bmp_line(BMP* bmp, int64_t from_x, int64_t from_y, int64_t to_x, int64_
     return count;
 }
 
+static inline uint8_t bmp_coverage(double distance) {
+    double coverage = 0.5 - distance;
+    return coverage <= 0.0 ? 0 : (coverage >= 1.0 ? 0xFF : (uint8_t)(coverage * 255.0 + 0.5));
+}
+
 /**
- * @brief Draw something on the image by using a custom function.
+ * @brief Draw an anti-aliased filled circle on the image. Coordinates are continuous, the pixel at
+ * (x, y) covers the square from (x, y) to (x + 1, y + 1).
  *
  * @param bmp the image to draw on
- * @param pixel the pixel to draw
- * @param condition custom function to determine if the pixel should be drawn
+ * @param center_x the x coordinate of the center of the circle
+ * @param center_y the y coordinate of the center of the circle
+ * @param radius the radius of the circle
+ * @param pixel the pixel to fill the circle with
  * @return the count of pixels that were drawn
  */
-uint64_t bmp_draw(BMP* bmp, Pixel pixel, bool (*condition)(BMP*, int64_t, int64_t)) {
+uint64_t bmp_circle_aa(BMP* bmp, double center_x, double center_y, double radius, Pixel pixel) {
+    int64_t width = bmp->header->info_header.width;
+    int64_t height = bmp->header->info_header.height;
+    if (radius <= 0.0) {
+        return 0;
+    }
+
+    double   outer = radius + 0.5, inner = radius - 0.5;
+    int64_t  from = (int64_t)floor(center_y - outer), to = (int64_t)ceil(center_y + outer);
+    uint8_t* coverage = malloc((uint64_t)(2 * ceil(outer) + 3));
     uint64_t count = 0;
 
-    for (int64_t y = 0; y < bmp->header->info_header.height; y++) {
-        for (int64_t x = 0; x < bmp->header->info_header.width; x++) {
-            if (bmp_safe(bmp, x, y) && (*condition)(bmp, x, y)) {
-                Pixel blended = pixel_over(pixel, *bmp->pixels[y][x]);
-                bmp->pixels[y][x]->red = blended.red;
-                bmp->pixels[y][x]->green = blended.green;
-                bmp->pixels[y][x]->blue = blended.blue;
-                bmp->pixels[y][x]->alpha = blended.alpha;
-                count++;
-            }
+    for (int64_t y = from < 0 ? 0 : from; y <= to && y < height; y++) {
+        double dy = y + 0.5 - center_y;
+        if (dy * dy >= outer * outer) {
+            continue;
         }
-    }
-
-    return count;
-}
 
-uint64_t bmp_turtle(BMP* bmp, int64_t start_x, int64_t start_y,
-                    bool (*turtle)(BMP*, int64_t*, int64_t*, uint64_t)) {
-    uint64_t count = 0;
+        double  half = sqrt(outer * outer - dy * dy);
+        double  solid = inner > 0.0 && dy * dy < inner * inner ? sqrt(inner * inner - dy * dy) : -1;
+        int64_t left = (int64_t)floor(center_x - half), right = (int64_t)ceil(center_x + half);
+        left = left < 0 ? 0 : left, right = right >= width ? width - 1 : right;
 
-    int64_t x = start_x, y = start_y;
-    while (turtle(bmp, &x, &y, count)) {
-        count++;
+        // the signed distance to the circle gives the coverage of the edge pixels
+        for (int64_t x = left; x <= right; x++) {
+            double dx = x + 0.5 - center_x;
+            double distance = sqrt(dx * dx + dy * dy) - radius;
+            coverage[x - left] = fabs(dx) < solid ? 0xFF : bmp_coverage(distance);
+        }
+        count += bmp_span(bmp, left, y, right - left + 1, pixel, coverage);
     }
 
+    free(coverage);
     return count;
 }
-// #endregion
 
-// #region File IO, instance management.
-bool bmp_free(BMP* bmp) {
-    if (bmp == NULL) {
-        return false;
+/**
+ * @brief Draw an anti-aliased filled rectangle on the image, the coverage of the edge pixels is
+ * the exact covered area. Coordinates are continuous like bmp_circle_aa.
+ *
+ * @param bmp the image to draw on
+ * @param from_x the x coordinate of the top left corner of the rectangle
+ * @param from_y the y coordinate of the top left corner of the rectangle
+ * @param width the width of the rectangle
+ * @param height the height of the rectangle
+ * @param pixel the pixel to fill the rectangle with
+ * @return the count of pixels that were drawn
+ */
+uint64_t bmp_rect_aa(BMP* bmp, double from_x, double from_y, double width, double height,
+                     Pixel pixel) {
+    if (width <= 0.0 || height <= 0.0) {
+        return 0;
     }
 
-    BITMAPINFOHEADER const* info_header = (BITMAPINFOHEADER*)bmp->header;
+    double  to_x = from_x + width, to_y = from_y + height;
+    int64_t left = (int64_t)floor(from_x), right = (int64_t)ceil(to_x) - 1;
+    int64_t top = (int64_t)floor(from_y), bottom = (int64_t)ceil(to_y) - 1;
+    int64_t limit = bmp->header->info_header.width;
+    left = left < 0 ? 0 : left, right = right >= limit ? limit - 1 : right;
+    if (right < left) {
+        return 0;
+    }
 
-    if (bmp->pixels != NULL) {
-        for (int64_t y = 0; y < info_header->height; y++) {
-            for (int64_t x = 0; x < info_header->width; x++) {
-                if (bmp->pixels[y][x] != NULL) {
-                    free(bmp->pixels[y][x]);
-                }
-            }
+    double* columns = malloc((right - left + 1) * sizeof(double));
+    for (int64_t x = left; x <= right; x++) {
+        double low = from_x > x ? from_x : x, high = to_x < x + 1 ? to_x : x + 1;
+        columns[x - left] = high - low;
+    }
 
-            free(bmp->pixels[y]);
+    uint8_t* coverage = malloc(right - left + 1);
+    uint64_t count = 0;
+    for (int64_t y = top < 0 ? 0 : top; y <= bottom && y < bmp->header->info_header.height; y++) {
+        double low = from_y > y ? from_y : y, high = to_y < y + 1 ? to_y : y + 1;
+        for (int64_t x = left; x <= right; x++) {
+            coverage[x - left] = (uint8_t)(columns[x - left] * (high - low) * 255.0 + 0.5);
         }
-
-        free(bmp->pixels);
+        count += bmp_span(bmp, left, y, right - left + 1, pixel, coverage);
     }
 
-    if (bmp->header != NULL) {
+    free(columns), free(coverage);
+    return count;
+}
+
+/**
+ * @brief Intersect a horizontal line with a convex quadrilateral.
+ *
+ * @return false if the line misses the quadrilateral.
+ */
+static inline bool bmp_quad_span(double const (*quad)[2], double y, double* left, double* right) {
+    bool hit = false;
+    for (int i = 0; i < 4; i++) {
+        double const* a = quad[i];
+        double const* b = quad[(i + 1) % 4];
+        // horizontal edges are covered by the crossings of their neighbours
+        if (a[1] == b[1] || (a[1] > y && b[1] > y) || (a[1] < y && b[1] < y)) {
+            continue;
+        }
+
+        double x = a[0] + (y - a[1]) / (b[1] - a[1]) * (b[0] - a[0]);
+        *left = hit && *left < x ? *left : x;
+        *right = hit && *right > x ? *right : x;
+        hit = true;
+    }
+    return hit;
+}
+
+/**
+ * @brief Draw an anti-aliased line with round caps on the image. Coordinates are continuous like
+ * bmp_circle_aa.
+ *
+ * @param bmp the image to draw on
+ * @param from_x the x coordinate of the start of the line
+ * @param from_y the y coordinate of the start of the line
+ * @param to_x the x coordinate of the end of the line
+ * @param to_y the y coordinate of the end of the line
+ * @param width the thickness of the line
+ * @param pixel the color of the line
+ * @return the count of pixels that were drawn
+ */
+uint64_t bmp_line_aa(BMP* bmp, double from_x, double from_y, double to_x, double to_y,
+                     double width, Pixel pixel) {
+    int64_t limit = bmp->header->info_header.width;
+    if (width <= 0.0) {
+        return 0;
+    }
+
+    double radius = width / 2.0, outer = radius + 0.5;
+    double dx = to_x - from_x, dy = to_y - from_y, length = sqrt(dx * dx + dy * dy);
+    double nx = length > 0.0 ? -dy / length * outer : 0.0;
+    double ny = length > 0.0 ? dx / length * outer : 0.0;
+    double quad[4][2] = {{from_x + nx, from_y + ny},
+                         {to_x + nx, to_y + ny},
+                         {to_x - nx, to_y - ny},
+                         {from_x - nx, from_y - ny}};
+
+    int64_t  top = (int64_t)floor((from_y < to_y ? from_y : to_y) - outer);
+    int64_t  bottom = (int64_t)ceil((from_y > to_y ? from_y : to_y) + outer);
+    uint8_t* coverage = malloc(limit + 1);
+    uint64_t count = 0;
+
+    for (int64_t y = top < 0 ? 0 : top; y <= bottom && y < bmp->header->info_header.height; y++) {
+        double cy = y + 0.5, left = INFINITY, right = -INFINITY, low = 0.0, high = 0.0;
+
+        // the row crosses the capsule grown by half a pixel in one interval: the union of the
+        // crossings of the two caps and of the body
+        double const caps[2][2] = {{from_x, from_y}, {to_x, to_y}};
+        for (int i = 0; i < 2; i++) {
+            double d = cy - caps[i][1];
+            if (d * d < outer * outer) {
+                double half = sqrt(outer * outer - d * d);
+                left = caps[i][0] - half < left ? caps[i][0] - half : left;
+                right = caps[i][0] + half > right ? caps[i][0] + half : right;
+            }
+        }
+        if (length > 0.0 && bmp_quad_span(quad, cy, &low, &high)) {
+            left = low < left ? low : left;
+            right = high > right ? high : right;
+        }
+        if (left > right) {
+            continue;
+        }
+
+        int64_t from = (int64_t)floor(left), to = (int64_t)ceil(right);
+        from = from < 0 ? 0 : from, to = to >= limit ? limit - 1 : to;
+        if (to < from) {
+            continue;
+        }
+
+        for (int64_t x = from; x <= to; x++) {
+            // distance from the pixel center to the segment
+            double px = x + 0.5 - from_x, py = cy - from_y;
+            double t = length > 0.0 ? (px * dx + py * dy) / (length * length) : 0.0;
+            t = t < 0.0 ? 0.0 : (t > 1.0 ? 1.0 : t);
+            double ex = px - t * dx, ey = py - t * dy;
+            coverage[x - from] = bmp_coverage(sqrt(ex * ex + ey * ey) - radius);
+        }
+        count += bmp_span(bmp, from, y, to - from + 1, pixel, coverage);
+    }
+
+    free(coverage);
+    return count;
+}
+
+enum BMP_FILL_RULE {
+    BMP_FILL_EVEN_ODD = 0,
+    BMP_FILL_NON_ZERO,
+};
+
+typedef struct BmpPoint {
+    double x;
+    double y;
+} BmpPoint;
+
+typedef struct BmpEdge {
+    /** x at the center of the current scanline. */
+    double  x;
+    double  slope;
+    /** The upper end of the edge, x is evaluated from it to avoid accumulating errors. */
+    double  origin_x;
+    double  origin_y;
+    /** First and past-the-last scanlines crossed by the edge. */
+    int64_t from;
+    int64_t to;
+    int32_t winding;
+} BmpEdge;
+
+static int bmp_edge_compare(void const* a, void const* b) {
+    BmpEdge const* first = (BmpEdge*)a;
+    BmpEdge const* second = (BmpEdge*)b;
+    return first->from < second->from ? -1 : (first->from > second->from ? 1 : 0);
+}
+
+/**
+ * @brief Fill a path made of closed polygons on the image with an active edge table. The cost
+ * depends on the number of edges and covered pixels, not on the size of the image.
+ *
+ * @param bmp the image to draw on
+ * @param points the vertices of all polygons, one after another
+ * @param contours the number of vertices of every polygon
+ * @param contour_count the number of polygons
+ * @param rule the fill rule, one of BMP_FILL_RULE
+ * @param pixel the pixel to fill the path with
+ * @return the count of pixels that were filled
+ */
+uint64_t bmp_path(BMP* bmp, BmpPoint const* points, uint32_t const* contours,
+                  uint32_t contour_count, uint8_t rule, Pixel pixel) {
+    int64_t  height = bmp->header->info_header.height;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < contour_count; i++) {
+        total += contours[i];
+    }
+
+    BmpEdge* edges = malloc((total + 1) * sizeof(BmpEdge));
+    uint64_t edge_count = 0;
+    for (uint32_t i = 0, first = 0; i < contour_count; first += contours[i], i++) {
+        for (uint32_t j = 0; j < contours[i]; j++) {
+            BmpPoint a = points[first + j], b = points[first + (j + 1) % contours[i]];
+            int32_t  winding = a.y < b.y ? 1 : -1;
+            if (a.y > b.y) {
+                BmpPoint temp = a;
+                a = b, b = temp;
+            }
+
+            // scanlines sample the pixel centers, y + 0.5
+            BmpEdge edge = {0.0,
+                            (b.x - a.x) / (b.y - a.y),
+                            a.x,
+                            a.y,
+                            (int64_t)ceil(a.y - 0.5),
+                            (int64_t)ceil(b.y - 0.5),
+                            winding};
+            edge.from = edge.from < 0 ? 0 : edge.from;
+            edge.to = edge.to > height ? height : edge.to;
+            if (edge.from >= edge.to) {
+                continue;
+            }
+            edges[edge_count++] = edge;
+        }
+    }
+    qsort(edges, edge_count, sizeof(BmpEdge), bmp_edge_compare);
+
+    BmpEdge** active = malloc((edge_count + 1) * sizeof(BmpEdge*));
+    uint64_t  active_count = 0, next = 0, count = 0;
+    int64_t   y = edge_count > 0 ? edges[0].from : height;
+
+    while (y < height && (active_count > 0 || next < edge_count)) {
+        for (; next < edge_count && edges[next].from == y; next++) {
+            active[active_count++] = &edges[next];
+        }
+        for (uint64_t i = 0; i < active_count; i++) {
+            active[i]->x = active[i]->origin_x + (y + 0.5 - active[i]->origin_y) * active[i]->slope;
+        }
+
+        // edges move little between scanlines, so insertion sort stays close to linear
+        for (uint64_t i = 1; i < active_count; i++) {
+            BmpEdge* edge = active[i];
+            uint64_t j = i;
+            for (; j > 0 && active[j - 1]->x > edge->x; j--) {
+                active[j] = active[j - 1];
+            }
+            active[j] = edge;
+        }
+
+        int32_t winding = 0;
+        for (uint64_t i = 0; i + 1 < active_count; i++) {
+            winding += rule == BMP_FILL_NON_ZERO ? active[i]->winding : 1;
+            bool inside = rule == BMP_FILL_NON_ZERO ? winding != 0 : winding % 2 != 0;
+            if (inside) {
+                int64_t from = (int64_t)ceil(active[i]->x - 0.5);
+                int64_t to = (int64_t)ceil(active[i + 1]->x - 0.5);
+                count += bmp_span(bmp, from, y, to - from, pixel, NULL);
+            }
+        }
+
+        y++;
+        uint64_t kept = 0;
+        for (uint64_t i = 0; i < active_count; i++) {
+            if (active[i]->to > y) {
+                active[kept++] = active[i];
+            }
+        }
+        active_count = kept;
+        if (active_count == 0 && next < edge_count) {
+            y = edges[next].from;
+        }
+    }
+
+    free(edges), free(active);
+    return count;
+}
+
+/**
+ * @brief Fill a polygon on the image.
+ *
+ * @param bmp the image to draw on
+ * @param points the vertices of the polygon
+ * @param count the number of vertices
+ * @param rule the fill rule, one of BMP_FILL_RULE
+ * @param pixel the pixel to fill the polygon with
+ * @return the count of pixels that were filled
+ */
+uint64_t bmp_polygon(BMP* bmp, BmpPoint const* points, uint32_t count, uint8_t rule, Pixel pixel) {
+    return bmp_path(bmp, points, &count, 1, rule, pixel);
+}
+
+typedef struct BmpSeed {
+    int64_t x;
+    int64_t y;
+} BmpSeed;
+
+static inline bool bmp_match(Pixel pixel, Pixel target, uint8_t tolerance) {
+    return abs(pixel.red - target.red) <= tolerance &&
+           abs(pixel.green - target.green) <= tolerance &&
+           abs(pixel.blue - target.blue) <= tolerance &&
+           abs(pixel.alpha - target.alpha) <= tolerance;
+}
+
+/**
+ * @brief Fill the connected region around a point whose pixels match the color of the point.
+ *
+ * @param bmp the image to draw on
+ * @param x the x coordinate of the seed point
+ * @param y the y coordinate of the seed point
+ * @param pixel the pixel to fill the region with
+ * @param tolerance the largest difference of any channel to the seed color to be in the region
+ * @param connectivity 4 to spread to the edge neighbours, 8 to also spread diagonally
+ * @return the count of pixels that were filled
+ */
+uint64_t bmp_flood_fill(BMP* bmp, int64_t x, int64_t y, Pixel pixel, uint8_t tolerance,
+                        uint8_t connectivity) {
+    int64_t width = bmp->header->info_header.width;
+    int64_t height = bmp->header->info_header.height;
+    if (!bmp_safe(bmp, x, y)) {
+        return 0;
+    }
+
+    Pixel    target = *bmp->pixels[y][x];
+    int64_t  reach = connectivity == 8 ? 1 : 0;
+    BmpMask* visited = bmp_mask_create(width, height);
+    uint64_t capacity = 1024, size = 0, count = 0;
+    BmpSeed* stack = malloc(capacity * sizeof(BmpSeed));
+    stack[size++] = (BmpSeed){x, y};
+
+    while (size > 0) {
+        BmpSeed seed = stack[--size];
+        Pixel*  row = bmp_row(bmp, seed.y);
+        if (bmp_mask_get(visited, seed.x, seed.y) || !bmp_match(row[seed.x], target, tolerance)) {
+            continue;
+        }
+
+        // grow the seed into the widest matching span of its row
+        int64_t left = seed.x, right = seed.x + 1;
+        while (left > 0 && !bmp_mask_get(visited, left - 1, seed.y) &&
+               bmp_match(row[left - 1], target, tolerance)) {
+            left--;
+        }
+        while (right < width && !bmp_mask_get(visited, right, seed.y) &&
+               bmp_match(row[right], target, tolerance)) {
+            right++;
+        }
+
+        bmp_mask_set_run(visited, seed.y, left, right);
+        count += bmp_span(bmp, left, seed.y, right - left, pixel, NULL);
+
+        // one seed per matching run of the rows above and below
+        for (int64_t ny = seed.y - 1; ny <= seed.y + 1; ny += 2) {
+            if (ny < 0 || ny >= height) {
+                continue;
+            }
+
+            Pixel const* next = bmp_row(bmp, ny);
+            int64_t      from = left - reach < 0 ? 0 : left - reach;
+            int64_t      to = right + reach > width ? width : right + reach;
+            bool         in_run = false;
+            for (int64_t nx = from; nx < to; nx++) {
+                bool open =
+                    !bmp_mask_get(visited, nx, ny) && bmp_match(next[nx], target, tolerance);
+                if (open && !in_run) {
+                    if (size == capacity) {
+                        capacity *= 2;
+                        stack = realloc(stack, capacity * sizeof(BmpSeed));
+                    }
+                    stack[size++] = (BmpSeed){nx, ny};
+                }
+                in_run = open;
+            }
+        }
+    }
+
+    free(stack);
+    bmp_mask_free(visited);
+    return count;
+}
+
+/**
+ * @brief Draw something on the image by using a custom function.
+ *
+ * @param bmp the image to draw on
+ * @param pixel the pixel to draw
+ * @param condition custom function to determine if the pixel should be drawn
+ * @return the count of pixels that were drawn
+ */
+uint64_t bmp_draw(BMP* bmp, Pixel pixel, bool (*condition)(BMP*, int64_t, int64_t)) {
+    uint64_t count = 0;
+
+    pixel = bmp_store(bmp, pixel);
+
+    for (int64_t y = 0; y < bmp->header->info_header.height; y++) {
+        for (int64_t x = 0; x < bmp->header->info_header.width; x++) {
+            if (bmp_safe(bmp, x, y) && (*condition)(bmp, x, y)) {
+                Pixel blended = bmp->premultiplied
+                                    ? bmp_over_premultiplied(pixel, *bmp->pixels[y][x])
+                                    : bmp_over(pixel, *bmp->pixels[y][x]);
+                bmp->pixels[y][x]->red = blended.red;
+                bmp->pixels[y][x]->green = blended.green;
+                bmp->pixels[y][x]->blue = blended.blue;
+                bmp->pixels[y][x]->alpha = blended.alpha;
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+uint64_t bmp_turtle(BMP* bmp, int64_t start_x, int64_t start_y,
+                    bool (*turtle)(BMP*, int64_t*, int64_t*, uint64_t)) {
+    uint64_t count = 0;
+
+    int64_t x = start_x, y = start_y;
+    while (turtle(bmp, &x, &y, count)) {
+        count++;
+    }
+
+    return count;
+}
+
+/** Number of steps a batched turtle can emit per call. */
+#define BMP_TURTLE_BATCH 4096
+
+typedef struct BmpStep {
+    int64_t x;
+    int64_t y;
+} BmpStep;
+
+/**
+ * @brief Grow a mask that covers a part of the image, so that it also covers a rectangle. It
+ * grows by at least its size on every side that moves, and starts on a word boundary, so that a
+ * walk that keeps leaving it is copied a logarithmic number of times.
+ *
+ * @return the mask, the same one if it already covers the rectangle.
+ */
+static BmpMask* bmp_mask_grow(BmpMask* mask, int64_t* origin_x, int64_t* origin_y, int64_t left,
+                              int64_t top, int64_t right, int64_t bottom, int64_t width,
+                              int64_t height) {
+    int64_t x0 = left, y0 = top, x1 = right, y1 = bottom;
+    if (mask != NULL) {
+        int64_t old_x1 = *origin_x + mask->width, old_y1 = *origin_y + mask->height;
+        if (left >= *origin_x && top >= *origin_y && right <= old_x1 && bottom <= old_y1) {
+            return mask;
+        }
+
+        x0 = left < *origin_x ? (left < *origin_x - mask->width ? left : *origin_x - mask->width)
+                              : *origin_x;
+        y0 = top < *origin_y ? (top < *origin_y - mask->height ? top : *origin_y - mask->height)
+                             : *origin_y;
+        x1 = right > old_x1 ? (right > old_x1 + mask->width ? right : old_x1 + mask->width)
+                            : old_x1;
+        y1 = bottom > old_y1 ? (bottom > old_y1 + mask->height ? bottom : old_y1 + mask->height)
+                             : old_y1;
+    }
+    x0 = x0 < 0 ? 0 : x0 & ~63LL, y0 = y0 < 0 ? 0 : y0;
+    x1 = x1 > width ? width : x1, y1 = y1 > height ? height : y1;
+
+    BmpMask* grown = bmp_mask_create(x1 - x0, y1 - y0);
+    if (mask != NULL) {
+        for (int64_t y = 0; y < mask->height; y++) {
+            memcpy(bmp_mask_row(grown, *origin_y - y0 + y) + (*origin_x - x0) / 64,
+                   bmp_mask_row(mask, y), mask->stride * sizeof(uint64_t));
+        }
+        bmp_mask_free(mask);
+    }
+
+    *origin_x = x0, *origin_y = y0;
+    return grown;
+}
+
+/**
+ * @brief Walk a turtle that emits its steps in batches, every step stamps a rectangle at its
+ * position. Stamps are merged into a bit mask that grows to their bounding box, overlapping
+ * stamps are drawn once, then the mask is drawn as row spans. All drawing happens after the last
+ * batch, so the turtle never sees its own stamps in the image.
+ *
+ * @param bmp the image to draw on
+ * @param start_x the x coordinate where the turtle starts
+ * @param start_y the y coordinate where the turtle starts
+ * @param width the width of the stamp
+ * @param height the height of the stamp
+ * @param pixel the pixel to fill the stamps with
+ * @param turtle writes up to `capacity` steps and moves the walker, `count` is the number of steps
+ * so far, returns the number of steps written or 0 to stop
+ * @return the count of steps
+ */
+uint64_t bmp_turtle_batch(BMP* bmp, int64_t start_x, int64_t start_y, int64_t width,
+                          int64_t height, Pixel pixel,
+                          uint64_t (*turtle)(BMP* bmp, int64_t* x, int64_t* y, BmpStep* steps,
+                                             uint64_t capacity, uint64_t count)) {
+    int64_t bmp_width = bmp->header->info_header.width;
+    int64_t bmp_height = bmp->header->info_header.height;
+    if (width <= 0 || height <= 0) {
+        return 0;
+    }
+
+    BmpMask* covered = NULL;
+    BmpStep* steps = malloc(BMP_TURTLE_BATCH * sizeof(BmpStep));
+    int64_t  origin_x = 0, origin_y = 0;
+    uint64_t count = 0, size;
+
+    int64_t x = start_x, y = start_y;
+    while ((size = turtle(bmp, &x, &y, steps, BMP_TURTLE_BATCH, count)) > 0) {
+        size = size > BMP_TURTLE_BATCH ? BMP_TURTLE_BATCH : size;
+        for (uint64_t i = 0; i < size; i++) {
+            BmpStep step = steps[i];
+            int64_t left = step.x < 0 ? 0 : step.x;
+            int64_t right = step.x + width > bmp_width ? bmp_width : step.x + width;
+            int64_t from = step.y < 0 ? 0 : step.y;
+            int64_t to = step.y + height > bmp_height ? bmp_height : step.y + height;
+            if (left >= right || from >= to) {
+                continue;
+            }
+
+            covered = bmp_mask_grow(covered, &origin_x, &origin_y, left, from, right, to,
+                                    bmp_width, bmp_height);
+            for (int64_t row = from; row < to; row++) {
+                bmp_mask_set_run(covered, row - origin_y, left - origin_x, right - origin_x);
+            }
+        }
+        count += size;
+    }
+
+    // draw every run of covered pixels once
+    for (int64_t row = 0; covered != NULL && row < covered->height; row++) {
+        uint64_t const* bits = bmp_mask_row(covered, row);
+        int64_t const   end = covered->width;
+        for (int64_t from = bmp_mask_next(bits, 0, end, true); from < end;) {
+            int64_t to = bmp_mask_next(bits, from, end, false);
+            bmp_span(bmp, origin_x + from, origin_y + row, to - from, pixel, NULL);
+            from = bmp_mask_next(bits, to, end, true);
+        }
+    }
+
+    free(steps);
+    bmp_mask_free(covered);
+    return count;
+}
+// #endregion
+
+// #region Text.
+/** Glyphs of the embedded font, 5x9 cells for ASCII 32 to 126, one byte per row, MSB first. */
+static uint8_t const bmp_font_glyphs[95 * 9] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // ' '
+    0x20, 0x20, 0x20, 0x20, 0x20, 0x00, 0x20, 0x00, 0x00,  // '!'
+    0x50, 0x50, 0x50, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // '"'
+    0x50, 0x50, 0xF8, 0x50, 0xF8, 0x50, 0x50, 0x00, 0x00,  // '#'
+    0x20, 0x78, 0xA0, 0x70, 0x28, 0xF0, 0x20, 0x00, 0x00,  // '$'
+    0xC0, 0xC8, 0x10, 0x20, 0x40, 0x98, 0x18, 0x00, 0x00,  // '%'
+    0x60, 0x90, 0xA0, 0x40, 0xA8, 0x90, 0x68, 0x00, 0x00,  // '&'
+    0x20, 0x20, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // '\''
+    0x10, 0x20, 0x40, 0x40, 0x40, 0x20, 0x10, 0x00, 0x00,  // '('
+    0x40, 0x20, 0x10, 0x10, 0x10, 0x20, 0x40, 0x00, 0x00,  // ')'
+    0x00, 0x20, 0xA8, 0x70, 0xA8, 0x20, 0x00, 0x00, 0x00,  // '*'
+    0x00, 0x20, 0x20, 0xF8, 0x20, 0x20, 0x00, 0x00, 0x00,  // '+'
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x60, 0x20, 0x40, 0x00,  // ','
+    0x00, 0x00, 0x00, 0xF8, 0x00, 0x00, 0x00, 0x00, 0x00,  // '-'
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x60, 0x60, 0x00, 0x00,  // '.'
+    0x00, 0x08, 0x10, 0x20, 0x40, 0x80, 0x00, 0x00, 0x00,  // '/'
+    0x70, 0x88, 0x98, 0xA8, 0xC8, 0x88, 0x70, 0x00, 0x00,  // '0'
+    0x20, 0x60, 0x20, 0x20, 0x20, 0x20, 0x70, 0x00, 0x00,  // '1'
+    0x70, 0x88, 0x08, 0x10, 0x20, 0x40, 0xF8, 0x00, 0x00,  // '2'
+    0xF8, 0x10, 0x20, 0x10, 0x08, 0x88, 0x70, 0x00, 0x00,  // '3'
+    0x10, 0x30, 0x50, 0x90, 0xF8, 0x10, 0x10, 0x00, 0x00,  // '4'
+    0xF8, 0x80, 0xF0, 0x08, 0x08, 0x88, 0x70, 0x00, 0x00,  // '5'
+    0x30, 0x40, 0x80, 0xF0, 0x88, 0x88, 0x70, 0x00, 0x00,  // '6'
+    0xF8, 0x08, 0x10, 0x20, 0x40, 0x40, 0x40, 0x00, 0x00,  // '7'
+    0x70, 0x88, 0x88, 0x70, 0x88, 0x88, 0x70, 0x00, 0x00,  // '8'
+    0x70, 0x88, 0x88, 0x78, 0x08, 0x10, 0x60, 0x00, 0x00,  // '9'
+    0x00, 0x60, 0x60, 0x00, 0x60, 0x60, 0x00, 0x00, 0x00,  // ':'
+    0x00, 0x60, 0x60, 0x00, 0x60, 0x20, 0x40, 0x00, 0x00,  // ';'
+    0x10, 0x20, 0x40, 0x80, 0x40, 0x20, 0x10, 0x00, 0x00,  // '<'
+    0x00, 0x00, 0xF8, 0x00, 0xF8, 0x00, 0x00, 0x00, 0x00,  // '='
+    0x40, 0x20, 0x10, 0x08, 0x10, 0x20, 0x40, 0x00, 0x00,  // '>'
+    0x70, 0x88, 0x08, 0x10, 0x20, 0x00, 0x20, 0x00, 0x00,  // '?'
+    0x70, 0x88, 0x08, 0x68, 0xA8, 0xA8, 0x70, 0x00, 0x00,  // '@'
+    0x70, 0x88, 0x88, 0xF8, 0x88, 0x88, 0x88, 0x00, 0x00,  // 'A'
+    0xF0, 0x88, 0x88, 0xF0, 0x88, 0x88, 0xF0, 0x00, 0x00,  // 'B'
+    0x70, 0x88, 0x80, 0x80, 0x80, 0x88, 0x70, 0x00, 0x00,  // 'C'
+    0xE0, 0x90, 0x88, 0x88, 0x88, 0x90, 0xE0, 0x00, 0x00,  // 'D'
+    0xF8, 0x80, 0x80, 0xF0, 0x80, 0x80, 0xF8, 0x00, 0x00,  // 'E'
+    0xF8, 0x80, 0x80, 0xF0, 0x80, 0x80, 0x80, 0x00, 0x00,  // 'F'
+    0x70, 0x88, 0x80, 0xB8, 0x88, 0x88, 0x78, 0x00, 0x00,  // 'G'
+    0x88, 0x88, 0x88, 0xF8, 0x88, 0x88, 0x88, 0x00, 0x00,  // 'H'
+    0x70, 0x20, 0x20, 0x20, 0x20, 0x20, 0x70, 0x00, 0x00,  // 'I'
+    0x38, 0x10, 0x10, 0x10, 0x10, 0x90, 0x60, 0x00, 0x00,  // 'J'
+    0x88, 0x90, 0xA0, 0xC0, 0xA0, 0x90, 0x88, 0x00, 0x00,  // 'K'
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0xF8, 0x00, 0x00,  // 'L'
+    0x88, 0xD8, 0xA8, 0xA8, 0x88, 0x88, 0x88, 0x00, 0x00,  // 'M'
+    0x88, 0x88, 0xC8, 0xA8, 0x98, 0x88, 0x88, 0x00, 0x00,  // 'N'
+    0x70, 0x88, 0x88, 0x88, 0x88, 0x88, 0x70, 0x00, 0x00,  // 'O'
+    0xF0, 0x88, 0x88, 0xF0, 0x80, 0x80, 0x80, 0x00, 0x00,  // 'P'
+    0x70, 0x88, 0x88, 0x88, 0xA8, 0x90, 0x68, 0x00, 0x00,  // 'Q'
+    0xF0, 0x88, 0x88, 0xF0, 0xA0, 0x90, 0x88, 0x00, 0x00,  // 'R'
+    0x78, 0x80, 0x80, 0x70, 0x08, 0x08, 0xF0, 0x00, 0x00,  // 'S'
+    0xF8, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x00, 0x00,  // 'T'
+    0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x70, 0x00, 0x00,  // 'U'
+    0x88, 0x88, 0x88, 0x88, 0x88, 0x50, 0x20, 0x00, 0x00,  // 'V'
+    0x88, 0x88, 0x88, 0xA8, 0xA8, 0xA8, 0x50, 0x00, 0x00,  // 'W'
+    0x88, 0x88, 0x50, 0x20, 0x50, 0x88, 0x88, 0x00, 0x00,  // 'X'
+    0x88, 0x88, 0x88, 0x50, 0x20, 0x20, 0x20, 0x00, 0x00,  // 'Y'
+    0xF8, 0x08, 0x10, 0x20, 0x40, 0x80, 0xF8, 0x00, 0x00,  // 'Z'
+    0x70, 0x40, 0x40, 0x40, 0x40, 0x40, 0x70, 0x00, 0x00,  // '['
+    0x00, 0x80, 0x40, 0x20, 0x10, 0x08, 0x00, 0x00, 0x00,  // '\\'
+    0x70, 0x10, 0x10, 0x10, 0x10, 0x10, 0x70, 0x00, 0x00,  // ']'
+    0x20, 0x50, 0x88, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // '^'
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xF8, 0x00,  // '_'
+    0x40, 0x20, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // '`'
+    0x00, 0x00, 0x70, 0x08, 0x78, 0x88, 0x78, 0x00, 0x00,  // 'a'
+    0x80, 0x80, 0xB0, 0xC8, 0x88, 0x88, 0xF0, 0x00, 0x00,  // 'b'
+    0x00, 0x00, 0x70, 0x80, 0x80, 0x88, 0x70, 0x00, 0x00,  // 'c'
+    0x08, 0x08, 0x68, 0x98, 0x88, 0x88, 0x78, 0x00, 0x00,  // 'd'
+    0x00, 0x00, 0x70, 0x88, 0xF8, 0x80, 0x70, 0x00, 0x00,  // 'e'
+    0x30, 0x48, 0x40, 0xE0, 0x40, 0x40, 0x40, 0x00, 0x00,  // 'f'
+    0x00, 0x00, 0x78, 0x88, 0x88, 0x88, 0x78, 0x08, 0x70,  // 'g'
+    0x80, 0x80, 0xB0, 0xC8, 0x88, 0x88, 0x88, 0x00, 0x00,  // 'h'
+    0x20, 0x00, 0x60, 0x20, 0x20, 0x20, 0x70, 0x00, 0x00,  // 'i'
+    0x10, 0x00, 0x30, 0x10, 0x10, 0x10, 0x10, 0x90, 0x60,  // 'j'
+    0x80, 0x80, 0x90, 0xA0, 0xC0, 0xA0, 0x90, 0x00, 0x00,  // 'k'
+    0x60, 0x20, 0x20, 0x20, 0x20, 0x20, 0x70, 0x00, 0x00,  // 'l'
+    0x00, 0x00, 0xD0, 0xA8, 0xA8, 0x88, 0x88, 0x00, 0x00,  // 'm'
+    0x00, 0x00, 0xB0, 0xC8, 0x88, 0x88, 0x88, 0x00, 0x00,  // 'n'
+    0x00, 0x00, 0x70, 0x88, 0x88, 0x88, 0x70, 0x00, 0x00,  // 'o'
+    0x00, 0x00, 0xF0, 0x88, 0x88, 0x88, 0xF0, 0x80, 0x80,  // 'p'
+    0x00, 0x00, 0x78, 0x88, 0x88, 0x88, 0x78, 0x08, 0x08,  // 'q'
+    0x00, 0x00, 0xB0, 0xC8, 0x80, 0x80, 0x80, 0x00, 0x00,  // 'r'
+    0x00, 0x00, 0x78, 0x80, 0x70, 0x08, 0xF0, 0x00, 0x00,  // 's'
+    0x40, 0x40, 0xE0, 0x40, 0x40, 0x48, 0x30, 0x00, 0x00,  // 't'
+    0x00, 0x00, 0x88, 0x88, 0x88, 0x98, 0x68, 0x00, 0x00,  // 'u'
+    0x00, 0x00, 0x88, 0x88, 0x88, 0x50, 0x20, 0x00, 0x00,  // 'v'
+    0x00, 0x00, 0x88, 0x88, 0xA8, 0xA8, 0x50, 0x00, 0x00,  // 'w'
+    0x00, 0x00, 0x88, 0x50, 0x20, 0x50, 0x88, 0x00, 0x00,  // 'x'
+    0x00, 0x00, 0x88, 0x88, 0x88, 0x88, 0x78, 0x08, 0x70,  // 'y'
+    0x00, 0x00, 0xF8, 0x10, 0x20, 0x40, 0xF8, 0x00, 0x00,  // 'z'
+    0x18, 0x20, 0x20, 0xC0, 0x20, 0x20, 0x18, 0x00, 0x00,  // '{'
+    0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x00, 0x00,  // '|'
+    0xC0, 0x20, 0x20, 0x18, 0x20, 0x20, 0xC0, 0x00, 0x00,  // '}'
+    0x00, 0x00, 0x40, 0xA8, 0x10, 0x00, 0x00, 0x00, 0x00,  // '~'
+};
+
+/**
+ * Glyph coverage masks of a font rasterized at one size, every glyph occupies a `width` x `height`
+ * cell of `coverage`, with the covered columns of each row and the covered rows of each glyph
+ * precomputed so that blitting only visits covered pixels.
+ */
+typedef struct BmpGlyphAtlas {
+    uint32_t              size;
+    uint32_t              width;
+    uint32_t              height;
+    uint32_t              advance;
+    uint32_t              line;
+    uint8_t*              coverage;
+    /** `left, right` of every glyph row, `right == left` for empty rows. */
+    uint16_t*             columns;
+    /** `top, bottom` of every glyph. */
+    uint16_t*             rows;
+    struct BmpGlyphAtlas* next;
+} BmpGlyphAtlas;
+
+typedef struct BmpFont {
+    /** Glyph bitmap size in pixels. */
+    uint32_t        width;
+    uint32_t        height;
+    /** Horizontal advance between glyphs and vertical advance between lines. */
+    uint32_t        advance;
+    uint32_t        line;
+    /** The character of the first glyph, and the number of glyphs. */
+    uint32_t        first;
+    uint32_t        count;
+    /** Bytes per glyph row, rows are MSB first. */
+    uint32_t        stride;
+    uint8_t const*  glyphs;
+    /** Glyph storage owned by a loaded font, NULL for the embedded font. */
+    uint8_t*        owned;
+    BmpGlyphAtlas*  atlases;
+    pthread_mutex_t lock;
+} BmpFont;
+
+static BmpFont bmp_font_embedded = {
+    5, 9, 6, 11, 32, 95, 1, bmp_font_glyphs, NULL, NULL, PTHREAD_MUTEX_INITIALIZER,
+};
+
+/**
+ * @brief Get the embedded 5x9 ASCII font.
+ *
+ * @return the embedded font, it must not be freed.
+ */
+BmpFont* bmp_font_default(void) { return &bmp_font_embedded; }
+
+static BmpFont* bmp_font_alloc(uint32_t width, uint32_t height, uint32_t first, uint32_t count) {
+    BmpFont* font = calloc(1, sizeof(BmpFont));
+    font->width = width, font->height = height;
+    font->advance = width, font->line = height;
+    font->first = first, font->count = count;
+    font->stride = (width + 7) / 8;
+    font->owned = calloc((size_t)count * height * font->stride, 1);
+    font->glyphs = font->owned;
+    pthread_mutex_init(&font->lock, NULL);
+    return font;
+}
+
+/**
+ * @brief Free a loaded font and its glyph atlases.
+ *
+ * @param font the font to free
+ * @return true if the font was freed, false for NULL or the embedded font
+ */
+bool bmp_font_free(BmpFont* font) {
+    if (font == NULL || font == &bmp_font_embedded) {
+        return false;
+    }
+
+    BmpGlyphAtlas* atlas = font->atlases;
+    while (atlas != NULL) {
+        BmpGlyphAtlas* next = atlas->next;
+        free(atlas->coverage), free(atlas->columns), free(atlas->rows), free(atlas);
+        atlas = next;
+    }
+    pthread_mutex_destroy(&font->lock);
+    free(font->owned);
+    free(font);
+    return true;
+}
+
+static bool bmp_font_read(FILE* file, void* buffer, size_t size) {
+    return fread(buffer, 1, size, file) == size;
+}
+
+static inline uint32_t bmp_font_u32(uint8_t const* bytes) {
+    return bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 |
+           (uint32_t)bytes[3] << 24;
+}
+
+/** BDF fonts are read line by line, only glyphs with an encoding from 0 to 255 are kept. */
+static BmpFont* bmp_font_load_bdf(FILE* file) {
+    BmpFont* font = NULL;
+    char     line[256];
+    int32_t  box_width = 0, box_height = 0, box_x = 0, box_y = 0;
+    int32_t  encoding = -1, width = 0, height = 0, x = 0, y = 0, row = -1;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "FONTBOUNDINGBOX %d %d %d %d", &box_width, &box_height, &box_x,
+                   &box_y) == 4) {
+            if (font != NULL || box_width <= 0 || box_height <= 0 || box_width > 256 ||
+                box_height > 256) {
+                break;
+            }
+            font = bmp_font_alloc(box_width, box_height, 0, 256);
+        } else if (sscanf(line, "ENCODING %d", &encoding) == 1) {
+            row = -1;
+        } else if (sscanf(line, "BBX %d %d %d %d", &width, &height, &x, &y) == 4) {
+            continue;
+        } else if (strncmp(line, "BITMAP", 6) == 0) {
+            row = 0;
+        } else if (strncmp(line, "ENDCHAR", 7) == 0) {
+            encoding = -1, row = -1;
+        } else if (font != NULL && row >= 0 && encoding >= 0 && encoding < 256) {
+            // the glyph box is placed relative to the baseline of the font box
+            int32_t  top = (box_y + box_height) - (y + height) + row++;
+            uint8_t* glyph = font->owned + (size_t)encoding * font->height * font->stride;
+            for (int32_t i = 0; i < width && line[i / 4] != '\0'; i++) {
+                char    digit = line[i / 4];
+                int32_t value = digit <= '9' ? digit - '0' : (digit | 0x20) - 'a' + 10;
+                int32_t column = x - box_x + i;
+                if (value < 0 || value > 15 || top < 0 || top >= box_height || column < 0 ||
+                    column >= box_width || !((value >> (3 - i % 4)) & 1)) {
+                    continue;
+                }
+                glyph[top * font->stride + column / 8] |= 0x80 >> (column % 8);
+            }
+        }
+    }
+
+    return font;
+}
+
+/**
+ * @brief Load a bitmap font from a PSF (version 1 or 2) or BDF file. Glyphs are indexed by the
+ * byte value of the characters.
+ *
+ * @param path the path of the font file
+ * @return the font, or NULL if it cannot be read
+ */
+BmpFont* bmp_font_load(char const* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    BmpFont* font = NULL;
+    uint8_t  header[32];
+    if (!bmp_font_read(file, header, 4)) {
+        fclose(file);
+        return NULL;
+    }
+
+    if (header[0] == 0x36 && header[1] == 0x04) {
+        // PSF 1: 8 pixels wide, 256 or 512 glyphs of `header[3]` rows
+        font = bmp_font_alloc(8, header[3], 0, header[2] & 1 ? 512 : 256);
+        if (font->height == 0 ||
+            !bmp_font_read(file, font->owned, (size_t)font->count * font->height)) {
+            bmp_font_free(font);
+            font = NULL;
+        }
+    } else if (header[0] == 0x72 && header[1] == 0xB5 && header[2] == 0x4A && header[3] == 0x86) {
+        uint32_t size = 0, count = 0, bytes = 0, height = 0, width = 0;
+        if (bmp_font_read(file, header + 4, 28)) {
+            size = bmp_font_u32(header + 8), count = bmp_font_u32(header + 16);
+            bytes = bmp_font_u32(header + 20);
+            height = bmp_font_u32(header + 24), width = bmp_font_u32(header + 28);
+        }
+        if (width > 0 && width <= 256 && height > 0 && height <= 256 && count > 0 &&
+            count <= 0x10000 && bytes == height * ((width + 7) / 8) && size >= 32 &&
+            fseek(file, size, SEEK_SET) == 0) {
+            font = bmp_font_alloc(width, height, 0, count);
+            if (!bmp_font_read(file, font->owned, (size_t)count * bytes)) {
+                bmp_font_free(font);
+                font = NULL;
+            }
+        }
+    } else if (memcmp(header, "STAR", 4) == 0) {
+        font = bmp_font_load_bdf(file);
+    }
+
+    fclose(file);
+    return font;
+}
+
+/**
+ * Area-average the glyph bitmaps into coverage masks of `size` pixels high, integer multiples of
+ * the font height give exact 0 / 255 masks, other sizes get smooth edges.
+ */
+static BmpGlyphAtlas* bmp_glyph_atlas_build(BmpFont const* font, uint32_t size) {
+    double         scale = (double)size / font->height, step = 1.0 / scale;
+    BmpGlyphAtlas* atlas = calloc(1, sizeof(BmpGlyphAtlas));
+    atlas->size = size;
+    atlas->width = (uint32_t)ceil(font->width * scale - 1e-9);
+    atlas->width = atlas->width > 0 ? atlas->width : 1;
+    atlas->height = size;
+    atlas->advance = (uint32_t)lround(font->advance * scale);
+    atlas->line = (uint32_t)lround(font->line * scale);
+
+    size_t cell = (size_t)atlas->width * atlas->height;
+    atlas->coverage = calloc(cell * font->count, 1);
+    atlas->columns = calloc((size_t)font->count * atlas->height * 2, sizeof(uint16_t));
+    atlas->rows = calloc((size_t)font->count * 2, sizeof(uint16_t));
+
+    for (uint32_t glyph = 0; glyph < font->count; glyph++) {
+        uint8_t const* bits = font->glyphs + (size_t)glyph * font->height * font->stride;
+        uint8_t*       coverage = atlas->coverage + glyph * cell;
+        uint16_t*      columns = atlas->columns + (size_t)glyph * atlas->height * 2;
+        uint16_t       top = atlas->height, bottom = 0;
+
+        for (uint32_t y = 0; y < atlas->height; y++) {
+            double   y0 = y * step, y1 = (y + 1) * step;
+            uint16_t left = atlas->width, right = 0;
+            for (uint32_t x = 0; x < atlas->width; x++) {
+                double x0 = x * step, x1 = (x + 1) * step, area = 0;
+                for (uint32_t sy = (uint32_t)y0; sy < font->height && sy < y1; sy++) {
+                    double height = fmin(y1, sy + 1) - fmax(y0, sy);
+                    for (uint32_t sx = (uint32_t)x0; sx < font->width && sx < x1; sx++) {
+                        if ((bits[sy * font->stride + sx / 8] << (sx % 8)) & 0x80) {
+                            area += height * (fmin(x1, sx + 1) - fmax(x0, sx));
+                        }
+                    }
+                }
+
+                long value = lround(area * scale * scale * 0xFF);
+                coverage[y * atlas->width + x] = value > 0xFF ? 0xFF : value;
+                if (coverage[y * atlas->width + x] != 0) {
+                    left = x < left ? x : left;
+                    right = x + 1;
+                }
+            }
+
+            columns[y * 2] = left < right ? left : 0;
+            columns[y * 2 + 1] = right;
+            if (left < right) {
+                top = y < top ? y : top;
+                bottom = y + 1;
+            }
+        }
+
+        atlas->rows[glyph * 2] = top < bottom ? top : 0;
+        atlas->rows[glyph * 2 + 1] = bottom;
+    }
+
+    return atlas;
+}
+
+/**
+ * @brief Get the glyph atlas of a font at a size, rasterizing it on first use. Atlases live as
+ * long as the font.
+ *
+ * @param font the font
+ * @param size the line height in pixels, 0 for the native height of the font
+ * @return the glyph atlas
+ */
+BmpGlyphAtlas* bmp_glyph_atlas(BmpFont* font, uint32_t size) {
+    size = size == 0 ? font->height : size;
+
+    pthread_mutex_lock(&font->lock);
+    BmpGlyphAtlas* atlas = font->atlases;
+    while (atlas != NULL && atlas->size != size) {
+        atlas = atlas->next;
+    }
+    if (atlas == NULL) {
+        atlas = bmp_glyph_atlas_build(font, size);
+        atlas->next = font->atlases;
+        font->atlases = atlas;
+    }
+    pthread_mutex_unlock(&font->lock);
+
+    return atlas;
+}
+
+static inline int64_t bmp_glyph_index(BmpFont const* font, uint8_t character) {
+    if (character >= font->first && character - font->first < font->count) {
+        return character - font->first;
+    }
+    if ('?' >= font->first && '?' - font->first < font->count) {
+        return '?' - font->first;
+    }
+    return -1;
+}
+
+/**
+ * @brief Count the characters of the longest line and the lines of a text.
+ */
+static inline void bmp_text_columns(char const* text, int64_t* columns, int64_t* lines) {
+    int64_t column = 0;
+    *columns = 0, *lines = 1;
+    for (char const* c = text; *c != '\0'; c++) {
+        if (*c == '\n') {
+            (*lines)++, column = 0;
+        } else if (++column > *columns) {
+            *columns = column;
+        }
+    }
+}
+
+/**
+ * @brief Measure the box a text takes when drawn.
+ *
+ * @param font the font, NULL for the embedded font
+ * @param size the line height in pixels, 0 for the native height of the font
+ * @param text the text, lines are separated by '\\n'
+ * @param width the width of the longest line
+ * @param height the height of all lines
+ */
+void bmp_text_size(BmpFont* font, uint32_t size, char const* text, int64_t* width,
+                   int64_t* height) {
+    BmpGlyphAtlas const* atlas = bmp_glyph_atlas(font != NULL ? font : &bmp_font_embedded, size);
+
+    int64_t columns, lines;
+    bmp_text_columns(text, &columns, &lines);
+    *width = columns * atlas->advance;
+    *height = (lines - 1) * atlas->line + atlas->height;
+}
+
+/**
+ * @brief Draw a text with a bitmap font. Glyphs are blitted from the coverage masks of the glyph
+ * atlas as spans, glyphs that fall outside of the image are skipped without touching pixels.
+ *
+ * @param bmp the image to draw on
+ * @param font the font, NULL for the embedded font
+ * @param x the x coordinate of the top left corner of the text
+ * @param y the y coordinate of the top left corner of the text
+ * @param size the line height in pixels, 0 for the native height of the font
+ * @param pixel the color of the text
+ * @param text the text, lines are separated by '\\n'
+ * @return the count of pixels that were drawn
+ */
+uint64_t bmp_text(BMP* bmp, BmpFont* font, int64_t x, int64_t y, uint32_t size, Pixel pixel,
+                  char const* text) {
+    font = font != NULL ? font : &bmp_font_embedded;
+    BmpGlyphAtlas const* atlas = bmp_glyph_atlas(font, size);
+    int64_t              width = bmp->header->info_header.width;
+    int64_t              height = bmp->header->info_header.height;
+    size_t               cell = (size_t)atlas->width * atlas->height;
+
+    uint64_t count = 0;
+    int64_t  pen_x = x, pen_y = y;
+    for (char const* c = text; *c != '\0'; c++) {
+        if (*c == '\n') {
+            pen_x = x, pen_y += atlas->line;
+            continue;
+        }
+
+        int64_t glyph = bmp_glyph_index(font, (uint8_t)*c);
+        if (glyph >= 0 && pen_x < width && pen_x + atlas->width > 0 && pen_y < height &&
+            pen_y + atlas->height > 0) {
+            uint8_t const*  coverage = atlas->coverage + glyph * cell;
+            uint16_t const* columns = atlas->columns + glyph * atlas->height * 2;
+            for (int64_t row = atlas->rows[glyph * 2]; row < atlas->rows[glyph * 2 + 1]; row++) {
+                int64_t left = columns[row * 2], right = columns[row * 2 + 1];
+                if (left < right) {
+                    count += bmp_span(bmp, pen_x + left, pen_y + row, right - left, pixel,
+                                      coverage + row * atlas->width + left);
+                }
+            }
+        }
+        pen_x += atlas->advance;
+    }
+
+    return count;
+}
+// #endregion
+
+// #region Gradients.
+/**
+ * @brief Interpolate two rows of pixels, the span version of `blend` in integer arithmetic.
+ *
+ * @param a the first pixels.
+ * @param b the second pixels.
+ * @param dst the blended pixels, can be the same as `a` or `b`.
+ * @param length the number of pixels.
+ * @param weights the weight of every pixel from 0 (a) to 255 (b), NULL to use `weight`.
+ * @param weight the constant weight from 0 (a) to 255 (b).
+ */
+void bmp_blend_span(Pixel const* a, Pixel const* b, Pixel* dst, int64_t length,
+                    uint8_t const* weights, uint8_t weight) {
+    int64_t x = 0;
+#if defined(BMP_SSE2)
+    __m128i const zero = _mm_setzero_si128(), bias = _mm_set1_epi16(128);
+    __m128i const full = _mm_set1_epi16(0xFF);
+    __m128i       low = _mm_set1_epi16(weight), high = low;
+    for (; x + 4 <= length; x += 4) {
+        if (weights != NULL) {
+            // repeat the weight of every pixel over its 4 channels
+            uint32_t packed;
+            memcpy(&packed, weights + x, sizeof(uint32_t));
+            __m128i pairs = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+            pairs = _mm_unpacklo_epi16(pairs, pairs);
+            low = _mm_unpacklo_epi32(pairs, pairs), high = _mm_unpackhi_epi32(pairs, pairs);
+        }
+
+        __m128i first = _mm_loadu_si128((__m128i const*)(a + x));
+        __m128i second = _mm_loadu_si128((__m128i const*)(b + x));
+        __m128i sums[2] = {
+            _mm_add_epi16(
+                _mm_mullo_epi16(_mm_unpacklo_epi8(first, zero), _mm_sub_epi16(full, low)),
+                _mm_mullo_epi16(_mm_unpacklo_epi8(second, zero), low)),
+            _mm_add_epi16(
+                _mm_mullo_epi16(_mm_unpackhi_epi8(first, zero), _mm_sub_epi16(full, high)),
+                _mm_mullo_epi16(_mm_unpackhi_epi8(second, zero), high)),
+        };
+        for (int32_t h = 0; h < 2; h++) {
+            sums[h] = _mm_add_epi16(sums[h], bias);
+            sums[h] = _mm_srli_epi16(_mm_add_epi16(sums[h], _mm_srli_epi16(sums[h], 8)), 8);
+        }
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(sums[0], sums[1]));
+    }
+#endif
+    for (; x < length; x++) {
+        uint32_t w = weights != NULL ? weights[x] : weight, keep = 0xFF - w;
+        dst[x] = (Pixel){bmp_div255(a[x].red * keep + b[x].red * w),
+                         bmp_div255(a[x].green * keep + b[x].green * w),
+                         bmp_div255(a[x].blue * keep + b[x].blue * w),
+                         bmp_div255(a[x].alpha * keep + b[x].alpha * w)};
+    }
+}
+
+/** Number of colors in the lookup table of a gradient. */
+#define BMP_GRADIENT_STEPS 1024
+
+/** Fractional bits of the gradient position, 1 << BMP_GRADIENT_BITS is the end of the gradient. */
+#define BMP_GRADIENT_BITS 16
+
+enum BMP_GRADIENT_TYPE {
+    BMP_GRADIENT_LINEAR = 0,
+    BMP_GRADIENT_RADIAL,
+};
+
+/** What a gradient does past its ends. */
+enum BMP_SPREAD {
+    BMP_SPREAD_PAD = 0,
+    BMP_SPREAD_REPEAT,
+    BMP_SPREAD_REFLECT,
+};
+
+typedef struct BmpStop {
+    /** The position of the stop, from 0 to 1. */
+    double offset;
+    Pixel  pixel;
+} BmpStop;
+
+typedef struct BmpGradient {
+    uint8_t type;
+    uint8_t spread;
+    bool    opaque;
+    /** Linear: start and end points. Radial: center and radius. */
+    double  x0;
+    double  y0;
+    double  x1;
+    double  y1;
+    double  radius;
+    Pixel   colors[BMP_GRADIENT_STEPS];
+    Pixel   premultiplied[BMP_GRADIENT_STEPS];
+} BmpGradient;
+
+static BmpGradient* bmp_gradient_create(BmpStop const* stops, uint32_t count, uint8_t spread) {
+    BmpGradient* gradient = calloc(1, sizeof(BmpGradient));
+    gradient->spread = spread;
+    gradient->opaque = true;
+
+    uint32_t stop = 0;
+    for (uint32_t i = 0; i < BMP_GRADIENT_STEPS; i++) {
+        double t = (i + 0.5) / BMP_GRADIENT_STEPS;
+        while (stop < count && stops[stop].offset <= t) {
+            stop++;
+        }
+
+        Pixel color;
+        if (count == 0) {
+            color = PIXEL_TRANSPARENT;
+        } else if (stop == 0) {
+            color = stops[0].pixel;
+        } else if (stop == count) {
+            color = stops[count - 1].pixel;
+        } else {
+            BmpStop const* from = &stops[stop - 1];
+            BmpStop const* to = &stops[stop];
+            double         span = to->offset - from->offset;
+            uint32_t       w = span > 0 ? (uint32_t)lround((t - from->offset) / span * 0xFF) : 0;
+            bmp_blend_span(&from->pixel, &to->pixel, &color, 1, NULL, w);
+        }
+
+        gradient->colors[i] = color;
+        gradient->premultiplied[i] = bmp_premultiply_pixel(color);
+        gradient->opaque = gradient->opaque && color.alpha == 0xFF;
+    }
+
+    return gradient;
+}
+
+/**
+ * @brief Create a linear gradient, the colors are constant along lines perpendicular to the
+ * segment from the start to the end.
+ *
+ * @param stops the color stops, sorted by offset.
+ * @param count the number of stops.
+ * @param spread what to do past the ends, one of BMP_SPREAD.
+ * @param x0 the x coordinate of the start, at offset 0.
+ * @param y0 the y coordinate of the start.
+ * @param x1 the x coordinate of the end, at offset 1.
+ * @param y1 the y coordinate of the end.
+ * @return the gradient.
+ */
+BmpGradient* bmp_gradient_linear(BmpStop const* stops, uint32_t count, uint8_t spread, double x0,
+                                 double y0, double x1, double y1) {
+    BmpGradient* gradient = bmp_gradient_create(stops, count, spread);
+    gradient->type = BMP_GRADIENT_LINEAR;
+    gradient->x0 = x0, gradient->y0 = y0, gradient->x1 = x1, gradient->y1 = y1;
+    return gradient;
+}
+
+/**
+ * @brief Create a radial gradient, the colors are constant along circles around the center.
+ *
+ * @param stops the color stops, sorted by offset.
+ * @param count the number of stops.
+ * @param spread what to do past the ends, one of BMP_SPREAD.
+ * @param center_x the x coordinate of the center, at offset 0.
+ * @param center_y the y coordinate of the center.
+ * @param radius the radius, at offset 1.
+ * @return the gradient.
+ */
+BmpGradient* bmp_gradient_radial(BmpStop const* stops, uint32_t count, uint8_t spread,
+                                 double center_x, double center_y, double radius) {
+    BmpGradient* gradient = bmp_gradient_create(stops, count, spread);
+    gradient->type = BMP_GRADIENT_RADIAL;
+    gradient->x0 = center_x, gradient->y0 = center_y, gradient->radius = radius;
+    return gradient;
+}
+
+void bmp_gradient_free(BmpGradient* gradient) { free(gradient); }
+
+/** Map a gradient position to an index of the lookup table. */
+static inline uint32_t bmp_gradient_index(uint8_t spread, int64_t t) {
+    int64_t const end = 1 << BMP_GRADIENT_BITS;
+    switch (spread) {
+        case BMP_SPREAD_REPEAT:
+            t &= end - 1;
+            break;
+        case BMP_SPREAD_REFLECT:
+            t &= 2 * end - 1;
+            t = t >= end ? 2 * end - 1 - t : t;
+            break;
+        default:
+            t = t < 0 ? 0 : t >= end ? end - 1 : t;
+    }
+    return (uint32_t)t * BMP_GRADIENT_STEPS >> BMP_GRADIENT_BITS;
+}
+
+/**
+ * @brief Generate a row of a gradient. Linear gradients step the position in 32.32 fixed point,
+ * radial gradients compute 2 distances at once in double precision.
+ *
+ * @param gradient the gradient.
+ * @param x the x coordinate of the first pixel.
+ * @param y the y coordinate of the row.
+ * @param length the number of pixels.
+ * @param premultiplied generate premultiplied pixels.
+ * @param dst the generated pixels.
+ */
+void bmp_gradient_row(BmpGradient const* gradient, int64_t x, int64_t y, int64_t length,
+                      bool premultiplied, Pixel* dst) {
+    Pixel const* colors = premultiplied ? gradient->premultiplied : gradient->colors;
+    double       px = x + 0.5 - gradient->x0, py = y + 0.5 - gradient->y0;
+
+    if (gradient->type == BMP_GRADIENT_LINEAR) {
+        double dx = gradient->x1 - gradient->x0, dy = gradient->y1 - gradient->y0;
+        double length_squared = dx * dx + dy * dy;
+        double scale = length_squared > 0 ? 4294967296.0 / length_squared : 0;
+
+        // the position in 32.32 fixed point, where 1.0 is the end of the gradient
+        int64_t t = (int64_t)llround((px * dx + py * dy) * scale);
+        int64_t step = (int64_t)llround(dx * scale);
+        if (step == 0) {
+            Pixel color = colors[bmp_gradient_index(gradient->spread, t >> 16)];
+            for (int64_t i = 0; i < length; i++) {
+                dst[i] = color;
+            }
+            return;
+        }
+        for (int64_t i = 0; i < length; i++, t += step) {
+            dst[i] = colors[bmp_gradient_index(gradient->spread, t >> 16)];
+        }
+        return;
+    }
+
+    double  scale = gradient->radius > 0 ? (1 << BMP_GRADIENT_BITS) / gradient->radius : 0;
+    int64_t i = 0;
+#if defined(BMP_SSE2)
+    // every pixel goes through the same double lanes, so its color does not depend on where the
+    // row starts, an odd last pixel uses half of a pair. Distances are clamped so that they stay
+    // in range of 32-bit integers.
+    __m128d const limit = _mm_set1_pd(1 << 30), factor = _mm_set1_pd(scale);
+    __m128d const dy2 = _mm_set1_pd(py * py), origin = _mm_set1_pd(px);
+    for (; i < length; i += 2) {
+        __m128d dx = _mm_add_pd(origin, _mm_setr_pd((double)i, (double)(i + 1)));
+        __m128d distance = _mm_mul_pd(_mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dx, dx), dy2)), factor);
+        int32_t positions[4];
+        _mm_storeu_si128((__m128i*)positions, _mm_cvttpd_epi32(_mm_min_pd(distance, limit)));
+        dst[i] = colors[bmp_gradient_index(gradient->spread, positions[0])];
+        if (i + 1 < length) {
+            dst[i + 1] = colors[bmp_gradient_index(gradient->spread, positions[1])];
+        }
+    }
+#endif
+    for (; i < length; i++) {
+        double distance = sqrt((px + i) * (px + i) + py * py) * scale;
+        int64_t position = distance < (1 << 30) ? (int64_t)distance : (1 << 30);
+        dst[i] = colors[bmp_gradient_index(gradient->spread, position)];
+    }
+}
+
+typedef struct BmpGradientJob {
+    BMP*               bmp;
+    BmpGradient const* gradient;
+    int64_t            x;
+    int64_t            y;
+    int64_t            width;
+} BmpGradientJob;
+
+static void bmp_gradient_rows(void* context, int64_t from, int64_t to) {
+    BmpGradientJob const* job = (BmpGradientJob*)context;
+    bool                  premultiplied = job->bmp->premultiplied;
+    Pixel*                scratch = NULL;
+    if (!job->gradient->opaque) {
+        scratch = malloc(job->width * sizeof(Pixel));
+    }
+    for (int64_t row = job->y + from; row < job->y + to; row++) {
+        Pixel* dst = bmp_row(job->bmp, row) + job->x;
+        if (scratch == NULL) {
+            bmp_gradient_row(job->gradient, job->x, row, job->width, premultiplied, dst);
+            continue;
+        }
+
+        bmp_gradient_row(job->gradient, job->x, row, job->width, premultiplied, scratch);
+        for (int64_t i = 0; i < job->width; i++) {
+            dst[i] = premultiplied ? bmp_over_premultiplied(scratch[i], dst[i])
+                                   : bmp_over(scratch[i], dst[i]);
+        }
+    }
+    free(scratch);
+}
+
+/**
+ * @brief Paint a gradient over a rectangle of the image, opaque gradients are written directly
+ * and translucent ones are composited.
+ *
+ * @param bmp the image to draw on
+ * @param gradient the gradient
+ * @param from_x the x coordinate of the top left corner of the rectangle
+ * @param from_y the y coordinate of the top left corner of the rectangle
+ * @param width the width of the rectangle
+ * @param height the height of the rectangle
+ * @return the count of pixels that were drawn
+ */
+uint64_t bmp_gradient_rect(BMP* bmp, BmpGradient const* gradient, int64_t from_x, int64_t from_y,
+                           int64_t width, int64_t height) {
+    int64_t left = from_x < 0 ? 0 : from_x, top = from_y < 0 ? 0 : from_y;
+    int64_t right = from_x + width < bmp->header->info_header.width
+                        ? from_x + width
+                        : bmp->header->info_header.width;
+    int64_t bottom = from_y + height < bmp->header->info_header.height
+                         ? from_y + height
+                         : bmp->header->info_header.height;
+    if (left >= right || top >= bottom) {
+        return 0;
+    }
+
+    BmpGradientJob job = {bmp, gradient, left, top, right - left};
+    bmp_parallel(bottom - top, 32, bmp_gradient_rows, &job);
+    return (uint64_t)(right - left) * (bottom - top);
+}
+// #endregion
+
+// #region File IO, instance management.
+bool bmp_free(BMP* bmp) {
+    if (bmp == NULL) {
+        return false;
+    }
+
+    BITMAPINFOHEADER const* info_header = (BITMAPINFOHEADER*)bmp->header;
+
+    if (bmp->data != NULL) {
+        if (bmp->pixels != NULL) {
+            if (info_header->height > 0) {
+                free(bmp->pixels[0]);
+            }
+            free(bmp->pixels);
+        }
+
+        free(bmp->data);
+    } else if (bmp->pixels != NULL) {
+        for (int64_t y = 0; y < info_header->height; y++) {
+            for (int64_t x = 0; x < info_header->width; x++) {
+                if (bmp->pixels[y][x] != NULL) {
+                    free(bmp->pixels[y][x]);
+                }
+            }
+
+            free(bmp->pixels[y]);
+        }
+
+        free(bmp->pixels);
+    }
+
+    if (bmp->header != NULL) {
         free(bmp->header);
     }
 
-    free(bmp);
+    free(bmp);
+
+    return true;
+}
+
+/** The size of the blocks that rows are read and written in. */
+#define BMP_IO_CHUNK (1 << 20)
+
+/**
+ * @brief Swap red and blue of 32-bit pixels, which turns pixels into BGRA file order and back.
+ *
+ * @param src the pixels to swap.
+ * @param dst where to store the swapped pixels.
+ * @param count the number of pixels.
+ * @param alpha bits to set in every pixel, 0xFF000000 to make them opaque.
+ */
+static inline void bmp_swap_red_blue(uint8_t const* src, uint8_t* dst, int64_t count,
+                                     uint32_t alpha) {
+    int64_t x = 0;
+#if defined(BMP_SSE2)
+    __m128i const green_alpha = _mm_set1_epi32((int)0xFF00FF00), low = _mm_set1_epi32(0xFF);
+    __m128i const opaque = _mm_set1_epi32((int)alpha);
+    for (; x + 4 <= count; x += 4) {
+        __m128i const p = _mm_loadu_si128((__m128i const*)(src + x * 4));
+        __m128i const swapped = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(p, green_alpha), opaque),
+            _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 16), low),
+                         _mm_slli_epi32(_mm_and_si128(p, low), 16)));
+        _mm_storeu_si128((__m128i*)(dst + x * 4), swapped);
+    }
+#endif
+    for (; x < count; x++) {
+        uint8_t const* in = src + x * 4;
+        uint8_t*       out = dst + x * 4;
+        uint8_t const  first = in[0];
+        out[0] = in[2], out[1] = in[1], out[2] = first, out[3] = in[3] | alpha >> 24;
+    }
+}
+
+typedef struct BmpWriter {
+    FILE*    file;
+    int32_t  width;
+    int32_t  height;
+    /** The number of rows written so far. */
+    int32_t  row;
+    /** Rows are written from the top down, the height in the header is negative. */
+    bool     top_down;
+    /** 32-bit pixels only swap red and blue, which is vectorized. */
+    bool     swizzle;
+    uint8_t  pixel_size;
+    uint32_t row_size;
+    /** The rows packed into the buffer, which is written once it holds `rows` rows. */
+    uint32_t rows;
+    uint32_t buffered;
+    uint8_t* buffer;
+    /** The packed value of every channel value, in blue, green, red, alpha order. */
+    uint32_t tables[4][256];
+} BmpWriter;
+
+/**
+ * @brief Open a file to write an image row by row, without holding the image in memory.
+ *
+ * @param writer where to store the writer.
+ * @param path the path of the file.
+ * @param width the width of the image.
+ * @param height the height of the image.
+ * @param red_bits the number of bits for the red channel.
+ * @param green_bits the number of bits for the green channel.
+ * @param blue_bits the number of bits for the blue channel.
+ * @param alpha_bits the number of bits for the alpha channel.
+ * @param top_down write the rows from the top down instead of from the bottom up.
+ * @return the error code.
+ */
+uint8_t bmp_writer_open(BmpWriter** writer, char const* path, uint32_t width, uint32_t height,
+                        uint8_t red_bits, uint8_t green_bits, uint8_t blue_bits,
+                        uint8_t alpha_bits, bool top_down) {
+    uint16_t bpp = red_bits + green_bits + blue_bits + alpha_bits;
+    if (red_bits == 0 || green_bits == 0 || blue_bits == 0 || red_bits > 16 || green_bits > 16 ||
+        blue_bits > 16 || alpha_bits > 16 || bpp > 32) {
+        return BMP_ERROR_NOT_SUPPORTED;
+    }
+
+    // channels are packed from the low bits in blue, green, red, alpha order, 8-bit RGB is the
+    // uncompressed 24-bit format, everything else is padded to 16 or 32 bits
+    bool const rgb = red_bits == 8 && green_bits == 8 && blue_bits == 8 && alpha_bits == 0;
+    bpp = rgb ? 24 : bpp <= 16 ? 16 : 32;
+    // shifted in 64 bits, an empty alpha channel starts at bit 32 when the colors fill 32 bits
+    uint8_t const alpha_shift = blue_bits + green_bits + red_bits;
+    Mask const    mask = {((1U << red_bits) - 1) << (blue_bits + green_bits),
+                          ((1U << green_bits) - 1) << blue_bits, (1U << blue_bits) - 1,
+                          (uint32_t)(((1ULL << alpha_bits) - 1) << alpha_shift)};
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return BMP_ERROR_FILE_ERROR;
+    }
+
+    BmpWriter* w = calloc(1, sizeof(BmpWriter));
+    w->file = file;
+    w->width = width;
+    w->height = height;
+    w->top_down = top_down;
+    w->swizzle = red_bits == 8 && green_bits == 8 && blue_bits == 8 && alpha_bits == 8;
+    w->pixel_size = bpp / 8;
+    w->row_size = ((w->width * bpp + 31) / 32) * 4;
+    w->rows = w->row_size > 0 && w->row_size < BMP_IO_CHUNK ? BMP_IO_CHUNK / w->row_size : 1;
+    w->rows = w->rows < height ? w->rows : (height > 0 ? height : 1);
+    // the padding of every row stays zero
+    w->buffer = calloc((uint64_t)w->rows * w->row_size + 1, sizeof(uint8_t));
+
+    uint8_t const bits[4] = {blue_bits, green_bits, red_bits, alpha_bits};
+    uint8_t       shift = 0;
+    for (int channel = 0; channel < 4; channel++) {
+        uint32_t const max = (1U << bits[channel]) - 1;
+        for (uint32_t value = 0; value < 256; value++) {
+            w->tables[channel][value] = (uint32_t)((((uint64_t)value * max + 127) / 255) << shift);
+        }
+        shift += bits[channel];
+    }
+
+    BITMAPV3INFOHEADER header = {0};
+    BITMAP_HEADER*     file_header = (BITMAP_HEADER*)&header;
+    BITMAPINFOHEADER*  info_header = (BITMAPINFOHEADER*)&header;
+
+    header.mask = mask;
+
+    info_header->header_size = sizeof(BITMAPV3INFOHEADER) - sizeof(BITMAP_HEADER);
+    info_header->width = w->width;
+    info_header->height = top_down ? -w->height : w->height;
+    info_header->planes = 1;
+    info_header->bpp = bpp;
+    info_header->compression = 3;
+    info_header->bitmap_size = abs(w->height) * w->row_size;
+    info_header->res_height = 9449;
+    info_header->res_width = 9449;
+
+    file_header->magic = BMP_MAGIC;
+    file_header->offset = sizeof(BITMAPV3INFOHEADER);
+    file_header->size = sizeof(BITMAPV3INFOHEADER) + info_header->bitmap_size;
+
+    if (rgb) {
+        info_header->compression = 0;
+    }
+
+    fwrite(&header, sizeof(BITMAPV3INFOHEADER), 1, file);
+
+    *writer = w;
+    return BMP_ERROR_NONE;
+}
+
+static inline void bmp_writer_pack(BmpWriter const* writer, Pixel const* pixels, uint8_t* dst) {
+    if (writer->swizzle) {
+        bmp_swap_red_blue((uint8_t const*)pixels, dst, writer->width, 0);
+        return;
+    }
+    for (int32_t x = 0; x < writer->width; x++) {
+        uint32_t const pixel_data =
+            writer->tables[0][pixels[x].blue] | writer->tables[1][pixels[x].green] |
+            writer->tables[2][pixels[x].red] | writer->tables[3][pixels[x].alpha];
+        memcpy(dst + x * writer->pixel_size, &pixel_data, writer->pixel_size);
+    }
+}
+
+/**
+ * @brief Write the next row of the image, rows are written from the bottom to the top, or from
+ * the top to the bottom for a top-down writer.
+ *
+ * @param writer the writer.
+ * @param pixels the straight pixels of the row, as many as the width of the image.
+ * @return the error code.
+ */
+uint8_t bmp_writer_row(BmpWriter* writer, Pixel const* pixels) {
+    if (writer->row >= writer->height) {
+        return BMP_ERROR_NOT_SUPPORTED;
+    }
+
+    bmp_writer_pack(writer, pixels, writer->buffer + (uint64_t)writer->buffered * writer->row_size);
+
+    writer->row++;
+    if (++writer->buffered < writer->rows && writer->row < writer->height) {
+        return BMP_ERROR_NONE;
+    }
+
+    uint64_t const size = (uint64_t)writer->buffered * writer->row_size;
+    writer->buffered = 0;
+    if (size > 0 && fwrite(writer->buffer, size, 1, writer->file) != 1) {
+        return BMP_ERROR_FILE_ERROR;
+    }
+    return BMP_ERROR_NONE;
+}
+
+/**
+ * @brief Close the file and free the writer.
+ *
+ * @param writer the writer, all rows should have been written.
+ * @return the error code.
+ */
+uint8_t bmp_writer_close(BmpWriter* writer) {
+    uint8_t error = writer->row == writer->height ? BMP_ERROR_NONE : BMP_ERROR_NOT_SUPPORTED;
+    if (fclose(writer->file) != 0) {
+        error = BMP_ERROR_FILE_ERROR;
+    }
+    free(writer->buffer), free(writer);
+    return error;
+}
+
+static uint8_t bmp_write_file(BMP* bmp, char const* path, uint8_t red_bits, uint8_t green_bits,
+                              uint8_t blue_bits, uint8_t alpha_bits, bool top_down) {
+    int32_t const width = bmp->header->info_header.width;
+    int32_t const height = bmp->header->info_header.height;
+
+    BmpWriter* writer;
+    uint8_t    error = bmp_writer_open(&writer, path, width, height, red_bits, green_bits,
+                                       blue_bits, alpha_bits, top_down);
+    if (error != BMP_ERROR_NONE) {
+        return error;
+    }
+
+    Pixel* straight = bmp->premultiplied ? malloc((width > 0 ? width : 1) * sizeof(Pixel)) : NULL;
+    for (int32_t i = 0; i < height && error == BMP_ERROR_NONE; i++) {
+        Pixel const* row = bmp_row(bmp, top_down ? i : height - 1 - i);
+        if (straight != NULL) {
+            bmp_unpremultiply_row(row, straight, width);
+            row = straight;
+        }
+        error = bmp_writer_row(writer, row);
+    }
+
+    free(straight);
+    uint8_t const closed = bmp_writer_close(writer);
+    return error != BMP_ERROR_NONE ? error : closed;
+}
+
+uint8_t write_bmp(BMP* bmp, char const* path, uint8_t red_bits, uint8_t green_bits,
+                  uint8_t blue_bits, uint8_t alpha_bits) {
+    return bmp_write_file(bmp, path, red_bits, green_bits, blue_bits, alpha_bits, false);
+}
+
+/**
+ * @brief Write a top-down BMP file, the rows are stored in the same order as in memory so the
+ * image is encoded and written front to back.
+ *
+ * @param bmp the image.
+ * @param path the path of the file.
+ * @param red_bits the number of bits for the red channel.
+ * @param green_bits the number of bits for the green channel.
+ * @param blue_bits the number of bits for the blue channel.
+ * @param alpha_bits the number of bits for the alpha channel.
+ * @return the error code.
+ */
+uint8_t write_bmp_top_down(BMP* bmp, char const* path, uint8_t red_bits, uint8_t green_bits,
+                           uint8_t blue_bits, uint8_t alpha_bits) {
+    return bmp_write_file(bmp, path, red_bits, green_bits, blue_bits, alpha_bits, true);
+}
+
+/**
+ * @brief Allocate an image with contiguous pixel storage, the pixels are left uninitialized.
+ *
+ * @param width the width of the image.
+ * @param height the height of the image.
+ * @return the allocated image.
+ */
+BMP* bmp_alloc(uint32_t width, uint32_t height) {
+    uint16_t bpp = 24;
+    uint16_t pixel_size = bpp / 8;
+
+    BMP* bmp = calloc(1, sizeof(BMP));
+    bmp->header = calloc(1, sizeof(BITMAPV3INFOHEADER));
+
+    BITMAP_HEADER* file_header = (BITMAP_HEADER*)bmp->header;
+    file_header->magic = BMP_MAGIC;
+    file_header->size = sizeof(BITMAPV3INFOHEADER) + pixel_size * width * height;
+    file_header->offset = sizeof(BITMAPV3INFOHEADER);
+
+    BITMAPINFOHEADER* info_header = (BITMAPINFOHEADER*)bmp->header;
+    info_header->header_size = sizeof(BITMAPV3INFOHEADER) - sizeof(BITMAP_HEADER);
+    info_header->width = width;
+    info_header->height = height;
+    info_header->planes = 1;
+    info_header->bpp = bpp;
+    info_header->bitmap_size = pixel_size * width * height;
+    info_header->res_height = 9449;
+    info_header->res_width = 9449;
+
+    bmp->header->mask = Mask_888;
+
+    uint64_t size = (uint64_t)width * height;
+    bmp->data = malloc((size > 0 ? size : 1) * sizeof(Pixel));
+    bmp->pixels = calloc(height > 0 ? height : 1, sizeof(Pixel**));
+
+    Pixel** table = malloc((size > 0 ? size : 1) * sizeof(Pixel*));
+    // rows of a zero-width image all share the one slot, so bmp_row stays a valid pointer
+    table[0] = bmp->data;
+    for (uint64_t i = 0; i < size; i++) {
+        table[i] = bmp->data + i;
+    }
+    for (uint64_t y = 0; y < height; y++) {
+        bmp->pixels[y] = table + y * width;
+    }
+    if (height == 0) {
+        free(table);
+    }
+
+    return bmp;
+}
+
+BMP* create_bmp(uint32_t width, uint32_t height, Pixel pixel) {
+    BMP* bmp = bmp_alloc(width, height);
+
+    uint64_t size = (uint64_t)width * height;
+    for (uint64_t i = 0; i < size; i++) {
+        bmp->data[i] = pixel;
+    }
+
+    return bmp;
+}
+
+/** The most bits of a channel that are expanded through a table, wider channels drop low bits. */
+#define BMP_CHANNEL_BITS 12
+
+enum BMP_DECODE {
+    /** Any masks, every channel is expanded to 8 bits through its table. */
+    BMP_DECODE_MASKS = 0,
+    /** 24-bit BGR. */
+    BMP_DECODE_BGR,
+    /** 32-bit BGRA, or BGRX without an alpha mask. */
+    BMP_DECODE_BGRA,
+    BMP_DECODE_BGRX,
+};
+
+typedef struct BmpDecoder {
+    uint8_t  kind;
+    uint8_t  pixel_size;
+    /** Shift and mask of the bits that index the table of every channel, in RGBA order. */
+    uint8_t  shifts[4];
+    uint32_t limits[4];
+    /** The 8-bit value of every channel value, a channel without a mask is 0, or 255 for alpha. */
+    uint8_t  tables[4][1 << BMP_CHANNEL_BITS];
+} BmpDecoder;
+
+/**
+ * @brief Build the expansion tables of the channel masks, once per image.
+ *
+ * @param decoder the decoder to build.
+ * @param mask the channel masks.
+ * @param bpp the bits per pixel.
+ */
+static void bmp_decoder_init(BmpDecoder* decoder, Mask mask, uint16_t bpp) {
+    decoder->pixel_size = bpp / 8;
+    decoder->kind = BMP_DECODE_MASKS;
+    if (bpp == 24 && memcmp(&mask, &Mask_888, sizeof(Mask)) == 0) {
+        decoder->kind = BMP_DECODE_BGR;
+    } else if (bpp == 32 && memcmp(&mask, &Mask_8888, sizeof(Mask)) == 0) {
+        decoder->kind = BMP_DECODE_BGRA;
+    } else if (bpp == 32 && memcmp(&mask, &Mask_888, sizeof(Mask)) == 0) {
+        decoder->kind = BMP_DECODE_BGRX;
+    }
+
+    uint32_t const masks[4] = {mask.red, mask.green, mask.blue, mask.alpha};
+    for (int channel = 0; channel < 4; channel++) {
+        uint32_t const m = masks[channel];
+        uint8_t const  shift = m != 0 ? __builtin_ctz(m) : 0;
+        uint8_t const  bits = m != 0 ? 32 - __builtin_clz(m) - shift : 0;
+        uint8_t const  kept = bits < BMP_CHANNEL_BITS ? bits : BMP_CHANNEL_BITS;
+
+        decoder->shifts[channel] = shift + bits - kept;
+        decoder->limits[channel] = (m >> decoder->shifts[channel]) & ((1U << kept) - 1);
+        uint32_t const max = (1U << kept) - 1;
+        for (uint32_t value = 0; value <= max; value++) {
+            decoder->tables[channel][value] =
+                max == 0 ? (channel == 3 ? 0xFF : 0) : (value * 255 + max / 2) / max;
+        }
+    }
+}
+
+/**
+ * @brief Decode a row of the file into pixels.
+ *
+ * @param decoder the decoder of the image.
+ * @param src the row in the file, readable up to 4 bytes past the last pixel.
+ * @param dst the pixels to decode into.
+ * @param width the number of pixels in the row.
+ */
+static inline void bmp_decode_row(BmpDecoder const* decoder, uint8_t const* src, Pixel* dst,
+                                  int64_t width) {
+    switch (decoder->kind) {
+        case BMP_DECODE_BGR:
+            for (int64_t x = 0; x < width; x++) {
+                dst[x] = (Pixel){src[x * 3 + 2], src[x * 3 + 1], src[x * 3], 0xFF};
+            }
+            return;
+        case BMP_DECODE_BGRA:
+            bmp_swap_red_blue(src, (uint8_t*)dst, width, 0);
+            return;
+        case BMP_DECODE_BGRX:
+            bmp_swap_red_blue(src, (uint8_t*)dst, width, 0xFF000000);
+            return;
+    }
+
+    uint8_t const (*tables)[1 << BMP_CHANNEL_BITS] = decoder->tables;
+    uint8_t const*  shifts = decoder->shifts;
+    uint32_t const* limits = decoder->limits;
+    for (int64_t x = 0; x < width; x++) {
+        uint32_t pixel_data;
+        memcpy(&pixel_data, src + x * decoder->pixel_size, sizeof(uint32_t));
+
+        dst[x].red = tables[0][(pixel_data >> shifts[0]) & limits[0]];
+        dst[x].green = tables[1][(pixel_data >> shifts[1]) & limits[1]];
+        dst[x].blue = tables[2][(pixel_data >> shifts[2]) & limits[2]];
+        dst[x].alpha = tables[3][(pixel_data >> shifts[3]) & limits[3]];
+    }
+}
+
+/**
+ * @brief Validate the header read from a file and resolve the channel masks.
+ *
+ * @param header the header, the bytes past the read size are cleared.
+ * @param read_size the number of bytes read into the header.
+ * @param mask where to store the channel masks.
+ * @return the error code.
+ */
+static uint8_t bmp_parse_header(BITMAPV3INFOHEADER* header, uint64_t read_size, Mask* mask) {
+    if (read_size < 2 || header->info_header.file_header.magic != BMP_MAGIC) {
+        return BMP_ERROR_NOT_BMP;
+    }
+
+    if (read_size < sizeof(BITMAPV3INFOHEADER)) {
+        memset((uint8_t*)header + read_size, 0, sizeof(BITMAPV3INFOHEADER) - read_size);
+    }
+
+    // the masks are part of V2 and later headers, or follow a bitfields info header
+    BITMAPINFOHEADER const* info_header = &header->info_header;
+    uint32_t                size = sizeof(BITMAP_HEADER) + info_header->header_size;
+    if (info_header->header_size == sizeof(BITMAPINFOHEADER) - sizeof(BITMAP_HEADER)) {
+        size += info_header->compression == 3 ? 3 * sizeof(uint32_t)
+              : info_header->compression == 6 ? 4 * sizeof(uint32_t)
+                                              : 0;
+    }
+    if (size < sizeof(BITMAPV3INFOHEADER)) {
+        memset((uint8_t*)header + size, 0, sizeof(BITMAPV3INFOHEADER) - size);
+    }
+
+    // a negative height is a top-down file
+    if ((info_header->bpp != 16 && info_header->bpp != 24 && info_header->bpp != 32) ||
+        info_header->width <= 0 || info_header->height == 0 || info_header->height == INT32_MIN) {
+        return BMP_ERROR_INVALID_HEADER;
+    }
+
+    *mask = header->mask;
+    if (info_header->compression == 0) {
+        switch (info_header->bpp) {
+            case 16:
+                *mask = Mask_555;
+                break;
+            case 24:
+                *mask = Mask_888;
+                break;
+            case 32:
+                *mask = Mask_8888;
+                break;
+        }
+    } else if (info_header->compression != 3 && info_header->compression != 6) {
+        return BMP_ERROR_NOT_SUPPORTED;
+    }
+
+    // every mask must fit in the pixel, and there must be some color
+    uint64_t const outside = ~((1ULL << info_header->bpp) - 1);
+    if (((mask->red | mask->green | mask->blue | mask->alpha) & outside) != 0 ||
+        (mask->red | mask->green | mask->blue) == 0) {
+        return BMP_ERROR_INVALID_HEADER;
+    }
+
+    return BMP_ERROR_NONE;
+}
+
+/**
+ * @brief Read a BMP file and box-filter it down while decoding, the full image is never held in
+ * memory, which makes it suitable for thumbnails.
+ *
+ * @param path the path of the file.
+ * @param bmp the pointer to store the image.
+ * @param scale the reduction factor, one of 1, 2, 4 or 8.
+ * @param premultiplied premultiply every row right after it is decoded.
+ * @return the error code.
+ */
+static uint8_t bmp_read_file(char const* path, BMP** bmp, uint8_t scale, bool premultiplied) {
+    if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+        return BMP_ERROR_NOT_SUPPORTED;
+    }
+
+    FILE* bmp_file = fopen(path, "rb");
+    if (bmp_file == NULL) {
+        return BMP_ERROR_FILE_ERROR;
+    }
+
+    BITMAPV3INFOHEADER header;
+    Mask               mask;
+    uint64_t           read_size = fread(&header, 1, sizeof(BITMAPV3INFOHEADER), bmp_file);
+    uint8_t            error = bmp_parse_header(&header, read_size, &mask);
+    if (error != BMP_ERROR_NONE) {
+        fclose(bmp_file);
+        return error;
+    }
+    BITMAPINFOHEADER const* info_header = &header.info_header;
+
+    BmpDecoder decoder;
+    bmp_decoder_init(&decoder, mask, info_header->bpp);
+
+    bool     top_down = info_header->height < 0;
+    int64_t  width = info_header->width;
+    int64_t  height = llabs(info_header->height);
+    int64_t  row_size = ((width * info_header->bpp + 31) / 32) * 4;
+    uint32_t out_width = (width + scale - 1) / scale;
+    uint32_t out_height = (height + scale - 1) / scale;
+
+    *bmp = bmp_alloc(out_width, out_height);
+    memcpy((*bmp)->header, &header, sizeof(BITMAPV3INFOHEADER));
+    (*bmp)->header->info_header.width = out_width;
+    (*bmp)->header->info_header.height = out_height;
+
+    // rows are read in blocks, the decoder may read 4 bytes past the last pixel of a block
+    int64_t const rows = row_size < BMP_IO_CHUNK ? BMP_IO_CHUNK / row_size : 1;
+    int64_t const block_rows = rows < height ? rows : height;
+    uint8_t*      block = calloc(block_rows * row_size + sizeof(uint32_t), sizeof(uint8_t));
+    Pixel*        decoded = scale > 1 ? malloc(width * sizeof(Pixel)) : NULL;
+    uint32_t*     sums = scale > 1 ? calloc(out_width * 4, sizeof(uint32_t)) : NULL;
+
+    error = BMP_ERROR_NONE;
+    if (fseek(bmp_file, header.info_header.file_header.offset, SEEK_SET) != 0) {
+        error = BMP_ERROR_FILE_ERROR;
+    }
+
+    for (int64_t i = 0; i < height && error == BMP_ERROR_NONE; i++) {
+        if (i % block_rows == 0) {
+            int64_t const count = height - i < block_rows ? height - i : block_rows;
+            if (fread(block, row_size, count, bmp_file) != (uint64_t)count) {
+                error = BMP_ERROR_FILE_ERROR;
+                break;
+            }
+        }
+
+        uint8_t const* row = block + (i % block_rows) * row_size;
+        int64_t        y = top_down ? i : height - 1 - i;
+        if (scale == 1) {
+            bmp_decode_row(&decoder, row, bmp_row(*bmp, y), width);
+            if (premultiplied) {
+                bmp_premultiply_row(bmp_row(*bmp, y), width);
+            }
+            continue;
+        }
+
+        bmp_decode_row(&decoder, row, decoded, width);
+        for (int64_t x = 0; x < width; x++) {
+            uint32_t* sum = sums + (x / scale) * 4;
+            sum[0] += decoded[x].red;
+            sum[1] += decoded[x].green;
+            sum[2] += decoded[x].blue;
+            sum[3] += decoded[x].alpha;
+        }
+
+        // the last row of a block to arrive completes it, the top row unless the file is top-down
+        if (top_down ? y % scale == scale - 1 || y == height - 1 : y % scale == 0) {
+            int64_t  top = y - y % scale;
+            uint32_t covered = height - top < scale ? height - top : scale;
+            Pixel*   out = bmp_row(*bmp, y / scale);
+            for (uint32_t x = 0; x < out_width; x++) {
+                uint32_t  columns = width - x * scale < scale ? width - x * scale : scale;
+                uint32_t  count = covered * columns;
+                uint32_t* sum = sums + x * 4;
+                out[x].red = (sum[0] + count / 2) / count;
+                out[x].green = (sum[1] + count / 2) / count;
+                out[x].blue = (sum[2] + count / 2) / count;
+                out[x].alpha = (sum[3] + count / 2) / count;
+            }
+            if (premultiplied) {
+                bmp_premultiply_row(out, out_width);
+            }
+            memset(sums, 0, out_width * 4 * sizeof(uint32_t));
+        }
+    }
+
+    fclose(bmp_file);
+    free(block), free(decoded), free(sums);
+    if (error != BMP_ERROR_NONE) {
+        bmp_free(*bmp);
+        *bmp = NULL;
+    } else {
+        (*bmp)->premultiplied = premultiplied;
+    }
+
+    return error;
+}
+
+/**
+ * @brief Read a BMP file and box-filter it down while decoding, the full image is never held in
+ * memory, which makes it suitable for thumbnails.
+ *
+ * @param path the path of the file.
+ * @param bmp the pointer to store the image.
+ * @param scale the reduction factor, one of 1, 2, 4 or 8.
+ * @return the error code.
+ */
+uint8_t read_bmp_scaled(char const* path, BMP** bmp, uint8_t scale) {
+    return bmp_read_file(path, bmp, scale, false);
+}
+
+uint8_t read_bmp(char const* path, BMP** bmp) { return bmp_read_file(path, bmp, 1, false); }
+
+/**
+ * @brief Read a BMP file into a premultiplied image, see `bmp_set_premultiplied`.
+ *
+ * @param path the path of the file.
+ * @param bmp the pointer to store the image.
+ * @return the error code.
+ */
+uint8_t read_bmp_premultiplied(char const* path, BMP** bmp) {
+    return bmp_read_file(path, bmp, 1, true);
+}
+
+typedef struct BmpBandJob {
+    char const*       path;
+    BMP*              bmp;
+    BmpDecoder const* decoder;
+    BmpWriter const*  writer;
+    bool              top_down;
+    /** The offset of the pixels in the file. */
+    uint32_t          offset;
+    int64_t           row_size;
+    /** Rows per band, every band is read or written with one call. */
+    int64_t           band_rows;
+    /** The error of every band. */
+    uint8_t*          errors;
+} BmpBandJob;
+
+static void bmp_read_bands(void* context, int64_t from, int64_t to) {
+    BmpBandJob const* job = (BmpBandJob*)context;
+    int64_t const     width = job->bmp->header->info_header.width;
+    int64_t const     height = job->bmp->header->info_header.height;
+
+    // every worker has its own handle, so bands are read at their own offsets
+    FILE* file = fopen(job->path, "rb");
+    if (file == NULL) {
+        memset(job->errors + from, BMP_ERROR_FILE_ERROR, to - from);
+        return;
+    }
+    setvbuf(file, NULL, _IONBF, 0);
+
+    // the decoder may read 4 bytes past the last pixel of a band
+    uint8_t* block = calloc(job->band_rows * job->row_size + sizeof(uint32_t), sizeof(uint8_t));
+    for (int64_t band = from; band < to; band++) {
+        int64_t const first = band * job->band_rows;
+        int64_t const count = height - first < job->band_rows ? height - first : job->band_rows;
+        if (fseek(file, job->offset + first * job->row_size, SEEK_SET) != 0 ||
+            fread(block, job->row_size, count, file) != (uint64_t)count) {
+            job->errors[band] = BMP_ERROR_FILE_ERROR;
+            continue;
+        }
+
+        for (int64_t i = 0; i < count; i++) {
+            int64_t const y = job->top_down ? first + i : height - 1 - first - i;
+            bmp_decode_row(job->decoder, block + i * job->row_size, bmp_row(job->bmp, y), width);
+        }
+    }
+
+    free(block);
+    fclose(file);
+}
+
+/**
+ * @brief Read a BMP file on multiple threads, every thread reads and decodes its own bands of
+ * rows through its own file handle.
+ *
+ * @param path the path of the file.
+ * @param bmp the pointer to store the image.
+ * @return the error code.
+ */
+uint8_t read_bmp_parallel(char const* path, BMP** bmp) {
+    FILE* bmp_file = fopen(path, "rb");
+    if (bmp_file == NULL) {
+        return BMP_ERROR_FILE_ERROR;
+    }
+
+    BITMAPV3INFOHEADER header;
+    Mask               mask;
+    uint64_t           read_size = fread(&header, 1, sizeof(BITMAPV3INFOHEADER), bmp_file);
+    fclose(bmp_file);
+    uint8_t error = bmp_parse_header(&header, read_size, &mask);
+    if (error != BMP_ERROR_NONE) {
+        return error;
+    }
+
+    BmpDecoder* decoder = malloc(sizeof(BmpDecoder));
+    bmp_decoder_init(decoder, mask, header.info_header.bpp);
+
+    int64_t const width = header.info_header.width;
+    int64_t const height = llabs(header.info_header.height);
+    int64_t const row_size = ((width * header.info_header.bpp + 31) / 32) * 4;
+    *bmp = bmp_alloc(width, height);
+    memcpy((*bmp)->header, &header, sizeof(BITMAPV3INFOHEADER));
+    (*bmp)->header->info_header.height = height;
+
+    BmpBandJob job = {path, *bmp, decoder, NULL, header.info_header.height < 0,
+                      header.info_header.file_header.offset, row_size,
+                      row_size < BMP_IO_CHUNK ? BMP_IO_CHUNK / row_size : 1, NULL};
+    int64_t const bands = (height + job.band_rows - 1) / job.band_rows;
+    job.errors = calloc(bands, sizeof(uint8_t));
+    bmp_parallel(bands, 1, bmp_read_bands, &job);
+
+    for (int64_t band = 0; band < bands && error == BMP_ERROR_NONE; band++) {
+        error = job.errors[band];
+    }
+    free(job.errors), free(decoder);
+    if (error != BMP_ERROR_NONE) {
+        bmp_free(*bmp);
+        *bmp = NULL;
+    }
+    return error;
+}
+
+static void bmp_write_bands(void* context, int64_t from, int64_t to) {
+    BmpBandJob const* job = (BmpBandJob*)context;
+    int64_t const     width = job->bmp->header->info_header.width;
+    int64_t const     height = job->bmp->header->info_header.height;
+
+    // the header is already written, bands past the end of the file extend it
+    FILE* file = fopen(job->path, "r+b");
+    if (file == NULL) {
+        memset(job->errors + from, BMP_ERROR_FILE_ERROR, to - from);
+        return;
+    }
+    setvbuf(file, NULL, _IONBF, 0);
+
+    // the padding of every row stays zero
+    uint8_t* block = calloc(job->band_rows * job->row_size + 1, sizeof(uint8_t));
+    Pixel*   straight = job->bmp->premultiplied ? malloc(width * sizeof(Pixel)) : NULL;
+    for (int64_t band = from; band < to; band++) {
+        int64_t const first = band * job->band_rows;
+        int64_t const count = height - first < job->band_rows ? height - first : job->band_rows;
+        for (int64_t i = 0; i < count; i++) {
+            int64_t const y = job->top_down ? first + i : height - 1 - first - i;
+            Pixel const*  row = bmp_row(job->bmp, y);
+            if (straight != NULL) {
+                bmp_unpremultiply_row(row, straight, width);
+                row = straight;
+            }
+            bmp_writer_pack(job->writer, row, block + i * job->row_size);
+        }
+
+        if (fseek(file, job->offset + first * job->row_size, SEEK_SET) != 0 ||
+            fwrite(block, job->row_size, count, file) != (uint64_t)count) {
+            job->errors[band] = BMP_ERROR_FILE_ERROR;
+        }
+    }
+
+    free(block), free(straight);
+    if (fclose(file) != 0) {
+        job->errors[from] = BMP_ERROR_FILE_ERROR;
+    }
+}
+
+/**
+ * @brief Write a BMP file on multiple threads, every thread encodes its own bands of rows and
+ * writes them through its own file handle.
+ *
+ * @param bmp the image.
+ * @param path the path of the file.
+ * @param red_bits the number of bits for the red channel.
+ * @param green_bits the number of bits for the green channel.
+ * @param blue_bits the number of bits for the blue channel.
+ * @param alpha_bits the number of bits for the alpha channel.
+ * @return the error code.
+ */
+uint8_t write_bmp_parallel(BMP* bmp, char const* path, uint8_t red_bits, uint8_t green_bits,
+                           uint8_t blue_bits, uint8_t alpha_bits) {
+    int32_t const width = bmp->header->info_header.width;
+    int32_t const height = bmp->header->info_header.height;
+
+    BmpWriter* writer;
+    uint8_t    error = bmp_writer_open(&writer, path, width, height, red_bits, green_bits,
+                                       blue_bits, alpha_bits, false);
+    if (error != BMP_ERROR_NONE) {
+        return error;
+    }
+    if (fflush(writer->file) != 0) {
+        error = BMP_ERROR_FILE_ERROR;
+    }
+
+    BmpBandJob job = {path, bmp, NULL, writer, false, sizeof(BITMAPV3INFOHEADER), writer->row_size,
+                      writer->rows, NULL};
+    int64_t const bands = (height + job.band_rows - 1) / job.band_rows;
+    job.errors = calloc(bands + 1, sizeof(uint8_t));
+    if (error == BMP_ERROR_NONE) {
+        bmp_parallel(bands, 1, bmp_write_bands, &job);
+    }
+
+    for (int64_t band = 0; band < bands && error == BMP_ERROR_NONE; band++) {
+        error = job.errors[band];
+    }
+    free(job.errors);
+    writer->row = writer->height;
+    uint8_t const closed = bmp_writer_close(writer);
+    return error != BMP_ERROR_NONE ? error : closed;
+}
+
+typedef struct BmpInfo {
+    int32_t  width;
+    int32_t  height;
+    uint16_t bpp;
+    /** The error code of probing the file, the other fields are only valid without error. */
+    uint8_t  error;
+    uint32_t compression;
+    /** The channel masks, resolved for uncompressed files. */
+    Mask     mask;
+    /** The size of the file according to the header. */
+    uint32_t size;
+} BmpInfo;
+
+/**
+ * @brief Read the geometry and format of a BMP file, only the header is read, with one
+ * unbuffered read.
+ *
+ * @param path the path of the file.
+ * @param info where to store the geometry and format.
+ * @return the error code, the same that reading the file would fail with on a bad header.
+ */
+uint8_t bmp_probe(char const* path, BmpInfo* info) {
+    memset(info, 0, sizeof(BmpInfo));
+
+    FILE* bmp_file = fopen(path, "rb");
+    if (bmp_file == NULL) {
+        return info->error = BMP_ERROR_FILE_ERROR;
+    }
+
+    // without a buffer the header is the only part of the file that is read
+    setvbuf(bmp_file, NULL, _IONBF, 0);
+    BITMAPV3INFOHEADER header;
+    uint64_t           read_size = fread(&header, 1, sizeof(BITMAPV3INFOHEADER), bmp_file);
+    fclose(bmp_file);
+
+    info->error = bmp_parse_header(&header, read_size, &info->mask);
+    if (info->error == BMP_ERROR_NONE) {
+        info->width = header.info_header.width;
+        info->height = header.info_header.height;
+        info->bpp = header.info_header.bpp;
+        info->compression = header.info_header.compression;
+        info->size = header.info_header.file_header.size;
+    }
+    return info->error;
+}
+
+typedef struct BmpIndexJob {
+    char const* const* paths;
+    BmpInfo*           table;
+} BmpIndexJob;
+
+static void bmp_index_files(void* context, int64_t from, int64_t to) {
+    BmpIndexJob const* job = (BmpIndexJob*)context;
+    for (int64_t i = from; i < to; i++) {
+        bmp_probe(job->paths[i], job->table + i);
+    }
+}
+
+/**
+ * @brief Probe many files on multiple threads.
+ *
+ * @param paths the paths of the files.
+ * @param count the number of files.
+ * @param table the metadata of every file, with the error of probing it.
+ * @return the number of files that are valid BMP files.
+ */
+uint64_t bmp_index(char const* const* paths, uint64_t count, BmpInfo* table) {
+    BmpIndexJob job = {paths, table};
+    bmp_parallel(count, 64, bmp_index_files, &job);
+
+    uint64_t valid = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        valid += table[i].error == BMP_ERROR_NONE;
+    }
+    return valid;
+}
+
+/** Rows per band of a content hash, bands are hashed on multiple threads. */
+#define BMP_HASH_BAND 64
+
+#define BMP_HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define BMP_HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define BMP_HASH_PRIME_3 0x165667B19E3779F9ULL
+#define BMP_HASH_PRIME_4 0x85EBCA77C2B2AE63ULL
+#define BMP_HASH_PRIME_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t bmp_hash_rotate(uint64_t value, uint8_t bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t bmp_hash_round(uint64_t acc, uint64_t input) {
+    return bmp_hash_rotate(acc + input * BMP_HASH_PRIME_2, 31) * BMP_HASH_PRIME_1;
+}
+
+static inline uint64_t bmp_hash_merge(uint64_t acc, uint64_t value) {
+    return (acc ^ bmp_hash_round(0, value)) * BMP_HASH_PRIME_1 + BMP_HASH_PRIME_4;
+}
+
+/**
+ * @brief Hash bytes with XXH64, the four lanes of 32-byte stripes are independent so they run in
+ * parallel on the CPU at several GB/s.
+ *
+ * @param data the bytes.
+ * @param size the number of bytes.
+ * @param seed the seed, chain hashes by passing the previous hash.
+ * @return the hash.
+ */
+uint64_t bmp_hash_bytes(void const* data, uint64_t size, uint64_t seed) {
+    uint8_t const*       p = data;
+    uint8_t const* const end = p + size;
+    uint64_t             hash;
+    uint64_t             word;
+    uint32_t             half;
+
+    if (size >= 32) {
+        uint64_t lanes[4] = {seed + BMP_HASH_PRIME_1 + BMP_HASH_PRIME_2, seed + BMP_HASH_PRIME_2,
+                             seed, seed - BMP_HASH_PRIME_1};
+        for (; end - p >= 32; p += 32) {
+            for (uint8_t i = 0; i < 4; i++) {
+                memcpy(&word, p + i * 8, 8);
+                lanes[i] = bmp_hash_round(lanes[i], word);
+            }
+        }
+        hash = bmp_hash_rotate(lanes[0], 1) + bmp_hash_rotate(lanes[1], 7) +
+               bmp_hash_rotate(lanes[2], 12) + bmp_hash_rotate(lanes[3], 18);
+        for (uint8_t i = 0; i < 4; i++) {
+            hash = bmp_hash_merge(hash, lanes[i]);
+        }
+    } else {
+        hash = seed + BMP_HASH_PRIME_5;
+    }
+
+    hash += size;
+    for (; end - p >= 8; p += 8) {
+        memcpy(&word, p, 8);
+        hash = bmp_hash_rotate(hash ^ bmp_hash_round(0, word), 27) * BMP_HASH_PRIME_1 +
+               BMP_HASH_PRIME_4;
+    }
+    if (end - p >= 4) {
+        memcpy(&half, p, 4);
+        hash = bmp_hash_rotate(hash ^ (half * BMP_HASH_PRIME_1), 23) * BMP_HASH_PRIME_2 +
+               BMP_HASH_PRIME_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        hash = bmp_hash_rotate(hash ^ (*p * BMP_HASH_PRIME_5), 11) * BMP_HASH_PRIME_1;
+    }
+
+    hash ^= hash >> 33, hash *= BMP_HASH_PRIME_2;
+    hash ^= hash >> 29, hash *= BMP_HASH_PRIME_3;
+    return hash ^ (hash >> 32);
+}
+
+typedef struct BmpHashJob {
+    BMP*      bmp;
+    uint64_t* digests;
+} BmpHashJob;
+
+static void bmp_hash_rows(void* context, int64_t from, int64_t to) {
+    BmpHashJob const* job = (BmpHashJob*)context;
+    int64_t const     width = job->bmp->header->info_header.width;
+    int64_t const     height = job->bmp->header->info_header.height;
+    for (int64_t band = from; band < to; band++) {
+        int64_t const top = band * BMP_HASH_BAND;
+        int64_t const rows = height - top < BMP_HASH_BAND ? height - top : BMP_HASH_BAND;
+        job->digests[band] = bmp_hash_bytes(bmp_row(job->bmp, top), rows * width * sizeof(Pixel),
+                                            (uint64_t)top);
+    }
+}
+
+/**
+ * @brief Hash every band of BMP_HASH_BAND rows, on multiple threads. Comparing the digests with
+ * those of an earlier version of the image tells which bands have changed.
+ *
+ * @param bmp the image.
+ * @param digests where to store the digests, one per band, (height + BMP_HASH_BAND - 1) /
+ * BMP_HASH_BAND.
+ * @return the number of bands.
+ */
+uint64_t bmp_hash_bands(BMP* bmp, uint64_t* digests) {
+    uint64_t const bands =
+        ((uint64_t)bmp->header->info_header.height + BMP_HASH_BAND - 1) / BMP_HASH_BAND;
+    BmpHashJob job = {bmp, digests};
+    bmp_parallel(bands, 1, bmp_hash_rows, &job);
+    return bands;
+}
+
+/**
+ * @brief Hash the size and the pixels of an image, for caching and finding duplicates. The hash
+ * is the same across runs on the same platform.
+ *
+ * @param bmp the image.
+ * @return the hash.
+ */
+uint64_t bmp_hash(BMP* bmp) {
+    uint64_t const bands =
+        ((uint64_t)bmp->header->info_header.height + BMP_HASH_BAND - 1) / BMP_HASH_BAND;
+    uint64_t* digests = malloc(bands * sizeof(uint64_t));
+    bmp_hash_bands(bmp, digests);
+
+    uint64_t const size = (uint64_t)bmp->header->info_header.width << 32 |
+                          (uint64_t)bmp->header->info_header.height << 1 | bmp->premultiplied;
+    uint64_t const hash = bmp_hash_bytes(digests, bands * sizeof(uint64_t), size);
+    free(digests);
+    return hash;
+}
+
+/**
+ * @brief Write a BMP file only if the image or the format differ from the last time it was
+ * written, skipping the encode and the write of images that are regenerated unchanged.
+ *
+ * @param bmp the image.
+ * @param path the path of the file.
+ * @param red_bits the number of bits for the red channel.
+ * @param green_bits the number of bits for the green channel.
+ * @param blue_bits the number of bits for the blue channel.
+ * @param alpha_bits the number of bits for the alpha channel.
+ * @param digest the digest of the last write, 0 if unknown, replaced by the digest of this one.
+ * @return the error code, BMP_ERROR_NONE when the write is skipped.
+ */
+uint8_t write_bmp_changed(BMP* bmp, char const* path, uint8_t red_bits, uint8_t green_bits,
+                          uint8_t blue_bits, uint8_t alpha_bits, uint64_t* digest) {
+    uint8_t const format[4] = {red_bits, green_bits, blue_bits, alpha_bits};
+    uint64_t const hash = bmp_hash_bytes(format, sizeof(format), bmp_hash(bmp));
+
+    // the file must still be there, with the size of the image
+    BmpInfo info;
+    if (hash == *digest && bmp_probe(path, &info) == BMP_ERROR_NONE &&
+        info.width == bmp->header->info_header.width &&
+        abs(info.height) == bmp->header->info_header.height) {
+        return BMP_ERROR_NONE;
+    }
+
+    uint8_t const error = write_bmp(bmp, path, red_bits, green_bits, blue_bits, alpha_bits);
+    *digest = error == BMP_ERROR_NONE ? hash : 0;
+    return error;
+}
+// #endregion
+
+// #region PNG.
+/** Filtered bytes per part, parts are compressed on multiple threads into their own IDAT chunks. */
+#define BMP_PNG_PART (1 << 20)
+
+/** The deflate window, matches reach back at most this far. */
+#define BMP_DEFLATE_WINDOW (1 << 15)
+#define BMP_DEFLATE_HASH_BITS 15
+
+/** Symbols per deflate block, every block gets its own Huffman codes. */
+#define BMP_DEFLATE_BLOCK (1 << 15)
+
+#define BMP_ADLER_BASE 65521
+
+/** The most bytes that can be summed before the Adler-32 sums must be reduced. */
+#define BMP_ADLER_RUN 5552
+
+static uint16_t const BMP_LENGTH_BASE[29] = {3,  4,  5,  6,   7,   8,   9,   10,  11, 13,
+                                             15, 17, 19, 23,  27,  31,  35,  43,  51, 59,
+                                             67, 83, 99, 115, 131, 163, 195, 227, 258};
+static uint8_t const  BMP_LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                              2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static uint16_t const BMP_DISTANCE_BASE[30] = {
+    1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+    193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static uint8_t const BMP_DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                               6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+/** The extra bits of the code length symbols that repeat lengths. */
+static uint8_t const BMP_CODE_LENGTH_EXTRA[19] = {[16] = 2, [17] = 3, [18] = 7};
+/** The order that the lengths of the code length code are stored in. */
+static uint8_t const BMP_CODE_LENGTH_ORDER[19] = {16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+                                                  11, 4,  12, 3, 13, 2, 14, 1, 15};
+
+/** How hard every level looks for matches: the hash chain length, the length that ends the
+ * search early, and whether a match is deferred when the next one is longer. */
+static struct {
+    uint16_t chain;
+    uint16_t nice;
+    bool     lazy;
+} const BMP_DEFLATE_LEVELS[10] = {{0, 0, false},     {4, 16, false},    {8, 32, false},
+                                  {16, 64, false},   {16, 32, true},    {32, 64, true},
+                                  {128, 128, true},  {256, 128, true},  {1024, 258, true},
+                                  {4096, 258, true}};
+
+static uint32_t       bmp_crc_table[8][256];
+/** The length code of every match length, and the distance code of every distance - 1, for
+ * distances over 256 indexed by 256 + ((distance - 1) >> 7). */
+static uint8_t        bmp_length_code[259];
+static uint8_t        bmp_distance_code[512];
+static pthread_once_t bmp_png_once = PTHREAD_ONCE_INIT;
+
+static void bmp_png_init(void) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = c & 1 ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+        }
+        bmp_crc_table[0][n] = c;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+        for (int t = 1; t < 8; t++) {
+            uint32_t const c = bmp_crc_table[t - 1][n];
+            bmp_crc_table[t][n] = (c >> 8) ^ bmp_crc_table[0][c & 0xFF];
+        }
+    }
+
+    for (uint8_t code = 0; code < 29; code++) {
+        uint32_t const end = BMP_LENGTH_BASE[code] + (1U << BMP_LENGTH_EXTRA[code]);
+        for (uint32_t length = BMP_LENGTH_BASE[code]; length < end && length <= 258; length++) {
+            bmp_length_code[length] = code;
+        }
+    }
+    for (uint8_t code = 0; code < 30; code++) {
+        uint32_t const first = BMP_DISTANCE_BASE[code] - 1;
+        for (uint32_t d = first; d < first + (1U << BMP_DISTANCE_EXTRA[code]); d++) {
+            bmp_distance_code[d < 256 ? d : 256 + (d >> 7)] = code;
+        }
+    }
+}
+
+/**
+ * @brief Update a CRC-32 (the one of PNG and zlib), eight bytes per step through sliced tables.
+ *
+ * @param crc the CRC of the bytes before, 0 to start.
+ * @param data the bytes.
+ * @param size the number of bytes.
+ * @return the CRC.
+ */
+uint32_t bmp_crc32(uint32_t crc, void const* data, uint64_t size) {
+    pthread_once(&bmp_png_once, bmp_png_init);
+    uint8_t const* p = data;
+    uint32_t const (*t)[256] = bmp_crc_table;
+
+    crc = ~crc;
+    for (; size >= 8; size -= 8, p += 8) {
+        uint32_t low, high;
+        memcpy(&low, p, 4), memcpy(&high, p + 4, 4);
+        low ^= crc;
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^
+              t[4][low >> 24] ^ t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^
+              t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+    }
+    for (; size > 0; size--, p++) {
+        crc = t[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Update an Adler-32 (the checksum of zlib), sixteen bytes per step with SSE2.
+ *
+ * @param adler the checksum of the bytes before, 1 to start.
+ * @param data the bytes.
+ * @param size the number of bytes.
+ * @return the checksum.
+ */
+uint32_t bmp_adler32(uint32_t adler, void const* data, uint64_t size) {
+    uint8_t const* p = data;
+    uint64_t       s1 = adler & 0xFFFF, s2 = adler >> 16;
+
+    while (size > 0) {
+        uint64_t n = size < BMP_ADLER_RUN ? size : BMP_ADLER_RUN;
+        size -= n;
+#if defined(BMP_SSE2)
+        uint64_t const blocks = n / 16;
+        if (blocks > 0) {
+            __m128i const zero = _mm_setzero_si128();
+            __m128i const high = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+            __m128i const low = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+            // the byte sums so far, their sum before every block, and the weighted sums
+            __m128i sums = zero, prefix = zero, weighted = zero;
+            for (uint64_t i = 0; i < blocks; i++, p += 16) {
+                __m128i const bytes = _mm_loadu_si128((__m128i const*)p);
+                prefix = _mm_add_epi32(prefix, sums);
+                sums = _mm_add_epi32(sums, _mm_sad_epu8(bytes, zero));
+                weighted = _mm_add_epi32(
+                    weighted, _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), high),
+                                            _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), low)));
+            }
+
+            uint32_t lanes[3][4];
+            _mm_storeu_si128((__m128i*)lanes[0], sums);
+            _mm_storeu_si128((__m128i*)lanes[1], prefix);
+            _mm_storeu_si128((__m128i*)lanes[2], weighted);
+            uint64_t total[3] = {0};
+            for (int k = 0; k < 3; k++) {
+                total[k] = (uint64_t)lanes[k][0] + lanes[k][1] + lanes[k][2] + lanes[k][3];
+            }
+            s2 += blocks * 16 * s1 + 16 * total[1] + total[2];
+            s1 += total[0];
+            n -= blocks * 16;
+        }
+#endif
+        for (; n > 0; n--, p++) {
+            s1 += *p;
+            s2 += s1;
+        }
+        s1 %= BMP_ADLER_BASE, s2 %= BMP_ADLER_BASE;
+    }
+    return (uint32_t)(s2 << 16 | s1);
+}
+
+/**
+ * @brief Combine the Adler-32 of two runs of bytes into the one of both.
+ *
+ * @param first the checksum of the first run.
+ * @param second the checksum of the second run.
+ * @param size the number of bytes of the second run.
+ * @return the checksum of both runs.
+ */
+static uint32_t bmp_adler32_combine(uint32_t first, uint32_t second, uint64_t size) {
+    uint64_t const remainder = size % BMP_ADLER_BASE;
+    uint64_t       s1 = first & 0xFFFF;
+    uint64_t       s2 = remainder * s1 % BMP_ADLER_BASE;
+    s1 = (s1 + (second & 0xFFFF) + BMP_ADLER_BASE - 1) % BMP_ADLER_BASE;
+    s2 = (s2 + (first >> 16) + (second >> 16) + BMP_ADLER_BASE - remainder) % BMP_ADLER_BASE;
+    return (uint32_t)(s2 << 16 | s1);
+}
+
+typedef struct BmpDeflate {
+    uint8_t*  out;
+    uint64_t  size;
+    uint64_t  capacity;
+    /** Bits that are not written yet, from the lowest. */
+    uint64_t  bits;
+    uint8_t   count;
+    /** Literals, or 1 << 31 | (length - 3) << 15 | (distance - 1) for matches. */
+    uint32_t* symbols;
+    uint32_t  symbol_count;
+    uint32_t  literal_freq[286];
+    uint32_t  distance_freq[30];
+    /** The last position of every hash, and the previous position with the same hash. */
+    int32_t*  head;
+    int32_t*  prev;
+    uint64_t  inserted;
+} BmpDeflate;
+
+static inline void bmp_deflate_reserve(BmpDeflate* d, uint64_t size) {
+    if (d->size + size > d->capacity) {
+        d->capacity = d->size + size > 2 * d->capacity ? d->size + size : 2 * d->capacity;
+        d->out = realloc(d->out, d->capacity);
+    }
+}
+
+static inline void bmp_deflate_bits(BmpDeflate* d, uint32_t value, uint8_t count) {
+    d->bits |= (uint64_t)value << d->count;
+    d->count += count;
+    if (d->count >= 32) {
+        bmp_deflate_reserve(d, 4);
+        uint32_t const word = (uint32_t)d->bits;
+        memcpy(d->out + d->size, &word, 4);
+        d->size += 4, d->bits >>= 32, d->count -= 32;
+    }
+}
+
+static inline void bmp_deflate_align(BmpDeflate* d) {
+    bmp_deflate_reserve(d, 8);
+    for (; d->count > 0; d->count = d->count > 8 ? d->count - 8 : 0) {
+        d->out[d->size++] = (uint8_t)d->bits;
+        d->bits >>= 8;
+    }
+    d->bits = 0;
+}
+
+/**
+ * @brief Find the code lengths of a Huffman code, no longer than the limit. At least two symbols
+ * must be used, so the code is complete.
+ *
+ * @param freq the frequency of every symbol.
+ * @param count the number of symbols.
+ * @param limit the longest code.
+ * @param lengths where to store the length of every symbol, 0 for unused symbols.
+ */
+static void bmp_huffman_lengths(uint32_t const* freq, uint32_t count, uint8_t limit,
+                                uint8_t* lengths) {
+    uint64_t leaves[286];
+    uint64_t weight[2 * 286];
+    uint32_t parent[2 * 286];
+    uint8_t  depth[2 * 286];
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        lengths[i] = 0;
+        if (freq[i] > 0) {
+            leaves[n++] = (uint64_t)freq[i] << 9 | i;
+        }
+    }
+
+    // sort the leaves by frequency, then merge the two lightest nodes from the leaves and from
+    // the internal nodes, which are made in order of weight
+    for (uint32_t i = 1; i < n; i++) {
+        uint64_t const leaf = leaves[i];
+        uint32_t       j = i;
+        for (; j > 0 && leaves[j - 1] > leaf; j--) {
+            leaves[j] = leaves[j - 1];
+        }
+        leaves[j] = leaf;
+    }
+
+    for (uint32_t shift = 0;; shift++) {
+        for (uint32_t i = 0; i < n; i++) {
+            // flattening the frequencies shortens the longest code
+            weight[i] = shift == 0 ? leaves[i] >> 9 : ((leaves[i] >> 9) >> shift) + 1;
+        }
+
+        uint32_t leaf = 0, node = n;
+        for (uint32_t k = n; k < 2 * n - 1; k++) {
+            uint32_t picked[2];
+            for (int m = 0; m < 2; m++) {
+                bool const use_leaf = leaf < n && (node >= k || weight[leaf] <= weight[node]);
+                picked[m] = use_leaf ? leaf++ : node++;
+            }
+            weight[k] = weight[picked[0]] + weight[picked[1]];
+            parent[picked[0]] = parent[picked[1]] = k;
+        }
+
+        uint8_t longest = 0;
+        depth[2 * n - 2] = 0;
+        for (int64_t k = 2 * (int64_t)n - 3; k >= 0; k--) {
+            depth[k] = depth[parent[k]] + 1;
+            longest = depth[k] > longest ? depth[k] : longest;
+        }
+        if (longest <= limit) {
+            for (uint32_t i = 0; i < n; i++) {
+                lengths[leaves[i] & 0x1FF] = depth[i];
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Make the canonical codes of the code lengths, bit-reversed to be written from the
+ * lowest bit.
+ */
+static void bmp_huffman_codes(uint8_t const* lengths, uint32_t count, uint16_t* codes) {
+    uint16_t length_count[16] = {0}, next[16] = {0};
+    for (uint32_t i = 0; i < count; i++) {
+        length_count[lengths[i]]++;
+    }
+    length_count[0] = 0;
+    for (int bits = 1; bits < 16; bits++) {
+        next[bits] = (next[bits - 1] + length_count[bits - 1]) << 1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t code = lengths[i] > 0 ? next[lengths[i]]++ : 0, reversed = 0;
+        for (uint8_t b = 0; b < lengths[i]; b++, code >>= 1) {
+            reversed = reversed << 1 | (code & 1);
+        }
+        codes[i] = reversed;
+    }
+}
+
+/** Make sure at least two symbols are used, so that every code is complete. */
+static inline void bmp_huffman_pad(uint32_t* freq, uint32_t count) {
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        used += freq[i] > 0;
+    }
+    for (uint32_t i = 0; i < count && used < 2; i++) {
+        if (freq[i] == 0) {
+            freq[i] = 1, used++;
+        }
+    }
+}
+
+static void bmp_deflate_symbols(BmpDeflate* d, uint8_t const* literal_lengths,
+                                uint8_t const* distance_lengths) {
+    uint16_t literal_codes[288], distance_codes[30];
+    bmp_huffman_codes(literal_lengths, 288, literal_codes);
+    bmp_huffman_codes(distance_lengths, 30, distance_codes);
+
+    for (uint32_t i = 0; i < d->symbol_count; i++) {
+        uint32_t const symbol = d->symbols[i];
+        if (!(symbol >> 31)) {
+            bmp_deflate_bits(d, literal_codes[symbol], literal_lengths[symbol]);
+            continue;
+        }
+
+        uint32_t const length = ((symbol >> 15) & 0xFF) + 3, distance = (symbol & 0x7FFF) + 1;
+        uint8_t const  code = bmp_length_code[length];
+        bmp_deflate_bits(d, literal_codes[257 + code], literal_lengths[257 + code]);
+        bmp_deflate_bits(d, length - BMP_LENGTH_BASE[code], BMP_LENGTH_EXTRA[code]);
+
+        uint8_t const distance_code =
+            bmp_distance_code[distance <= 256 ? distance - 1 : 256 + ((distance - 1) >> 7)];
+        bmp_deflate_bits(d, distance_codes[distance_code], distance_lengths[distance_code]);
+        bmp_deflate_bits(d, distance - BMP_DISTANCE_BASE[distance_code],
+                         BMP_DISTANCE_EXTRA[distance_code]);
+    }
+    bmp_deflate_bits(d, literal_codes[256], literal_lengths[256]);
+}
+
+static void bmp_deflate_stored(BmpDeflate* d, uint8_t const* raw, uint64_t size, bool last) {
+    do {
+        uint32_t const length = size < 0xFFFF ? size : 0xFFFF;
+        bmp_deflate_bits(d, last && length == size, 1);
+        bmp_deflate_bits(d, 0, 2);
+        bmp_deflate_align(d);
+        bmp_deflate_reserve(d, 4 + length);
+        uint8_t const lengths[4] = {length & 0xFF, length >> 8, ~length & 0xFF,
+                                    (~length >> 8) & 0xFF};
+        memcpy(d->out + d->size, lengths, 4);
+        if (length > 0) {
+            memcpy(d->out + d->size + 4, raw, length);
+        }
+        d->size += 4 + length, raw += length, size -= length;
+    } while (size > 0);
+}
+
+/**
+ * @brief Write the collected symbols as one block, with dynamic or fixed Huffman codes or stored,
+ * whichever is the smallest.
+ *
+ * @param d the compressor.
+ * @param raw the bytes that the symbols encode.
+ * @param size the number of bytes.
+ * @param last whether this is the last block of the stream.
+ */
+static void bmp_deflate_block(BmpDeflate* d, uint8_t const* raw, uint64_t size, bool last) {
+    d->literal_freq[256] = 1;
+    bmp_huffman_pad(d->literal_freq, 286);
+    bmp_huffman_pad(d->distance_freq, 30);
+
+    uint8_t lengths[286 + 30] = {0}, fixed[288];
+    bmp_huffman_lengths(d->literal_freq, 286, 15, lengths);
+    bmp_huffman_lengths(d->distance_freq, 30, 15, lengths + 286);
+    for (int i = 0; i < 288; i++) {
+        fixed[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    }
+
+    uint32_t literals = 286, distances = 30;
+    for (; literals > 257 && lengths[literals - 1] == 0; literals--) {
+    }
+    for (; distances > 1 && lengths[286 + distances - 1] == 0; distances--) {
+    }
+    memmove(lengths + literals, lengths + 286, distances);
+
+    // run-length encode the code lengths, 16 repeats the previous length 3-6 times, 17 and 18
+    // repeat zero 3-10 and 11-138 times
+    uint16_t runs[286 + 30];
+    uint32_t run_count = 0, run_freq[19] = {0};
+    uint32_t const total = literals + distances;
+    for (uint32_t i = 0; i < total;) {
+        uint8_t const value = lengths[i];
+        uint32_t      repeat = 1;
+        for (; i + repeat < total && lengths[i + repeat] == value; repeat++) {
+        }
+        i += repeat;
+        if (value == 0) {
+            for (; repeat >= 11; repeat -= repeat < 138 ? repeat : 138) {
+                runs[run_count++] = 18 | (repeat < 138 ? repeat - 11 : 127) << 8;
+            }
+            for (; repeat >= 3; repeat -= repeat < 10 ? repeat : 10) {
+                runs[run_count++] = 17 | (repeat < 10 ? repeat - 3 : 7) << 8;
+            }
+        } else {
+            runs[run_count++] = value, repeat--;
+            for (; repeat >= 3; repeat -= repeat < 6 ? repeat : 6) {
+                runs[run_count++] = 16 | (repeat < 6 ? repeat - 3 : 3) << 8;
+            }
+        }
+        for (; repeat > 0; repeat--) {
+            runs[run_count++] = value;
+        }
+    }
+    for (uint32_t i = 0; i < run_count; i++) {
+        run_freq[runs[i] & 0xFF]++;
+    }
+    bmp_huffman_pad(run_freq, 19);
+
+    uint8_t  run_lengths[19];
+    uint32_t code_lengths = 19;
+    bmp_huffman_lengths(run_freq, 19, 7, run_lengths);
+    for (; code_lengths > 4 && run_lengths[BMP_CODE_LENGTH_ORDER[code_lengths - 1]] == 0;
+         code_lengths--) {
+    }
+
+    // the size of every kind of block, in bits
+    uint64_t dynamic = 3 + 14 + 3 * code_lengths, fixed_size = 3, extra = 0;
+    for (uint32_t i = 0; i < 19; i++) {
+        dynamic += (uint64_t)run_freq[i] * (run_lengths[i] + BMP_CODE_LENGTH_EXTRA[i]);
+    }
+    for (uint32_t i = 0; i < 286; i++) {
+        uint64_t const bits = i > 256 ? BMP_LENGTH_EXTRA[i - 257] : 0;
+        dynamic += (uint64_t)d->literal_freq[i] * (i < literals ? lengths[i] : 0);
+        fixed_size += (uint64_t)d->literal_freq[i] * fixed[i];
+        extra += d->literal_freq[i] * bits;
+    }
+    for (uint32_t i = 0; i < 30; i++) {
+        dynamic += (uint64_t)d->distance_freq[i] * (i < distances ? lengths[literals + i] : 0);
+        fixed_size += (uint64_t)d->distance_freq[i] * 5;
+        extra += (uint64_t)d->distance_freq[i] * BMP_DISTANCE_EXTRA[i];
+    }
+    dynamic += extra, fixed_size += extra;
+    uint64_t const stored = (size + 5 * ((size + 0xFFFE) / 0xFFFF) + 1) * 8;
+
+    if (stored <= dynamic && stored <= fixed_size) {
+        bmp_deflate_stored(d, raw, size, last);
+    } else if (fixed_size <= dynamic) {
+        uint8_t distance_fixed[30];
+        memset(distance_fixed, 5, sizeof(distance_fixed));
+        bmp_deflate_bits(d, last, 1);
+        bmp_deflate_bits(d, 1, 2);
+        bmp_deflate_symbols(d, fixed, distance_fixed);
+    } else {
+        bmp_deflate_bits(d, last, 1);
+        bmp_deflate_bits(d, 2, 2);
+        bmp_deflate_bits(d, literals - 257, 5);
+        bmp_deflate_bits(d, distances - 1, 5);
+        bmp_deflate_bits(d, code_lengths - 4, 4);
+        for (uint32_t i = 0; i < code_lengths; i++) {
+            bmp_deflate_bits(d, run_lengths[BMP_CODE_LENGTH_ORDER[i]], 3);
+        }
+
+        uint16_t run_codes[19];
+        bmp_huffman_codes(run_lengths, 19, run_codes);
+        for (uint32_t i = 0; i < run_count; i++) {
+            uint8_t const symbol = runs[i] & 0xFF;
+            bmp_deflate_bits(d, run_codes[symbol], run_lengths[symbol]);
+            bmp_deflate_bits(d, runs[i] >> 8, BMP_CODE_LENGTH_EXTRA[symbol]);
+        }
+
+        uint8_t literal_lengths[288] = {0}, distance_lengths[30] = {0};
+        memcpy(literal_lengths, lengths, literals);
+        memcpy(distance_lengths, lengths + literals, distances);
+        bmp_deflate_symbols(d, literal_lengths, distance_lengths);
+    }
+
+    d->symbol_count = 0;
+    memset(d->literal_freq, 0, sizeof(d->literal_freq));
+    memset(d->distance_freq, 0, sizeof(d->distance_freq));
+}
+
+static inline uint32_t bmp_deflate_hash(uint8_t const* p) {
+    return ((uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2]) * 2654435761U >>
+           (32 - BMP_DEFLATE_HASH_BITS);
+}
+
+/**
+ * @brief Find the longest match of a position in the window, every position before it is added
+ * to the hash chains first.
+ */
+static inline uint32_t bmp_deflate_match(BmpDeflate* d, uint8_t const* data, uint64_t size,
+                                         uint64_t position, uint8_t level, uint32_t* distance) {
+    for (; d->inserted < position && d->inserted + 3 <= size; d->inserted++) {
+        uint32_t const hash = bmp_deflate_hash(data + d->inserted);
+        d->prev[d->inserted % BMP_DEFLATE_WINDOW] = d->head[hash];
+        d->head[hash] = (int32_t)d->inserted;
+    }
+
+    uint32_t const max = size - position < 258 ? size - position : 258;
+    if (max < 3) {
+        return 0;
+    }
+
+    uint8_t const* const target = data + position;
+    uint32_t             best = 2, chain = BMP_DEFLATE_LEVELS[level].chain;
+    int64_t              candidate = d->head[bmp_deflate_hash(target)];
+    while (candidate >= 0 && position - candidate <= BMP_DEFLATE_WINDOW && chain-- > 0) {
+        uint8_t const* const source = data + candidate;
+        if (source[best] == target[best]) {
+            uint32_t length = 0;
+            for (; length + 8 <= max; length += 8) {
+                uint64_t a, b;
+                memcpy(&a, source + length, 8), memcpy(&b, target + length, 8);
+                if (a != b) {
+                    length += __builtin_ctzll(a ^ b) / 8;
+                    break;
+                }
+            }
+            for (; length < max && source[length] == target[length]; length++) {
+            }
+
+            if (length > best) {
+                best = length, *distance = position - candidate;
+                if (length >= BMP_DEFLATE_LEVELS[level].nice || length == max) {
+                    break;
+                }
+            }
+        }
+
+        int64_t const next = d->prev[candidate % BMP_DEFLATE_WINDOW];
+        if (next >= candidate) {
+            break;
+        }
+        candidate = next;
+    }
+    return best >= 3 ? best : 0;
+}
+
+/**
+ * @brief Compress bytes as a run of deflate blocks, which ends on a byte boundary.
+ *
+ * @param d the compressor, its output is appended to.
+ * @param data the bytes, a new window is started for them.
+ * @param size the number of bytes.
+ * @param level 0 to store the bytes, 1 for the fastest to 9 for the smallest.
+ * @param last whether the run ends the stream, otherwise it ends with an empty stored block.
+ */
+static void bmp_deflate(BmpDeflate* d, uint8_t const* data, uint64_t size, uint8_t level,
+                        bool last) {
+    if (level == 0) {
+        bmp_deflate_stored(d, data, size, last);
+        return;
+    }
+
+    memset(d->head, 0xFF, sizeof(int32_t) << BMP_DEFLATE_HASH_BITS);
+    d->inserted = 0;
+    bool const lazy = BMP_DEFLATE_LEVELS[level].lazy;
+    uint64_t   start = 0;
+    for (uint64_t i = 0; i < size;) {
+        uint32_t distance = 0;
+        uint32_t length = bmp_deflate_match(d, data, size, i, level, &distance);
+
+        // a longer match at the next byte is worth a literal
+        if (lazy && length > 0 && length < BMP_DEFLATE_LEVELS[level].nice) {
+            uint32_t next_distance;
+            if (bmp_deflate_match(d, data, size, i + 1, level, &next_distance) > length) {
+                length = 0;
+            }
+        }
+
+        if (length > 0) {
+            d->symbols[d->symbol_count++] = 1U << 31 | (length - 3) << 15 | (distance - 1);
+            d->literal_freq[257 + bmp_length_code[length]]++;
+            d->distance_freq[bmp_distance_code[distance <= 256 ? distance - 1
+                                                               : 256 + ((distance - 1) >> 7)]]++;
+            i += length;
+        } else {
+            d->symbols[d->symbol_count++] = data[i];
+            d->literal_freq[data[i]]++;
+            i++;
+        }
+
+        if (d->symbol_count == BMP_DEFLATE_BLOCK || i == size) {
+            bmp_deflate_block(d, data + start, i - start, last && i == size);
+            start = i;
+        }
+    }
+
+    if (!last) {
+        // an empty stored block ends the run on a byte boundary, so runs can be concatenated
+        bmp_deflate_stored(d, NULL, 0, false);
+    } else {
+        bmp_deflate_align(d);
+    }
+}
+
+/**
+ * @brief Write the bytes of a row, minus the prediction of a PNG filter.
+ *
+ * @param filter 0 none, 1 sub, 2 up, 4 paeth.
+ * @param row the bytes of the row.
+ * @param above the bytes of the row above, zeros for the first row.
+ * @param out where to store the filtered bytes.
+ * @param size the number of bytes of a row.
+ * @param bpp the number of bytes of a pixel.
+ */
+static void bmp_png_filter(uint8_t filter, uint8_t const* row, uint8_t const* above, uint8_t* out,
+                           uint64_t size, uint8_t bpp) {
+    uint64_t i = 0;
+    switch (filter) {
+        case 0:
+            memcpy(out, row, size);
+            return;
+        case 1:
+            for (; i < bpp && i < size; i++) {
+                out[i] = row[i];
+            }
+#if defined(BMP_SSE2)
+            for (; i + 16 <= size; i += 16) {
+                __m128i const x = _mm_loadu_si128((__m128i const*)(row + i));
+                __m128i const a = _mm_loadu_si128((__m128i const*)(row + i - bpp));
+                _mm_storeu_si128((__m128i*)(out + i), _mm_sub_epi8(x, a));
+            }
+#endif
+            for (; i < size; i++) {
+                out[i] = row[i] - row[i - bpp];
+            }
+            return;
+        case 2:
+#if defined(BMP_SSE2)
+            for (; i + 16 <= size; i += 16) {
+                __m128i const x = _mm_loadu_si128((__m128i const*)(row + i));
+                __m128i const b = _mm_loadu_si128((__m128i const*)(above + i));
+                _mm_storeu_si128((__m128i*)(out + i), _mm_sub_epi8(x, b));
+            }
+#endif
+            for (; i < size; i++) {
+                out[i] = row[i] - above[i];
+            }
+            return;
+    }
+
+    // the paeth predictor of the first pixel only has the byte above
+    for (; i < bpp && i < size; i++) {
+        out[i] = row[i] - above[i];
+    }
+#if defined(BMP_SSE2)
+    __m128i const zero = _mm_setzero_si128(), ones = _mm_set1_epi16(-1);
+    __m128i const mask = _mm_set1_epi16(0xFF);
+    for (; i + 8 <= size; i += 8) {
+        __m128i const x = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const*)(row + i)), zero);
+        __m128i const a =
+            _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const*)(row + i - bpp)), zero);
+        __m128i const b = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const*)(above + i)), zero);
+        __m128i const c =
+            _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i const*)(above + i - bpp)), zero);
+
+        __m128i const bc = _mm_sub_epi16(b, c), ac = _mm_sub_epi16(a, c);
+        __m128i const pa = _mm_max_epi16(bc, _mm_sub_epi16(zero, bc));
+        __m128i const pb = _mm_max_epi16(ac, _mm_sub_epi16(zero, ac));
+        __m128i const sum = _mm_add_epi16(bc, ac);
+        __m128i const pc = _mm_max_epi16(sum, _mm_sub_epi16(zero, sum));
+
+        __m128i const use_a =
+            _mm_xor_si128(_mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc)), ones);
+        __m128i const use_b = _mm_xor_si128(_mm_cmpgt_epi16(pb, pc), ones);
+        __m128i const other = _mm_or_si128(_mm_and_si128(use_b, b), _mm_andnot_si128(use_b, c));
+        __m128i const prediction =
+            _mm_or_si128(_mm_and_si128(use_a, a), _mm_andnot_si128(use_a, other));
+        __m128i const filtered = _mm_and_si128(_mm_sub_epi16(x, prediction), mask);
+        _mm_storel_epi64((__m128i*)(out + i), _mm_packus_epi16(filtered, zero));
+    }
+#endif
+    for (; i < size; i++) {
+        int16_t const a = row[i - bpp], b = above[i], c = above[i - bpp];
+        int16_t const pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+        out[i] = row[i] - (pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+    }
+}
+
+/** The sum of the filtered bytes as signed values, a smaller sum usually compresses better. */
+static inline uint64_t bmp_png_score(uint8_t const* filtered, uint64_t size) {
+    uint64_t score = 0, i = 0;
+#if defined(BMP_SSE2)
+    __m128i const zero = _mm_setzero_si128();
+    __m128i       sums = zero;
+    for (; i + 16 <= size; i += 16) {
+        __m128i const x = _mm_loadu_si128((__m128i const*)(filtered + i));
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_min_epu8(x, _mm_sub_epi8(zero, x)), zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, sums);
+    score = lanes[0] + lanes[1];
+#endif
+    for (; i < size; i++) {
+        score += filtered[i] < 128 ? filtered[i] : 256 - filtered[i];
+    }
+    return score;
+}
+
+typedef struct BmpPngPart {
+    uint8_t* data;
+    uint64_t size;
+    uint32_t crc;
+    uint32_t adler;
+} BmpPngPart;
+
+typedef struct BmpPngJob {
+    BMP*        bmp;
+    uint8_t     channels;
+    uint8_t     level;
+    /** The bytes of a filtered row, the filter type and the pixels. */
+    uint64_t    stride;
+    uint8_t*    filtered;
+    int64_t     part_rows;
+    int64_t     parts;
+    BmpPngPart* outputs;
+} BmpPngJob;
+
+static inline void bmp_png_pixels(BmpPngJob const* job, int64_t y, Pixel* straight,
+                                  uint8_t* out) {
+    int64_t const width = job->bmp->header->info_header.width;
+    Pixel const*  row = bmp_row(job->bmp, y);
+    if (job->bmp->premultiplied) {
+        bmp_unpremultiply_row(row, straight, width);
+        row = straight;
+    }
+    if (job->channels == 4) {
+        memcpy(out, row, width * sizeof(Pixel));
+        return;
+    }
+    for (int64_t x = 0; x < width; x++) {
+        out[x * 3] = row[x].red, out[x * 3 + 1] = row[x].green, out[x * 3 + 2] = row[x].blue;
+    }
+}
+
+static void bmp_png_filter_rows(void* context, int64_t from, int64_t to) {
+    BmpPngJob const* job = (BmpPngJob*)context;
+    uint64_t const   size = job->stride - 1;
+    uint8_t*         rows = calloc(2 * size + 4 * size, sizeof(uint8_t));
+    Pixel*           straight = malloc(job->bmp->header->info_header.width * sizeof(Pixel));
+    uint8_t*         above = rows;
+    uint8_t*         row = rows + size;
+    uint8_t*         candidates = rows + 2 * size;
+    if (from > 0) {
+        bmp_png_pixels(job, from - 1, straight, above);
+    }
+
+    for (int64_t y = from; y < to; y++) {
+        bmp_png_pixels(job, y, straight, row);
+        uint8_t* out = job->filtered + y * job->stride;
+
+        uint8_t filter = 0;
+        if (job->level > 0) {
+            static uint8_t const filters[4] = {0, 1, 2, 4};
+            uint64_t             best = UINT64_MAX;
+            for (int k = 0; k < 4; k++) {
+                bmp_png_filter(filters[k], row, above, candidates + k * size, size,
+                               job->channels);
+                uint64_t const score = bmp_png_score(candidates + k * size, size);
+                if (score < best) {
+                    best = score, filter = k;
+                }
+            }
+            memcpy(out + 1, candidates + filter * size, size);
+            filter = filters[filter];
+        } else {
+            memcpy(out + 1, row, size);
+        }
+        out[0] = filter;
+
+        uint8_t* swap = above;
+        above = row, row = swap;
+    }
+
+    free(rows), free(straight);
+}
+
+static void bmp_png_compress_parts(void* context, int64_t from, int64_t to) {
+    BmpPngJob const* job = (BmpPngJob*)context;
+    int64_t const    height = job->bmp->header->info_header.height;
+
+    BmpDeflate d = {0};
+    d.symbols = malloc(BMP_DEFLATE_BLOCK * sizeof(uint32_t));
+    d.head = malloc(sizeof(int32_t) << BMP_DEFLATE_HASH_BITS);
+    d.prev = malloc(BMP_DEFLATE_WINDOW * sizeof(int32_t));
+
+    for (int64_t part = from; part < to; part++) {
+        int64_t const  first = part * job->part_rows;
+        int64_t const  rows = height - first < job->part_rows ? height - first : job->part_rows;
+        uint8_t const* data = job->filtered + first * job->stride;
+        uint64_t const size = rows * job->stride;
+
+        // room for the chunk length and type in front, which are part of the CRC
+        d.capacity = size / 2 + 64;
+        d.out = malloc(d.capacity);
+        d.size = 8;
+        if (part == 0) {
+            // the zlib header, deflate with a 32K window and the compression level
+            uint8_t const level = job->level < 2 ? 0 : job->level < 6 ? 1 : job->level == 6 ? 2 : 3;
+            uint8_t const flags = level << 6;
+            d.out[d.size++] = 0x78;
+            d.out[d.size++] = flags + 31 - ((0x78 << 8 | flags) % 31);
+        }
+        bmp_deflate(&d, data, size, job->level, part == job->parts - 1);
+        bmp_deflate_reserve(&d, 4);
+
+        BmpPngPart* output = job->outputs + part;
+        output->data = d.out, output->size = d.size - 8;
+        output->adler = bmp_adler32(1, data, size);
+        memcpy(d.out + 4, "IDAT", 4);
+        output->crc = bmp_crc32(0, d.out + 4, output->size + 4);
+        d.out = NULL;
+    }
+
+    free(d.symbols), free(d.head), free(d.prev);
+}
+
+static inline void bmp_png_u32(uint8_t* p, uint32_t value) {
+    p[0] = value >> 24, p[1] = value >> 16, p[2] = value >> 8, p[3] = value;
+}
+
+static bool bmp_png_chunk(FILE* file, char const* type, uint8_t* data, uint32_t size) {
+    uint8_t length[4], crc[4];
+    bmp_png_u32(length, size);
+    bmp_png_u32(crc, bmp_crc32(bmp_crc32(0, type, 4), data, size));
+    return fwrite(length, 4, 1, file) == 1 && fwrite(type, 4, 1, file) == 1 &&
+           (size == 0 || fwrite(data, size, 1, file) == 1) && fwrite(crc, 4, 1, file) == 1;
+}
+
+/**
+ * @brief Write a PNG file with 8 bits per channel. Rows are filtered with the filter that
+ * predicts them best, then compressed in parts of about 1 MB on the threads that bmp_parallel
+ * starts for the call.
+ *
+ * @param bmp the image.
+ * @param path the path of the file.
+ * @param alpha whether to store the alpha channel.
+ * @param level 0 to store the pixels uncompressed, 1 for the fastest to 9 for the smallest.
+ * @return the error code.
+ */
+uint8_t write_png(BMP* bmp, char const* path, bool alpha, uint8_t level) {
+    int64_t const width = bmp->header->info_header.width;
+    int64_t const height = bmp->header->info_header.height;
+    if (level > 9 || width == 0 || height == 0) {
+        return BMP_ERROR_NOT_SUPPORTED;
+    }
+    pthread_once(&bmp_png_once, bmp_png_init);
+
+    BmpPngJob job = {.bmp = bmp, .channels = alpha ? 4 : 3, .level = level};
+    job.stride = 1 + width * job.channels;
+    job.part_rows = job.stride < BMP_PNG_PART ? BMP_PNG_PART / job.stride : 1;
+    job.parts = (height + job.part_rows - 1) / job.part_rows;
+    job.filtered = malloc(height * job.stride);
+    job.outputs = calloc(job.parts, sizeof(BmpPngPart));
+    bmp_parallel(height, 16, bmp_png_filter_rows, &job);
+    bmp_parallel(job.parts, 1, bmp_png_compress_parts, &job);
+
+    // the checksum of all filtered bytes ends the last part
+    uint32_t adler = job.outputs[0].adler;
+    for (int64_t part = 1; part < job.parts; part++) {
+        int64_t const rows = height - part * job.part_rows < job.part_rows
+                                 ? height - part * job.part_rows
+                                 : job.part_rows;
+        adler = bmp_adler32_combine(adler, job.outputs[part].adler, rows * job.stride);
+    }
+    BmpPngPart* last = job.outputs + job.parts - 1;
+    last->data = realloc(last->data, 8 + last->size + 4 + 4);
+    bmp_png_u32(last->data + 8 + last->size, adler);
+    last->size += 4;
+    last->crc = bmp_crc32(0, last->data + 4, last->size + 4);
+
+    uint8_t error = BMP_ERROR_NONE;
+    FILE*   file = fopen(path, "wb");
+    if (file != NULL) {
+        uint8_t header[13] = {0};
+        bmp_png_u32(header, width), bmp_png_u32(header + 4, height);
+        header[8] = 8, header[9] = alpha ? 6 : 2;
+
+        bool ok = fwrite("\x89PNG\r\n\x1A\n", 8, 1, file) == 1 &&
+                  bmp_png_chunk(file, "IHDR", header, sizeof(header));
+        for (int64_t part = 0; part < job.parts && ok; part++) {
+            BmpPngPart* output = job.outputs + part;
+            bmp_png_u32(output->data, output->size);
+            bmp_png_u32(output->data + 8 + output->size, output->crc);
+            ok = fwrite(output->data, output->size + 12, 1, file) == 1;
+        }
+        ok = ok && bmp_png_chunk(file, "IEND", NULL, 0);
+        error = fclose(file) == 0 && ok ? BMP_ERROR_NONE : BMP_ERROR_FILE_ERROR;
+    } else {
+        error = BMP_ERROR_FILE_ERROR;
+    }
+
+    for (int64_t part = 0; part < job.parts; part++) {
+        free(job.outputs[part].data);
+    }
+    free(job.outputs), free(job.filtered);
+    return error;
+}
+// #endregion
+
+// #region Resampling.
+enum BMP_FILTER {
+    BMP_FILTER_NEAREST = 0,
+    BMP_FILTER_BOX,
+    BMP_FILTER_BILINEAR,
+    BMP_FILTER_LANCZOS3,
+};
+
+/** Fixed-point precision of the resampling weights. */
+#define BMP_WEIGHT_BITS 14
+
+typedef struct BmpWeights {
+    /** Number of taps of every output sample. */
+    int32_t  taps;
+    /** First source index of every output sample. */
+    int32_t* start;
+    /** `taps` weights per output sample, summing to 1 << BMP_WEIGHT_BITS. */
+    int16_t* weights;
+} BmpWeights;
+
+static inline double bmp_filter_support(uint8_t filter) {
+    switch (filter) {
+        case BMP_FILTER_BILINEAR:
+            return 1.0;
+        case BMP_FILTER_LANCZOS3:
+            return 3.0;
+        default:
+            return 0.5;
+    }
+}
+
+static inline double bmp_filter_weight(uint8_t filter, double x) {
+    x = fabs(x);
+    switch (filter) {
+        case BMP_FILTER_BILINEAR:
+            return x < 1.0 ? 1.0 - x : 0.0;
+        case BMP_FILTER_LANCZOS3:
+            if (x < 1e-8) {
+                return 1.0;
+            }
+            if (x >= 3.0) {
+                return 0.0;
+            }
+            return 3.0 * sin(M_PI * x) * sin(M_PI * x / 3.0) / (M_PI * M_PI * x * x);
+        default:
+            return x <= 0.5 ? 1.0 : 0.0;
+    }
+}
+
+/**
+ * @brief Precompute the fixed-point weights to resample one axis.
+ *
+ * @param in_size the source size.
+ * @param out_size the target size.
+ * @param filter the filter, one of BMP_FILTER.
+ * @return the weights, release with bmp_weights_free.
+ */
+BmpWeights bmp_weights(uint32_t in_size, uint32_t out_size, uint8_t filter) {
+    double  scale = (double)in_size / out_size;
+    double  stretch = scale > 1.0 ? scale : 1.0;
+    double  support = bmp_filter_support(filter) * stretch;
+    int32_t span = filter == BMP_FILTER_NEAREST ? 1 : (int32_t)ceil(2.0 * support) + 2;
+
+    double*  values = calloc((uint64_t)out_size * span, sizeof(double));
+    int32_t* first = malloc(out_size * sizeof(int32_t));
+    int32_t* count = malloc(out_size * sizeof(int32_t));
+    int32_t  taps = 1;
+
+    for (uint32_t i = 0; i < out_size; i++) {
+        double  center = (i + 0.5) * scale;
+        double* value = values + (uint64_t)i * span;
+
+        if (filter == BMP_FILTER_NEAREST) {
+            first[i] = (int32_t)center < (int32_t)in_size ? (int32_t)center : (int32_t)in_size - 1;
+            count[i] = 1;
+            value[0] = 1.0;
+            continue;
+        }
+
+        int64_t left = (int64_t)floor(center - support);
+        int64_t right = (int64_t)ceil(center + support);
+        int64_t origin = left < 0 ? 0 : left;
+        double  total = 0.0;
+
+        // samples outside of the image are folded onto the edge pixels
+        for (int64_t j = left; j <= right; j++) {
+            double weight = bmp_filter_weight(filter, (j + 0.5 - center) / stretch);
+            if (weight == 0.0) {
+                continue;
+            }
+            int64_t clamped = j < 0 ? 0 : (j >= in_size ? in_size - 1 : j);
+            value[clamped - origin] += weight;
+            total += weight;
+        }
+
+        if (total == 0.0) {
+            int64_t clamped = (int64_t)center < in_size ? (int64_t)center : in_size - 1;
+            value[clamped - origin] = total = 1.0;
+        }
+
+        int32_t from = 0, to = span - 1;
+        while (from < to && value[from] == 0.0) {
+            from++;
+        }
+        while (to > from && value[to] == 0.0) {
+            to--;
+        }
+
+        first[i] = origin + from;
+        count[i] = to - from + 1;
+        for (int32_t k = 0; k < count[i]; k++) {
+            value[k] = value[from + k] / total;
+        }
+        taps = count[i] > taps ? count[i] : taps;
+    }
+
+    BmpWeights weights = {taps, malloc(out_size * sizeof(int32_t)),
+                          calloc((uint64_t)out_size * taps, sizeof(int16_t))};
+    for (uint32_t i = 0; i < out_size; i++) {
+        double const* value = values + (uint64_t)i * span;
+
+        // every sample uses the same number of taps, so shift windows back from the right edge
+        int32_t start = first[i] + taps > (int32_t)in_size ? (int32_t)in_size - taps : first[i];
+        int16_t* weight = weights.weights + (uint64_t)i * taps + (first[i] - start);
+
+        int32_t sum = 0, largest = 0;
+        for (int32_t k = 0; k < count[i]; k++) {
+            weight[k] = (int16_t)lround(value[k] * (1 << BMP_WEIGHT_BITS));
+            sum += weight[k];
+            largest = weight[k] > weight[largest] ? k : largest;
+        }
+        weight[largest] += (1 << BMP_WEIGHT_BITS) - sum;
+        weights.start[i] = start;
+    }
+
+    free(values), free(first), free(count);
+    return weights;
+}
+
+void bmp_weights_free(BmpWeights* weights) {
+    free(weights->start), free(weights->weights);
+    weights->start = NULL, weights->weights = NULL;
+}
+
+static inline uint8_t bmp_clamp_u8(int32_t value) {
+    return value < 0 ? 0 : (value > 0xFF ? 0xFF : (uint8_t)value);
+}
+
+/** Round the fixed-point channel sums back to a pixel. */
+static inline Pixel bmp_weighted_pixel(int32_t red, int32_t green, int32_t blue, int32_t alpha) {
+    return (Pixel){bmp_clamp_u8(red >> BMP_WEIGHT_BITS), bmp_clamp_u8(green >> BMP_WEIGHT_BITS),
+                   bmp_clamp_u8(blue >> BMP_WEIGHT_BITS), bmp_clamp_u8(alpha >> BMP_WEIGHT_BITS)};
+}
+
+/** Pack two 16-bit weights into the 32-bit lane layout used by madd. */
+static inline int32_t bmp_weight_pair(int16_t first, int16_t second) {
+    return (int32_t)((uint32_t)(uint16_t)first | ((uint32_t)(uint16_t)second << 16));
+}
+
+/**
+ * @brief Resample a row horizontally.
+ *
+ * @param src the source row.
+ * @param dst the target row.
+ * @param width the width of the target row.
+ * @param weights the horizontal weights.
+ */
+static inline void bmp_resample_row(Pixel const* src, Pixel* dst, uint32_t width,
+                                    BmpWeights const* weights) {
+    int32_t const taps = weights->taps;
+    for (uint32_t x = 0; x < width; x++) {
+        Pixel const*   from = src + weights->start[x];
+        int16_t const* weight = weights->weights + (uint64_t)x * taps;
+#if defined(BMP_SSE2)
+        __m128i const zero = _mm_setzero_si128();
+        __m128i       acc = _mm_set1_epi32(1 << (BMP_WEIGHT_BITS - 1));
+        int32_t       k = 0;
+        for (; k + 1 < taps; k += 2) {
+            int32_t a, b;
+            memcpy(&a, from + k, sizeof(int32_t));
+            memcpy(&b, from + k + 1, sizeof(int32_t));
+            // r0 r1 g0 g1 b0 b1 a0 a1, so each madd pair is one channel of two taps
+            __m128i pair = _mm_unpacklo_epi8(_mm_cvtsi32_si128(a), _mm_cvtsi32_si128(b));
+            __m128i w = _mm_set1_epi32(bmp_weight_pair(weight[k], weight[k + 1]));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi8(pair, zero), w));
+        }
+        if (k < taps) {
+            int32_t a;
+            memcpy(&a, from + k, sizeof(int32_t));
+            __m128i one = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(a), zero), zero);
+            __m128i w = _mm_set1_epi32(bmp_weight_pair(weight[k], 0));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(one, w));
+        }
+        acc = _mm_srai_epi32(acc, BMP_WEIGHT_BITS);
+        acc = _mm_packs_epi32(acc, acc);
+        int32_t result = _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+        memcpy(dst + x, &result, sizeof(int32_t));
+#else
+        int32_t red = 1 << (BMP_WEIGHT_BITS - 1), green = red, blue = red, alpha = red;
+        for (int32_t k = 0; k < taps; k++) {
+            red += weight[k] * from[k].red;
+            green += weight[k] * from[k].green;
+            blue += weight[k] * from[k].blue;
+            alpha += weight[k] * from[k].alpha;
+        }
+        dst[x] = bmp_weighted_pixel(red, green, blue, alpha);
+#endif
+    }
+}
+
+/**
+ * @brief Resample a row vertically from `taps` source rows.
+ *
+ * @param rows the source rows.
+ * @param weight the weights of the source rows.
+ * @param taps the number of source rows.
+ * @param dst the target row.
+ * @param width the width of the rows.
+ */
+static inline void bmp_resample_column(Pixel const* const* rows, int16_t const* weight,
+                                       int32_t taps, Pixel* dst, uint32_t width) {
+    uint32_t x = 0;
+#if defined(BMP_SSE2)
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const round = _mm_set1_epi32(1 << (BMP_WEIGHT_BITS - 1));
+    for (; x + 4 <= width; x += 4) {
+        __m128i acc[4] = {round, round, round, round};
+        for (int32_t k = 0; k < taps; k += 2) {
+            __m128i a = _mm_loadu_si128((__m128i const*)(rows[k] + x));
+            __m128i b = k + 1 < taps ? _mm_loadu_si128((__m128i const*)(rows[k + 1] + x)) : zero;
+            int16_t next = k + 1 < taps ? weight[k + 1] : 0;
+            __m128i w = _mm_set1_epi32(bmp_weight_pair(weight[k], next));
+            // interleave the two rows so every madd pair is one channel of one pixel
+            __m128i low = _mm_unpacklo_epi8(a, b), high = _mm_unpackhi_epi8(a, b);
+            acc[0] = _mm_add_epi32(acc[0], _mm_madd_epi16(_mm_unpacklo_epi8(low, zero), w));
+            acc[1] = _mm_add_epi32(acc[1], _mm_madd_epi16(_mm_unpackhi_epi8(low, zero), w));
+            acc[2] = _mm_add_epi32(acc[2], _mm_madd_epi16(_mm_unpacklo_epi8(high, zero), w));
+            acc[3] = _mm_add_epi32(acc[3], _mm_madd_epi16(_mm_unpackhi_epi8(high, zero), w));
+        }
+        __m128i first = _mm_packs_epi32(_mm_srai_epi32(acc[0], BMP_WEIGHT_BITS),
+                                        _mm_srai_epi32(acc[1], BMP_WEIGHT_BITS));
+        __m128i second = _mm_packs_epi32(_mm_srai_epi32(acc[2], BMP_WEIGHT_BITS),
+                                         _mm_srai_epi32(acc[3], BMP_WEIGHT_BITS));
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(first, second));
+    }
+#endif
+    for (; x < width; x++) {
+        int32_t red = 1 << (BMP_WEIGHT_BITS - 1), green = red, blue = red, alpha = red;
+        for (int32_t k = 0; k < taps; k++) {
+            red += weight[k] * rows[k][x].red;
+            green += weight[k] * rows[k][x].green;
+            blue += weight[k] * rows[k][x].blue;
+            alpha += weight[k] * rows[k][x].alpha;
+        }
+        dst[x] = bmp_weighted_pixel(red, green, blue, alpha);
+    }
+}
+
+typedef struct BmpResizeJob {
+    BMP*       source;
+    BMP*       target;
+    Pixel**    rows;
+    BmpWeights horizontal;
+    BmpWeights vertical;
+} BmpResizeJob;
+
+static void bmp_resize_horizontal(void* context, int64_t from, int64_t to) {
+    BmpResizeJob* job = (BmpResizeJob*)context;
+    uint32_t      width = job->target->header->info_header.width;
+    for (int64_t y = from; y < to; y++) {
+        bmp_resample_row(bmp_row(job->source, y), job->rows[y], width, &job->horizontal);
+    }
+}
+
+static void bmp_resize_vertical(void* context, int64_t from, int64_t to) {
+    BmpResizeJob* job = (BmpResizeJob*)context;
+    uint32_t      width = job->target->header->info_header.width;
+    int32_t       taps = job->vertical.taps;
+    for (int64_t y = from; y < to; y++) {
+        bmp_resample_column((Pixel const* const*)job->rows + job->vertical.start[y],
+                            job->vertical.weights + y * taps, taps, bmp_row(job->target, y),
+                            width);
+    }
+}
+
+/**
+ * @brief Resize the image into a new image with a separable filter.
+ *
+ * @param bmp the source image.
+ * @param width the width of the new image.
+ * @param height the height of the new image.
+ * @param filter the filter, one of BMP_FILTER.
+ * @return the new image, or NULL if a size is 0.
+ */
+BMP* bmp_resize(BMP* bmp, uint32_t width, uint32_t height, uint8_t filter) {
+    uint32_t source_width = bmp->header->info_header.width;
+    uint32_t source_height = bmp->header->info_header.height;
+    if (width == 0 || height == 0 || source_width == 0 || source_height == 0) {
+        return NULL;
+    }
+
+    BmpResizeJob job = {bmp, bmp_alloc(width, height), malloc(source_height * sizeof(Pixel*)),
+                        bmp_weights(source_width, width, filter),
+                        bmp_weights(source_height, height, filter)};
+
+    // the horizontal pass is skipped when only the height changes
+    Pixel* temp = NULL;
+    if (width == source_width) {
+        for (uint32_t y = 0; y < source_height; y++) {
+            job.rows[y] = bmp_row(bmp, y);
+        }
+    } else {
+        temp = malloc((uint64_t)width * source_height * sizeof(Pixel));
+        for (uint32_t y = 0; y < source_height; y++) {
+            job.rows[y] = temp + (uint64_t)y * width;
+        }
+        bmp_parallel(source_height, 16, bmp_resize_horizontal, &job);
+    }
+
+    bmp_parallel(height, 16, bmp_resize_vertical, &job);
+
+    free(temp), free(job.rows);
+    bmp_weights_free(&job.horizontal), bmp_weights_free(&job.vertical);
+    job.target->premultiplied = bmp->premultiplied;
+    return job.target;
+}
+
+/** Precision of the linear light values of the gamma-correct reduction. */
+#define BMP_LINEAR_BITS 14
+
+static uint16_t       bmp_srgb_linear[256];
+static uint8_t        bmp_linear_srgb[1 << BMP_LINEAR_BITS];
+static pthread_once_t bmp_gamma_once = PTHREAD_ONCE_INIT;
+
+static void bmp_gamma_init(void) {
+    for (int32_t v = 0; v < 256; v++) {
+        double c = v / 255.0;
+        c = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+        bmp_srgb_linear[v] = (uint16_t)lround(c * ((1 << BMP_LINEAR_BITS) - 1));
+    }
+    for (int32_t i = 0; i < 1 << BMP_LINEAR_BITS; i++) {
+        double c = (double)i / ((1 << BMP_LINEAR_BITS) - 1);
+        c = c <= 0.0031308 ? c * 12.92 : 1.055 * pow(c, 1.0 / 2.4) - 0.055;
+        bmp_linear_srgb[i] = (uint8_t)lround(c * 255.0);
+    }
+}
+
+/**
+ * @brief Reduce two rows into one with a 2x2 box filter, an odd last column is averaged alone.
+ *
+ * @param top the upper row.
+ * @param bottom the lower row, the same as top for an odd last row.
+ * @param dst the reduced row, (width + 1) / 2 pixels.
+ * @param width the width of the source rows.
+ * @param gamma whether to average the color channels in linear light.
+ */
+static inline void bmp_reduce_row(Pixel const* top, Pixel const* bottom, Pixel* dst,
+                                  uint32_t width, bool gamma) {
+    uint32_t x = 0;
+    if (gamma) {
+        for (; x + 1 < width; x += 2) {
+            uint32_t const red = bmp_srgb_linear[top[x].red] + bmp_srgb_linear[top[x + 1].red] +
+                                 bmp_srgb_linear[bottom[x].red] +
+                                 bmp_srgb_linear[bottom[x + 1].red];
+            uint32_t const green =
+                bmp_srgb_linear[top[x].green] + bmp_srgb_linear[top[x + 1].green] +
+                bmp_srgb_linear[bottom[x].green] + bmp_srgb_linear[bottom[x + 1].green];
+            uint32_t const blue =
+                bmp_srgb_linear[top[x].blue] + bmp_srgb_linear[top[x + 1].blue] +
+                bmp_srgb_linear[bottom[x].blue] + bmp_srgb_linear[bottom[x + 1].blue];
+            uint32_t const alpha = top[x].alpha + top[x + 1].alpha + bottom[x].alpha +
+                                   bottom[x + 1].alpha;
+
+            dst[x / 2] = (Pixel){bmp_linear_srgb[(red + 2) >> 2],
+                                 bmp_linear_srgb[(green + 2) >> 2],
+                                 bmp_linear_srgb[(blue + 2) >> 2], (alpha + 2) >> 2};
+        }
+        if (x < width) {
+            dst[x / 2] = (Pixel){
+                bmp_linear_srgb[(bmp_srgb_linear[top[x].red] + bmp_srgb_linear[bottom[x].red] +
+                                 1) >> 1],
+                bmp_linear_srgb[(bmp_srgb_linear[top[x].green] +
+                                 bmp_srgb_linear[bottom[x].green] + 1) >> 1],
+                bmp_linear_srgb[(bmp_srgb_linear[top[x].blue] + bmp_srgb_linear[bottom[x].blue] +
+                                 1) >> 1],
+                (top[x].alpha + bottom[x].alpha + 1) >> 1};
+        }
+        return;
+    }
+
+#if defined(BMP_SSE2)
+    __m128i const zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+    for (; x + 8 <= width; x += 8) {
+        __m128i reduced[2];
+        for (int half = 0; half < 2; half++) {
+            __m128i const a = _mm_loadu_si128((__m128i const*)(top + x + half * 4));
+            __m128i const b = _mm_loadu_si128((__m128i const*)(bottom + x + half * 4));
+            // vertical sums of pixels 0, 1 and of pixels 2, 3 as 16-bit lanes
+            __m128i const low = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                              _mm_unpacklo_epi8(b, zero));
+            __m128i const high = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                               _mm_unpackhi_epi8(b, zero));
+            __m128i const sum = _mm_add_epi16(_mm_unpacklo_epi64(low, high),
+                                              _mm_unpackhi_epi64(low, high));
+            reduced[half] = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+        }
+        _mm_storeu_si128((__m128i*)(dst + x / 2), _mm_packus_epi16(reduced[0], reduced[1]));
+    }
+#endif
+
+    for (; x + 1 < width; x += 2) {
+        dst[x / 2] = (Pixel){
+            (top[x].red + top[x + 1].red + bottom[x].red + bottom[x + 1].red + 2) >> 2,
+            (top[x].green + top[x + 1].green + bottom[x].green + bottom[x + 1].green + 2) >> 2,
+            (top[x].blue + top[x + 1].blue + bottom[x].blue + bottom[x + 1].blue + 2) >> 2,
+            (top[x].alpha + top[x + 1].alpha + bottom[x].alpha + bottom[x + 1].alpha + 2) >> 2};
+    }
+    if (x < width) {
+        dst[x / 2] = (Pixel){(top[x].red + bottom[x].red + 1) >> 1,
+                             (top[x].green + bottom[x].green + 1) >> 1,
+                             (top[x].blue + bottom[x].blue + 1) >> 1,
+                             (top[x].alpha + bottom[x].alpha + 1) >> 1};
+    }
+}
+
+typedef struct BmpPyramidJob {
+    BMP* source;
+    BMP* target;
+    bool gamma;
+} BmpPyramidJob;
+
+static void bmp_pyramid_rows(void* context, int64_t from, int64_t to) {
+    BmpPyramidJob const* job = (BmpPyramidJob*)context;
+    uint32_t const       width = job->source->header->info_header.width;
+    int64_t const        height = job->source->header->info_header.height;
+    for (int64_t y = from; y < to; y++) {
+        Pixel const* top = bmp_row(job->source, 2 * y);
+        Pixel const* bottom = 2 * y + 1 < height ? bmp_row(job->source, 2 * y + 1) : top;
+        bmp_reduce_row(top, bottom, bmp_row(job->target, y), width, job->gamma);
+    }
+}
+
+/**
+ * @brief Build the pyramid of an image, every level halves the previous level with a 2x2 box
+ * filter, rounding odd sizes up. The source is read once, every other level is reduced from the
+ * level before it and handed to the callback as soon as it is produced.
+ *
+ * @param bmp the source image, level 0.
+ * @param levels the maximum number of levels to produce, 0 to go down to 1x1.
+ * @param gamma whether to average the color channels in linear light, ignored for premultiplied
+ * images which are averaged as stored.
+ * @param level called with every level from 1, return true to take ownership of the level,
+ * otherwise it is freed once the next level is produced.
+ * @param ctx the context passed to level.
+ * @return the number of levels produced.
+ */
+uint32_t bmp_pyramid(BMP* bmp, uint32_t levels, bool gamma,
+                     bool (*level)(BMP* bmp, uint32_t level, void* ctx), void* ctx) {
+    gamma = gamma && !bmp->premultiplied;
+    if (gamma) {
+        pthread_once(&bmp_gamma_once, bmp_gamma_init);
+    }
+
+    BMP*     source = bmp;
+    bool     owned = false;
+    uint32_t count = 0;
+    while (levels == 0 || count < levels) {
+        uint32_t const width = source->header->info_header.width;
+        uint32_t const height = source->header->info_header.height;
+        if (width <= 1 && height <= 1) {
+            break;
+        }
+
+        BmpPyramidJob job = {source, bmp_alloc((width + 1) / 2, (height + 1) / 2), gamma};
+        job.target->premultiplied = bmp->premultiplied;
+        bmp_parallel((height + 1) / 2, 16, bmp_pyramid_rows, &job);
+
+        if (owned) {
+            bmp_free(source);
+        }
+        source = job.target;
+        owned = !level(source, ++count, ctx);
+    }
+
+    if (owned) {
+        bmp_free(source);
+    }
+    return count;
+}
+// #endregion
+
+// #region Transform.
+/** Side of the square tiles the transposing kernels walk through, in pixels. */
+#define BMP_TILE_SIZE 64
+
+/**
+ * @brief Transpose a 4x4 block of pixels in registers.
+ *
+ * @param src the 4 source rows, starting at the block.
+ * @param dst the 4 target rows, row i receives source column i.
+ * @param reverse store every target row in reverse order.
+ */
+static inline void bmp_transpose_4x4(Pixel* const* src, Pixel* const* dst, bool reverse) {
+#if defined(BMP_SSE2)
+    __m128i r0 = _mm_loadu_si128((__m128i const*)src[0]);
+    __m128i r1 = _mm_loadu_si128((__m128i const*)src[1]);
+    __m128i r2 = _mm_loadu_si128((__m128i const*)src[2]);
+    __m128i r3 = _mm_loadu_si128((__m128i const*)src[3]);
+
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1), t1 = _mm_unpacklo_epi32(r2, r3);
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1), t3 = _mm_unpackhi_epi32(r2, r3);
+    __m128i columns[4] = {_mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1),
+                          _mm_unpacklo_epi64(t2, t3), _mm_unpackhi_epi64(t2, t3)};
+
+    for (int i = 0; i < 4; i++) {
+        if (reverse) {
+            columns[i] = _mm_shuffle_epi32(columns[i], _MM_SHUFFLE(0, 1, 2, 3));
+        }
+        _mm_storeu_si128((__m128i*)dst[i], columns[i]);
+    }
+#else
+    Pixel block[4][4];
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 4; x++) {
+            block[x][reverse ? 3 - y : y] = src[y][x];
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        memcpy(dst[i], block[i], sizeof(block[i]));
+    }
+#endif
+}
+
+typedef struct BmpTransposeJob {
+    BMP* source;
+    BMP* target;
+    /** Source column x goes to target row width - 1 - x. */
+    bool flip_rows;
+    /** Source row y goes to target column height - 1 - y. */
+    bool flip_columns;
+} BmpTransposeJob;
+
+static void bmp_transpose_tiles(void* context, int64_t from, int64_t to) {
+    BmpTransposeJob const* job = (BmpTransposeJob*)context;
+    int64_t                width = job->source->header->info_header.width;
+    int64_t                height = job->source->header->info_header.height;
+
+    // every band is a stripe of source columns, which is a band of target rows
+    for (int64_t x0 = from * BMP_TILE_SIZE; x0 < to * BMP_TILE_SIZE && x0 < width;
+         x0 += BMP_TILE_SIZE) {
+        int64_t x1 = x0 + BMP_TILE_SIZE < width ? x0 + BMP_TILE_SIZE : width;
+        for (int64_t y0 = 0; y0 < height; y0 += BMP_TILE_SIZE) {
+            int64_t y1 = y0 + BMP_TILE_SIZE < height ? y0 + BMP_TILE_SIZE : height;
+
+            for (int64_t y = y0; y < y1; y += 4) {
+                for (int64_t x = x0; x < x1; x += 4) {
+                    if (x + 4 <= x1 && y + 4 <= y1) {
+                        int64_t column = job->flip_columns ? height - 4 - y : y;
+                        Pixel*  src[4], *dst[4];
+                        for (int i = 0; i < 4; i++) {
+                            int64_t row = job->flip_rows ? width - 1 - (x + i) : x + i;
+                            src[i] = bmp_row(job->source, y + i) + x;
+                            dst[i] = bmp_row(job->target, row) + column;
+                        }
+                        bmp_transpose_4x4(src, dst, job->flip_columns);
+                        continue;
+                    }
+
+                    for (int64_t yy = y; yy < y + 4 && yy < y1; yy++) {
+                        for (int64_t xx = x; xx < x + 4 && xx < x1; xx++) {
+                            int64_t row = job->flip_rows ? width - 1 - xx : xx;
+                            int64_t column = job->flip_columns ? height - 1 - yy : yy;
+                            bmp_row(job->target, row)[column] = bmp_row(job->source, yy)[xx];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static inline BMP* bmp_transposed(BMP* bmp, bool flip_rows, bool flip_columns) {
+    int64_t width = bmp->header->info_header.width;
+    int64_t height = bmp->header->info_header.height;
+
+    BmpTransposeJob job = {bmp, bmp_alloc(height, width), flip_rows, flip_columns};
+    bmp_parallel((width + BMP_TILE_SIZE - 1) / BMP_TILE_SIZE, 1, bmp_transpose_tiles, &job);
+    job.target->premultiplied = bmp->premultiplied;
+    return job.target;
+}
+
+/**
+ * @brief Transpose the image into a new image, swapping the x and y axes.
+ *
+ * @param bmp the source image.
+ * @return the transposed image.
+ */
+BMP* bmp_transpose(BMP* bmp) { return bmp_transposed(bmp, false, false); }
+
+static void bmp_flip_rows(void* context, int64_t from, int64_t to) {
+    BMP*    bmp = (BMP*)context;
+    int64_t width = bmp->header->info_header.width;
+    for (int64_t y = from; y < to; y++) {
+        Pixel*  row = bmp_row(bmp, y);
+        int64_t left = 0, right = width;
+#if defined(BMP_SSE2)
+        for (; right - left >= 8; left += 4, right -= 4) {
+            __m128i a = _mm_loadu_si128((__m128i const*)(row + left));
+            __m128i b = _mm_loadu_si128((__m128i const*)(row + right - 4));
+            _mm_storeu_si128((__m128i*)(row + left), _mm_shuffle_epi32(b, _MM_SHUFFLE(0, 1, 2, 3)));
+            _mm_storeu_si128((__m128i*)(row + right - 4),
+                             _mm_shuffle_epi32(a, _MM_SHUFFLE(0, 1, 2, 3)));
+        }
+#endif
+        for (right--; left < right; left++, right--) {
+            Pixel temp = row[left];
+            row[left] = row[right];
+            row[right] = temp;
+        }
+    }
+}
+
+/**
+ * @brief Mirror the image in place.
+ *
+ * @param bmp the image to mirror.
+ * @param horizontal mirror left and right.
+ * @param vertical mirror top and bottom.
+ * @return true if the image was mirrored.
+ */
+bool bmp_flip(BMP* bmp, bool horizontal, bool vertical) {
+    if (bmp == NULL) {
+        return false;
+    }
+
+    int64_t width = bmp->header->info_header.width;
+    int64_t height = bmp->header->info_header.height;
+
+    if (horizontal) {
+        bmp_parallel(height, 64, bmp_flip_rows, bmp);
+    }
+
+    if (vertical && width > 0) {
+        Pixel* temp = malloc(width * sizeof(Pixel));
+        for (int64_t y = 0; y < height / 2; y++) {
+            memcpy(temp, bmp_row(bmp, y), width * sizeof(Pixel));
+            memcpy(bmp_row(bmp, y), bmp_row(bmp, height - 1 - y), width * sizeof(Pixel));
+            memcpy(bmp_row(bmp, height - 1 - y), temp, width * sizeof(Pixel));
+        }
+        free(temp);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Rotate the image clockwise into a new image.
+ *
+ * @param bmp the source image.
+ * @param degrees the angle, a multiple of 90.
+ * @return the rotated image, or NULL if the angle is not a multiple of 90.
+ */
+BMP* bmp_rotate(BMP* bmp, int32_t degrees) {
+    if (degrees % 90 != 0) {
+        return NULL;
+    }
+
+    switch (((degrees % 360) + 360) % 360) {
+        case 90:
+            return bmp_transposed(bmp, false, true);
+        case 270:
+            return bmp_transposed(bmp, true, false);
+    }
+
+    int64_t width = bmp->header->info_header.width;
+    int64_t height = bmp->header->info_header.height;
+    BMP*    rotated = bmp_alloc(width, height);
+    rotated->premultiplied = bmp->premultiplied;
+    for (int64_t y = 0; y < height; y++) {
+        memcpy(bmp_row(rotated, y), bmp_row(bmp, y), width * sizeof(Pixel));
+    }
+
+    if (((degrees % 360) + 360) % 360 == 180) {
+        bmp_flip(rotated, true, true);
+    }
+
+    return rotated;
+}
+
+static void bmp_transpose_square(void* context, int64_t from, int64_t to) {
+    BMP*    bmp = (BMP*)context;
+    int64_t size = bmp->header->info_header.width;
+    int64_t aligned = size / 4 * 4;
+
+    // band i owns the 4x4 blocks (i, j) with j >= i and swaps them with (j, i)
+    for (int64_t by = from * 4; by < to * 4 && by < aligned; by += 4) {
+        for (int64_t bx = by; bx < aligned; bx += 4) {
+            Pixel  block[16];
+            Pixel* src[4], *dst[4], *temp[4] = {block, block + 4, block + 8, block + 12};
+            for (int i = 0; i < 4; i++) {
+                src[i] = bmp_row(bmp, by + i) + bx;
+                dst[i] = bmp_row(bmp, bx + i) + by;
+            }
+
+            bmp_transpose_4x4(src, temp, false);
+            if (bx != by) {
+                bmp_transpose_4x4(dst, src, false);
+            }
+            for (int i = 0; i < 4; i++) {
+                memcpy(dst[i], temp[i], sizeof(Pixel) * 4);
+            }
+        }
+
+        for (int64_t y = by; y < by + 4; y++) {
+            for (int64_t x = aligned; x < size; x++) {
+                Pixel pixel = bmp_row(bmp, y)[x];
+                bmp_row(bmp, y)[x] = bmp_row(bmp, x)[y];
+                bmp_row(bmp, x)[y] = pixel;
+            }
+        }
+    }
+
+    if (to == (size + 3) / 4) {
+        for (int64_t y = aligned; y < size; y++) {
+            for (int64_t x = y + 1; x < size; x++) {
+                Pixel pixel = bmp_row(bmp, y)[x];
+                bmp_row(bmp, y)[x] = bmp_row(bmp, x)[y];
+                bmp_row(bmp, x)[y] = pixel;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Rotate the image clockwise in place. Square images and half turns are rotated inside of
+ * their own buffer, other images are rotated into a new buffer which replaces the old one.
+ *
+ * @param bmp the image to rotate.
+ * @param degrees the angle, a multiple of 90.
+ * @return true if the image was rotated.
+ */
+bool bmp_rotate_in_place(BMP* bmp, int32_t degrees) {
+    if (bmp == NULL || degrees % 90 != 0) {
+        return false;
+    }
+
+    int32_t angle = ((degrees % 360) + 360) % 360;
+    if (angle == 0 || angle == 180) {
+        return bmp_flip(bmp, angle == 180, angle == 180);
+    }
+
+    int64_t width = bmp->header->info_header.width;
+    int64_t height = bmp->header->info_header.height;
+    if (width == height) {
+        // transposing and then mirroring is a quarter turn
+        bmp_parallel((width + 3) / 4, 8, bmp_transpose_square, bmp);
+        return bmp_flip(bmp, angle == 90, angle == 270);
+    }
+
+    BMP* rotated = bmp_rotate(bmp, angle);
+    BMP  temp = *bmp;
+    bmp->pixels = rotated->pixels, bmp->data = rotated->data;
+    bmp->header->info_header.width = height, bmp->header->info_header.height = width;
+    rotated->pixels = temp.pixels, rotated->data = temp.data;
+    rotated->header->info_header.width = width, rotated->header->info_header.height = height;
+    bmp_free(rotated);
+
+    return true;
+}
+// #endregion
+
+// #region Filters.
+typedef struct BmpBands {
+    BMP*    bmp;
+    int64_t count;
+    int32_t radius;
+    /** Snapshot of the `radius` rows above and below every band, taken before any band writes. */
+    Pixel*  halo;
+} BmpBands;
+
+/**
+ * @brief Split the image into row bands that can be filtered in place concurrently.
+ *
+ * @param bmp the image.
+ * @param radius the number of neighbour rows a filter reads on each side.
+ * @return the bands, release with bmp_bands_free.
+ */
+BmpBands bmp_bands(BMP* bmp, int32_t radius) {
+    int64_t  width = bmp->header->info_header.width;
+    int64_t  height = bmp->header->info_header.height;
+    int64_t  count = bmp_threads() < height ? bmp_threads() : (height > 0 ? height : 1);
+    BmpBands bands = {bmp, count, radius,
+                      malloc((uint64_t)(count * 2 * radius * width + 1) * sizeof(Pixel))};
+
+    for (int64_t band = 0; band < count; band++) {
+        int64_t from = height * band / count, to = height * (band + 1) / count;
+        Pixel*  halo = bands.halo + band * 2 * radius * width;
+        for (int64_t i = 0; i < radius; i++) {
+            if (from - radius + i >= 0) {
+                memcpy(halo + i * width, bmp_row(bmp, from - radius + i), width * sizeof(Pixel));
+            }
+            if (to + i < height) {
+                memcpy(halo + (radius + i) * width, bmp_row(bmp, to + i), width * sizeof(Pixel));
+            }
+        }
+    }
+
+    return bands;
+}
+
+void bmp_bands_free(BmpBands* bands) {
+    free(bands->halo);
+    bands->halo = NULL;
+}
+
+/**
+ * @brief Get the original content of a row as seen by a band, rows out of the image are clamped.
+ *
+ * @param bands the bands.
+ * @param band the band reading the row.
+ * @param y the y coordinate of the row, at most `radius` rows away from the band.
+ * @return the row.
+ */
+static inline Pixel const* bmp_band_row(BmpBands const* bands, int64_t band, int64_t y) {
+    int64_t width = bands->bmp->header->info_header.width;
+    int64_t height = bands->bmp->header->info_header.height;
+    int64_t from = height * band / bands->count, to = height * (band + 1) / bands->count;
+    Pixel*  halo = bands->halo + band * 2 * bands->radius * width;
+
+    y = y < 0 ? 0 : (y >= height ? height - 1 : y);
+    if (y < from) {
+        return halo + (y - (from - bands->radius)) * width;
+    }
+    if (y >= to) {
+        return halo + (bands->radius + y - to) * width;
+    }
+    return bmp_row(bands->bmp, y);
+}
+
+/**
+ * @brief Build the weights of a convolution kernel along one axis, taps beyond the edges are
+ * folded onto the edge pixels.
+ *
+ * @param kernel the 2 * radius + 1 fixed-point taps, summing to 1 << BMP_WEIGHT_BITS.
+ * @param radius the radius of the kernel.
+ * @param size the size of the axis.
+ * @return the weights, release with bmp_weights_free.
+ */
+BmpWeights bmp_kernel_weights(int16_t const* kernel, int32_t radius, uint32_t size) {
+    int32_t    taps = 2 * radius + 1 < (int32_t)size ? 2 * radius + 1 : (int32_t)size;
+    BmpWeights weights = {taps, malloc(size * sizeof(int32_t)),
+                          calloc((uint64_t)size * taps, sizeof(int16_t))};
+    int32_t*   folded = malloc(taps * sizeof(int32_t));
+
+    for (int64_t i = 0; i < size; i++) {
+        int64_t low = i - radius < 0 ? 0 : i - radius;
+        memset(folded, 0, taps * sizeof(int32_t));
+        for (int64_t j = i - radius; j <= i + radius; j++) {
+            int64_t clamped = j < 0 ? 0 : (j >= size ? size - 1 : j);
+            folded[clamped - low] += kernel[j - (i - radius)];
+        }
+
+        int64_t start = low + taps > size ? size - taps : low;
+        for (int64_t k = 0; k < taps - (low - start); k++) {
+            weights.weights[i * taps + low - start + k] = (int16_t)folded[k];
+        }
+        weights.start[i] = start;
+    }
+
+    free(folded);
+    return weights;
+}
+
+typedef struct BmpSeparableJob {
+    BmpBands   bands;
+    BmpWeights horizontal;
+    BmpWeights vertical;
+} BmpSeparableJob;
+
+static void bmp_separable_bands(void* context, int64_t from, int64_t to) {
+    BmpSeparableJob const* job = (BmpSeparableJob*)context;
+    BMP*                   bmp = job->bands.bmp;
+    int64_t                width = bmp->header->info_header.width;
+    int64_t                height = bmp->header->info_header.height;
+    int32_t                taps = job->vertical.taps;
+
+    // the horizontally filtered rows of the vertical window live in a ring buffer
+    Pixel*        ring = malloc((uint64_t)taps * width * sizeof(Pixel));
+    Pixel const** rows = malloc(taps * sizeof(Pixel*));
+
+    for (int64_t band = from; band < to; band++) {
+        int64_t first = height * band / job->bands.count;
+        int64_t last = height * (band + 1) / job->bands.count;
+        int64_t next = first < last ? job->vertical.start[first] : 0;
+
+        for (int64_t y = first; y < last; y++) {
+            int64_t start = job->vertical.start[y];
+            next = next < start ? start : next;
+            for (; next < start + taps; next++) {
+                bmp_resample_row(bmp_band_row(&job->bands, band, next),
+                                 ring + (next % taps) * width, width, &job->horizontal);
+            }
+
+            for (int32_t k = 0; k < taps; k++) {
+                rows[k] = ring + ((start + k) % taps) * width;
+            }
+            bmp_resample_column(rows, job->vertical.weights + y * taps, taps, bmp_row(bmp, y),
+                                width);
+        }
+    }
+
+    free(ring), free(rows);
+}
+
+/**
+ * @brief Convolve the image in place with a separable kernel, applied along both axes.
+ *
+ * @param bmp the image to filter.
+ * @param kernel the 2 * radius + 1 fixed-point taps, summing to 1 << BMP_WEIGHT_BITS.
+ * @param radius the radius of the kernel.
+ * @return the count of pixels that were filtered.
+ */
+uint64_t bmp_convolve_separable(BMP* bmp, int16_t const* kernel, int32_t radius) {
+    int64_t width = bmp->header->info_header.width;
+    int64_t height = bmp->header->info_header.height;
+    if (width <= 0 || height <= 0) {
+        return 0;
+    }
+
+    BmpSeparableJob job = {bmp_bands(bmp, radius), bmp_kernel_weights(kernel, radius, width),
+                           bmp_kernel_weights(kernel, radius, height)};
+    bmp_parallel(job.bands.count, 1, bmp_separable_bands, &job);
+
+    bmp_bands_free(&job.bands);
+    bmp_weights_free(&job.horizontal), bmp_weights_free(&job.vertical);
+    return width * height;
+}
+
+/**
+ * @brief Blur the image in place with a Gaussian kernel.
+ *
+ * @param bmp the image to blur.
+ * @param sigma the standard deviation of the kernel, in pixels.
+ * @return the count of pixels that were blurred.
+ */
+uint64_t bmp_gaussian_blur(BMP* bmp, double sigma) {
+    if (sigma <= 0.0) {
+        return 0;
+    }
+
+    int32_t  radius = (int32_t)ceil(sigma * 3.0);
+    double*  values = malloc((2 * radius + 1) * sizeof(double));
+    int16_t* kernel = malloc((2 * radius + 1) * sizeof(int16_t));
+
+    double total = 0.0;
+    for (int32_t i = -radius; i <= radius; i++) {
+        values[i + radius] = exp(-(double)(i * i) / (2.0 * sigma * sigma));
+        total += values[i + radius];
+    }
+
+    int32_t sum = 0;
+    for (int32_t i = 0; i < 2 * radius + 1; i++) {
+        kernel[i] = (int16_t)lround(values[i] / total * (1 << BMP_WEIGHT_BITS));
+        sum += kernel[i];
+    }
+    kernel[radius] += (1 << BMP_WEIGHT_BITS) - sum;
+
+    uint64_t count = bmp_convolve_separable(bmp, kernel, radius);
+    free(values), free(kernel);
+    return count;
+}
+
+typedef struct BmpBoxJob {
+    BMP*    bmp;
+    int32_t radius;
+} BmpBoxJob;
+
+static inline Pixel bmp_box_average(int32_t const* sum, float inverse) {
+    return (Pixel){(uint8_t)lrintf(sum[0] * inverse), (uint8_t)lrintf(sum[1] * inverse),
+                   (uint8_t)lrintf(sum[2] * inverse), (uint8_t)lrintf(sum[3] * inverse)};
+}
+
+static void bmp_box_rows(void* context, int64_t from, int64_t to) {
+    BmpBoxJob const* job = (BmpBoxJob*)context;
+    int64_t          width = job->bmp->header->info_header.width;
+    int64_t          radius = job->radius;
+    float            inverse = 1.0f / (float)(2 * radius + 1);
+    Pixel*           source = malloc(width * sizeof(Pixel));
+
+    for (int64_t y = from; y < to; y++) {
+        Pixel* row = bmp_row(job->bmp, y);
+        memcpy(source, row, width * sizeof(Pixel));
+
+        int32_t sum[4] = {0, 0, 0, 0};
+        for (int64_t j = -radius; j <= radius; j++) {
+            Pixel pixel = source[j < 0 ? 0 : (j >= width ? width - 1 : j)];
+            sum[0] += pixel.red, sum[1] += pixel.green, sum[2] += pixel.blue;
+            sum[3] += pixel.alpha;
+        }
+
+        // slide the window: one add and one subtract per pixel regardless of the radius
+        for (int64_t x = 0; x < width; x++) {
+            row[x] = bmp_box_average(sum, inverse);
+            Pixel in = source[x + radius + 1 < width ? x + radius + 1 : width - 1];
+            Pixel out = source[x - radius > 0 ? x - radius : 0];
+            sum[0] += in.red - out.red, sum[1] += in.green - out.green;
+            sum[2] += in.blue - out.blue, sum[3] += in.alpha - out.alpha;
+        }
+    }
+
+    free(source);
+}
+
+static inline void bmp_box_accumulate(int32_t* sums, Pixel const* add, Pixel const* sub,
+                                      int64_t width) {
+    int64_t x = 0;
+#if defined(BMP_SSE2)
+    __m128i const zero = _mm_setzero_si128();
+    for (; x + 4 <= width; x += 4) {
+        __m128i in = _mm_loadu_si128((__m128i const*)(add + x));
+        __m128i out = _mm_loadu_si128((__m128i const*)(sub + x));
+        __m128i in_low = _mm_unpacklo_epi8(in, zero), in_high = _mm_unpackhi_epi8(in, zero);
+        __m128i out_low = _mm_unpacklo_epi8(out, zero), out_high = _mm_unpackhi_epi8(out, zero);
+        __m128i delta[4] = {_mm_sub_epi32(_mm_unpacklo_epi16(in_low, zero),
+                                          _mm_unpacklo_epi16(out_low, zero)),
+                            _mm_sub_epi32(_mm_unpackhi_epi16(in_low, zero),
+                                          _mm_unpackhi_epi16(out_low, zero)),
+                            _mm_sub_epi32(_mm_unpacklo_epi16(in_high, zero),
+                                          _mm_unpacklo_epi16(out_high, zero)),
+                            _mm_sub_epi32(_mm_unpackhi_epi16(in_high, zero),
+                                          _mm_unpackhi_epi16(out_high, zero))};
+        for (int i = 0; i < 4; i++) {
+            __m128i* sum = (__m128i*)(sums + (x + i) * 4);
+            _mm_storeu_si128(sum, _mm_add_epi32(_mm_loadu_si128(sum), delta[i]));
+        }
+    }
+#endif
+    for (; x < width; x++) {
+        sums[x * 4 + 0] += add[x].red - sub[x].red;
+        sums[x * 4 + 1] += add[x].green - sub[x].green;
+        sums[x * 4 + 2] += add[x].blue - sub[x].blue;
+        sums[x * 4 + 3] += add[x].alpha - sub[x].alpha;
+    }
+}
+
+static void bmp_box_columns(void* context, int64_t from, int64_t to) {
+    BmpBoxJob const* job = (BmpBoxJob*)context;
+    int64_t          width = job->bmp->header->info_header.width;
+    int64_t          height = job->bmp->header->info_header.height;
+    int64_t          radius = job->radius;
+    int64_t          slots = radius + 2;
+    float            inverse = 1.0f / (float)(2 * radius + 1);
+
+    int32_t* sums = malloc(BMP_TILE_SIZE * 4 * sizeof(int32_t));
+    Pixel*   ring = malloc(slots * BMP_TILE_SIZE * sizeof(Pixel));
+    Pixel*   zero = calloc(BMP_TILE_SIZE, sizeof(Pixel));
+
+    // every stripe of BMP_TILE_SIZE columns keeps its running sums and ring buffer in cache
+    for (int64_t stripe = from; stripe < to; stripe++) {
+        int64_t x0 = stripe * BMP_TILE_SIZE;
+        int64_t span = x0 + BMP_TILE_SIZE < width ? BMP_TILE_SIZE : width - x0;
+
+        memset(sums, 0, BMP_TILE_SIZE * 4 * sizeof(int32_t));
+        for (int64_t j = -radius; j <= radius; j++) {
+            int64_t clamped = j < 0 ? 0 : (j >= height ? height - 1 : j);
+            bmp_box_accumulate(sums, bmp_row(job->bmp, clamped) + x0, zero, span);
+        }
+
+        for (int64_t y = 0; y < height; y++) {
+            Pixel* row = bmp_row(job->bmp, y) + x0;
+            memcpy(ring + (y % slots) * BMP_TILE_SIZE, row, span * sizeof(Pixel));
+            for (int64_t x = 0; x < span; x++) {
+                row[x] = bmp_box_average(sums + x * 4, inverse);
+            }
+
+            int64_t in = y + radius + 1 < height ? y + radius + 1 : height - 1;
+            int64_t out = y - radius > 0 ? y - radius : 0;
+            // the last row is added again past the bottom, its original is in the ring
+            Pixel const* add =
+                in > y ? bmp_row(job->bmp, in) + x0 : ring + (y % slots) * BMP_TILE_SIZE;
+            Pixel const* sub = ring + (out % slots) * BMP_TILE_SIZE;
+            bmp_box_accumulate(sums, add, sub, span);
+        }
+    }
+
+    free(sums), free(ring), free(zero);
+}
+
+/**
+ * @brief Blur the image in place with a box filter, the cost per pixel does not depend on the
+ * radius.
+ *
+ * @param bmp the image to blur.
+ * @param radius the radius of the box.
+ * @return the count of pixels that were blurred.
+ */
+uint64_t bmp_box_blur(BMP* bmp, uint32_t radius) {
+    int64_t width = bmp->header->info_header.width;
+    int64_t height = bmp->header->info_header.height;
+    if (radius == 0 || width <= 0 || height <= 0) {
+        return 0;
+    }
+
+    BmpBoxJob job = {bmp, (int32_t)radius};
+    bmp_parallel(height, 64, bmp_box_rows, &job);
+    bmp_parallel((width + BMP_TILE_SIZE - 1) / BMP_TILE_SIZE, 1, bmp_box_columns, &job);
+    return width * height;
+}
+
+typedef struct BmpConvolveJob {
+    BmpBands bands;
+    int16_t  kernel[15 * 15];
+    int32_t  size;
+    float    inverse;
+} BmpConvolveJob;
+
+static void bmp_convolve_bands(void* context, int64_t from, int64_t to) {
+    BmpConvolveJob const* job = (BmpConvolveJob*)context;
+    BMP*                  bmp = job->bands.bmp;
+    int64_t               width = bmp->header->info_header.width;
+    int64_t               height = bmp->header->info_header.height;
+    int32_t               size = job->size, radius = size / 2;
+    int64_t               padded = width + 2 * radius + 1;
+
+    // source rows padded by replicated edge pixels, so the inner loop never clamps
+    Pixel* ring = calloc(size * padded, sizeof(Pixel));
+
+    for (int64_t band = from; band < to; band++) {
+        int64_t first = height * band / job->bands.count;
+        int64_t last = height * (band + 1) / job->bands.count;
+
+        for (int64_t y = first - radius; y < last + radius; y++) {
+            Pixel const* source = bmp_band_row(&job->bands, band, y);
+            Pixel*       slot = ring + ((y + size) % size) * padded;
+            for (int32_t i = 0; i < radius; i++) {
+                slot[i] = source[0], slot[radius + width + i] = source[width - 1];
+            }
+            memcpy(slot + radius, source, width * sizeof(Pixel));
+
+            int64_t out = y - radius;
+            if (out < first) {
+                continue;
+            }
+
+            Pixel* row = bmp_row(bmp, out);
+            for (int64_t x = 0; x < width; x++) {
+                Pixel const* center = ring + ((out + size) % size) * padded + radius + x;
+#if defined(BMP_SSE2)
+                __m128i const zero = _mm_setzero_si128();
+                __m128i       acc = zero;
+                for (int32_t ky = 0; ky < size; ky++) {
+                    Pixel const*   line = ring + ((out - radius + ky + size) % size) * padded + x;
+                    int16_t const* weight = job->kernel + ky * size;
+                    // kernels have odd sizes, the last pair multiplies a zero weight
+                    for (int32_t kx = 0; kx < size; kx += 2) {
+                        int32_t a, b;
+                        memcpy(&a, line + kx, sizeof(int32_t));
+                        memcpy(&b, line + kx + 1, sizeof(int32_t));
+                        __m128i pair =
+                            _mm_unpacklo_epi8(_mm_cvtsi32_si128(a), _mm_cvtsi32_si128(b));
+                        int16_t next = kx + 1 < size ? weight[kx + 1] : 0;
+                        __m128i w = _mm_set1_epi32(bmp_weight_pair(weight[kx], next));
+                        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi8(pair, zero), w));
+                    }
+                }
+                acc = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(acc), _mm_set1_ps(job->inverse)));
+                acc = _mm_packs_epi32(acc, acc);
+                int32_t result = _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+                memcpy(row + x, &result, sizeof(int32_t));
+#else
+                int32_t red = 0, green = 0, blue = 0;
+                for (int32_t ky = 0; ky < size; ky++) {
+                    Pixel const*   line = ring + ((out - radius + ky + size) % size) * padded + x;
+                    int16_t const* weight = job->kernel + ky * size;
+                    for (int32_t kx = 0; kx < size; kx++) {
+                        red += weight[kx] * line[kx].red;
+                        green += weight[kx] * line[kx].green;
+                        blue += weight[kx] * line[kx].blue;
+                    }
+                }
+                row[x].red = bmp_clamp_u8((int32_t)lrintf(red * job->inverse));
+                row[x].green = bmp_clamp_u8((int32_t)lrintf(green * job->inverse));
+                row[x].blue = bmp_clamp_u8((int32_t)lrintf(blue * job->inverse));
+#endif
+                row[x].alpha = center->alpha;
+            }
+        }
+    }
+
+    free(ring);
+}
+
+/**
+ * @brief Convolve the color channels of the image in place with a square kernel, such as 3x3 or
+ * 5x5 sharpen, emboss or edge detection kernels. The alpha channel is kept.
+ *
+ * @param bmp the image to filter.
+ * @param kernel the size * size weights, row by row.
+ * @param size the odd size of the kernel, up to 15.
+ * @param divisor the sum of the weighted pixels is divided by it, 0 to use the sum of the kernel.
+ * @return the count of pixels that were filtered.
+ */
+uint64_t bmp_convolve(BMP* bmp, int32_t const* kernel, uint8_t size, int32_t divisor) {
+    int64_t width = bmp->header->info_header.width;
+    int64_t height = bmp->header->info_header.height;
+    if (size % 2 == 0 || size > 15 || width <= 0 || height <= 0) {
+        return 0;
+    }
+
+    BmpConvolveJob* job = calloc(1, sizeof(BmpConvolveJob));
+    int32_t         sum = 0;
+    for (int32_t i = 0; i < size * size; i++) {
+        job->kernel[i] = (int16_t)kernel[i];
+        sum += kernel[i];
+    }
+    divisor = divisor != 0 ? divisor : (sum != 0 ? sum : 1);
+
+    job->bands = bmp_bands(bmp, size / 2);
+    job->size = size;
+    job->inverse = 1.0f / (float)divisor;
+    bmp_parallel(job->bands.count, 1, bmp_convolve_bands, job);
+
+    bmp_bands_free(&job->bands);
+    free(job);
+    return width * height;
+}
+
+typedef struct BmpSharpenJob {
+    BMP*    bmp;
+    BMP*    blurred;
+    int32_t amount;
+} BmpSharpenJob;
+
+static void bmp_sharpen_rows(void* context, int64_t from, int64_t to) {
+    BmpSharpenJob const* job = (BmpSharpenJob*)context;
+    int64_t              width = job->bmp->header->info_header.width;
+    for (int64_t y = from; y < to; y++) {
+        Pixel*       row = bmp_row(job->bmp, y);
+        Pixel const* blurred = bmp_row(job->blurred, y);
+        for (int64_t x = 0; x < width; x++) {
+            row[x].red =
+                bmp_clamp_u8(row[x].red + (((row[x].red - blurred[x].red) * job->amount) >> 8));
+            row[x].green = bmp_clamp_u8(row[x].green +
+                                        (((row[x].green - blurred[x].green) * job->amount) >> 8));
+            row[x].blue = bmp_clamp_u8(row[x].blue +
+                                       (((row[x].blue - blurred[x].blue) * job->amount) >> 8));
+        }
+    }
+}
+
+/**
+ * @brief Sharpen the color channels of the image in place with an unsharp mask.
+ *
+ * @param bmp the image to sharpen.
+ * @param sigma the standard deviation of the Gaussian blur used as the mask.
+ * @param amount how much of the detail is added back, 1.0 doubles the detail.
+ * @return the count of pixels that were sharpened.
+ */
+uint64_t bmp_sharpen(BMP* bmp, double sigma, double amount) {
+    int64_t width = bmp->header->info_header.width;
+    int64_t height = bmp->header->info_header.height;
+    if (sigma <= 0.0 || width <= 0 || height <= 0) {
+        return 0;
+    }
+
+    BmpSharpenJob job = {bmp, bmp_alloc(width, height), (int32_t)lround(amount * 256.0)};
+    for (int64_t y = 0; y < height; y++) {
+        memcpy(bmp_row(job.blurred, y), bmp_row(bmp, y), width * sizeof(Pixel));
+    }
+
+    bmp_gaussian_blur(job.blurred, sigma);
+    bmp_parallel(height, 64, bmp_sharpen_rows, &job);
+
+    bmp_free(job.blurred);
+    return width * height;
+}
+// #endregion
+
+// #region Morphology.
+/** The structuring element of the mask morphology operations. */
+enum BMP_ELEMENT {
+    /** A rectangle of (2 * radius_x + 1) x (2 * radius_y + 1) pixels. */
+    BMP_ELEMENT_RECT = 0,
+    /** The pixels within a euclidean distance of radius from the center. */
+    BMP_ELEMENT_DISK,
+};
+
+/** Number of 64-bit words per stripe of the vertical pass, one cache line. */
+#define BMP_MORPHOLOGY_SPAN 8
+
+typedef struct BmpMorphologyJob {
+    BMP*           bmp;
+    BmpMask const* source;
+    BmpMask*       result;
+    float*         distances;
+    int64_t        radius_x;
+    int64_t        radius_y;
+    /** The squared radius of a disk, or a negative value to keep the distances. */
+    double         limit;
+    uint8_t        threshold;
+    Pixel          pixel;
+} BmpMorphologyJob;
+
+/**
+ * @brief Flip every bit of the mask in place, the bits past the width stay clear.
+ */
+static void bmp_mask_invert(BmpMask* mask) {
+    if (mask->stride == 0) {
+        return;
+    }
+
+    uint64_t const last = mask->width & 63 ? (1ULL << (mask->width & 63)) - 1 : ~0ULL;
+    for (int64_t y = 0; y < mask->height; y++) {
+        uint64_t* row = bmp_mask_row(mask, y);
+        for (uint64_t i = 0; i < mask->stride; i++) {
+            row[i] = ~row[i];
+        }
+        row[mask->stride - 1] &= last;
+    }
+}
+
+static BmpMask* bmp_mask_copy(BmpMask const* mask) {
+    BmpMask* copy = bmp_mask_create(mask->width, mask->height);
+    memcpy(copy->bits, mask->bits, mask->stride * mask->height * sizeof(uint64_t));
+    return copy;
+}
+
+static void bmp_mask_alpha_rows(void* context, int64_t from, int64_t to) {
+    BmpMorphologyJob* job = (BmpMorphologyJob*)context;
+    int64_t           width = job->result->width;
+
+    for (int64_t y = from; y < to; y++) {
+        Pixel const* pixels = bmp_row(job->bmp, y);
+        uint64_t*    row = bmp_mask_row(job->result, y);
+        for (int64_t x = 0; x < width; x++) {
+            row[x >> 6] |= (uint64_t)(pixels[x].alpha >= job->threshold) << (x & 63);
+        }
+    }
+}
+
+/**
+ * @brief Create a mask of the pixels that are at least as opaque as a threshold.
+ *
+ * @param bmp the image.
+ * @param threshold the smallest alpha of a pixel in the mask.
+ * @return the mask, release with bmp_mask_free.
+ */
+BmpMask* bmp_mask_alpha(BMP* bmp, uint8_t threshold) {
+    int64_t          width = bmp->header->info_header.width;
+    int64_t          height = bmp->header->info_header.height;
+    BmpMorphologyJob job = {.bmp = bmp, .threshold = threshold};
+
+    job.result = bmp_mask_create(width, height);
+    bmp_parallel(height, 64, bmp_mask_alpha_rows, &job);
+    return job.result;
+}
+
+static void bmp_mask_draw_rows(void* context, int64_t from, int64_t to) {
+    BmpMorphologyJob* job = (BmpMorphologyJob*)context;
+    int64_t           width = job->source->width;
+
+    // every run of set bits is one span, composited like the other shapes
+    for (int64_t y = from; y < to; y++) {
+        uint64_t const* row = bmp_mask_row(job->source, y);
+        for (int64_t x = bmp_mask_next(row, 0, width, true); x < width;) {
+            int64_t end = bmp_mask_next(row, x, width, false);
+            bmp_span(job->bmp, x, y, end - x, job->pixel, NULL);
+            x = bmp_mask_next(row, end, width, true);
+        }
+    }
+}
+
+/**
+ * @brief Draw a pixel over every pixel of the image that is set in a mask of the same size.
+ *
+ * @param bmp the image to draw on.
+ * @param mask the mask.
+ * @param pixel the pixel to draw.
+ * @return the count of pixels that were drawn.
+ */
+uint64_t bmp_mask_draw(BMP* bmp, BmpMask const* mask, Pixel pixel) {
+    int64_t width = bmp->header->info_header.width;
+    int64_t height = bmp->header->info_header.height;
+    if (mask->width != width || mask->height != height) {
+        return 0;
+    }
+
+    BmpMorphologyJob job = {.bmp = bmp, .source = mask, .pixel = pixel};
+    bmp_parallel(height, 64, bmp_mask_draw_rows, &job);
+
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < mask->stride * height; i++) {
+        count += __builtin_popcountll(mask->bits[i]);
+    }
+    return count;
+}
+
+/**
+ * @brief The first pass of the distance transform, the distance to the closest set pixel of the
+ * same column, for the columns of the words [from, to).
+ */
+static void bmp_mask_distance_columns(void* context, int64_t from, int64_t to) {
+    BmpMorphologyJob* job = (BmpMorphologyJob*)context;
+    int64_t           width = job->source->width;
+    int64_t           height = job->source->height;
+    int64_t           x0 = from * 64, x1 = to * 64 < width ? to * 64 : width;
+
+    for (int64_t y = 0; y < height; y++) {
+        uint64_t const* row = bmp_mask_row(job->source, y);
+        float*          distances = job->distances + y * width;
+        for (int64_t x = x0; x < x1; x++) {
+            bool set = (row[x >> 6] >> (x & 63)) & 1;
+            distances[x] = set ? 0.0f : (y > 0 ? distances[x - width] + 1.0f : INFINITY);
+        }
+    }
+
+    for (int64_t y = height - 2; y >= 0; y--) {
+        float* distances = job->distances + y * width;
+        for (int64_t x = x0; x < x1; x++) {
+            float below = distances[x + width] + 1.0f;
+            distances[x] = below < distances[x] ? below : distances[x];
+        }
+    }
+}
+
+/**
+ * @brief The second pass of the distance transform, the lower envelope of the parabolas of the
+ * column distances along every row (Felzenszwalb and Huttenlocher).
+ */
+static void bmp_mask_distance_rows(void* context, int64_t from, int64_t to) {
+    BmpMorphologyJob* job = (BmpMorphologyJob*)context;
+    int64_t           width = job->source->width;
+    double*           heights = malloc(width * sizeof(double));
+    int64_t*          sites = malloc(width * sizeof(int64_t));
+    double*           starts = malloc(width * sizeof(double));
+
+    for (int64_t y = from; y < to; y++) {
+        float*  distances = job->distances + y * width;
+        int64_t count = 0;
+        for (int64_t q = 0; q < width; q++) {
+            if (!isfinite(distances[q])) {
+                continue;
+            }
+
+            // drop the parabolas that the new one hides, columns without a set pixel add none
+            heights[q] = (double)distances[q] * distances[q];
+            double start = -INFINITY;
+            while (count > 0) {
+                int64_t p = sites[count - 1];
+                start = (heights[q] + q * q - heights[p] - p * p) / (2.0 * (q - p));
+                if (start > starts[count - 1]) {
+                    break;
+                }
+                start = -INFINITY;
+                count--;
+            }
+            sites[count] = q, starts[count] = start;
+            count++;
+        }
+
+        for (int64_t q = 0, k = 0; q < width; q++) {
+            while (k + 1 < count && starts[k + 1] < q) {
+                k++;
+            }
+
+            double square = count > 0 ? (double)(q - sites[k]) * (q - sites[k]) + heights[sites[k]]
+                                      : INFINITY;
+            if (job->limit < 0.0) {
+                distances[q] = (float)sqrt(square);
+            } else if (square <= job->limit) {
+                bmp_mask_set(job->result, q, y);
+            }
+        }
+    }
+
+    free(heights), free(sites), free(starts);
+}
+
+static void bmp_mask_distance_run(BmpMorphologyJob* job) {
+    bmp_parallel(job->source->stride, 1, bmp_mask_distance_columns, job);
+    bmp_parallel(job->source->height, 16, bmp_mask_distance_rows, job);
+}
+
+/**
+ * @brief The exact euclidean distance from every pixel to the closest set pixel of a mask, in
+ * two linear passes.
+ *
+ * @param mask the mask.
+ * @return the distances, row by row from the top, 0 on the set pixels and INFINITY when no pixel
+ * is set. Release with free, NULL for an empty mask.
+ */
+float* bmp_mask_distance(BmpMask const* mask) {
+    if (mask->width == 0 || mask->height == 0) {
+        return NULL;
+    }
+
+    BmpMorphologyJob job = {.source = mask, .limit = -1.0};
+    job.distances = malloc((uint64_t)mask->width * mask->height * sizeof(float));
+    bmp_mask_distance_run(&job);
+    return job.distances;
+}
+
+/**
+ * @brief Dilate the rows of the source into the result, every run of set bits grows by radius_x
+ * on both sides and the overlapping runs are merged, so every word is written once.
+ */
+static void bmp_mask_dilate_rows(void* context, int64_t from, int64_t to) {
+    BmpMorphologyJob* job = (BmpMorphologyJob*)context;
+    int64_t           width = job->source->width;
+    int64_t           radius = job->radius_x;
+
+    for (int64_t y = from; y < to; y++) {
+        uint64_t const* row = bmp_mask_row(job->source, y);
+        int64_t         start = 0, end = 0;
+        for (int64_t x = bmp_mask_next(row, 0, width, true); x < width;) {
+            int64_t stop = bmp_mask_next(row, x, width, false);
+            int64_t low = x - radius > 0 ? x - radius : 0;
+            int64_t high = stop + radius < width ? stop + radius : width;
+            if (low > end) {
+                bmp_mask_set_run(job->result, y, start, end);
+                start = low;
+            }
+            end = high;
+            x = bmp_mask_next(row, stop, width, true);
+        }
+        bmp_mask_set_run(job->result, y, start, end);
+    }
+}
+
+/**
+ * @brief Dilate the columns of the result in place by radius_y, for the stripes of words
+ * [from, to). The OR over a window of 2 * radius_y + 1 rows is one suffix and one prefix of the
+ * blocks of that many rows (van Herk and Gil-Werman), whatever the radius.
+ */
+static void bmp_mask_dilate_columns(void* context, int64_t from, int64_t to) {
+    BmpMorphologyJob* job = (BmpMorphologyJob*)context;
+    int64_t           height = job->result->height;
+    int64_t           stride = job->result->stride;
+    int64_t           radius = job->radius_y, block = 2 * radius + 1;
+    uint64_t*         prefix = malloc(height * BMP_MORPHOLOGY_SPAN * sizeof(uint64_t));
+    uint64_t*         suffix = malloc(height * BMP_MORPHOLOGY_SPAN * sizeof(uint64_t));
+
+    for (int64_t stripe = from; stripe < to; stripe++) {
+        int64_t w0 = stripe * BMP_MORPHOLOGY_SPAN;
+        int64_t span = w0 + BMP_MORPHOLOGY_SPAN < stride ? BMP_MORPHOLOGY_SPAN : stride - w0;
+
+        for (int64_t y = 0; y < height; y++) {
+            uint64_t const* row = bmp_mask_row(job->result, y) + w0;
+            uint64_t*       words = prefix + y * BMP_MORPHOLOGY_SPAN;
+            for (int64_t i = 0; i < span; i++) {
+                words[i] = (y % block ? words[i - BMP_MORPHOLOGY_SPAN] : 0) | row[i];
+            }
+        }
+        for (int64_t y = height - 1; y >= 0; y--) {
+            uint64_t const* row = bmp_mask_row(job->result, y) + w0;
+            uint64_t*       words = suffix + y * BMP_MORPHOLOGY_SPAN;
+            bool            last = y == height - 1 || (y + 1) % block == 0;
+            for (int64_t i = 0; i < span; i++) {
+                words[i] = (last ? 0 : words[i + BMP_MORPHOLOGY_SPAN]) | row[i];
+            }
+        }
+
+        for (int64_t y = 0; y < height; y++) {
+            int64_t         top = y - radius > 0 ? y - radius : 0;
+            int64_t         bottom = y + radius < height ? y + radius : height - 1;
+            uint64_t const* head = suffix + top * BMP_MORPHOLOGY_SPAN;
+            uint64_t const* tail = prefix + bottom * BMP_MORPHOLOGY_SPAN;
+            uint64_t*       row = bmp_mask_row(job->result, y) + w0;
+            // a window that starts a block is a prefix, one clipped by the bottom is a suffix
+            for (int64_t i = 0; i < span; i++) {
+                row[i] = top % block == 0            ? tail[i]
+                         : top / block == bottom / block ? head[i]
+                                                         : head[i] | tail[i];
+            }
+        }
+    }
+
+    free(prefix), free(suffix);
+}
+
+/**
+ * @brief Dilate a mask, a pixel is set when the structuring element around it covers a set pixel.
+ *
+ * @param mask the mask.
+ * @param element the structuring element, see enum BMP_ELEMENT.
+ * @param radius_x the horizontal radius of the element.
+ * @param radius_y the vertical radius of the element, the same as radius_x for a disk.
+ * @return the dilated mask, release with bmp_mask_free. NULL for an unknown element or a disk
+ * with different radii.
+ */
+BmpMask* bmp_mask_dilate(BmpMask const* mask, uint8_t element, uint32_t radius_x,
+                         uint32_t radius_y) {
+    if (element > BMP_ELEMENT_DISK || (element == BMP_ELEMENT_DISK && radius_x != radius_y)) {
+        return NULL;
+    }
+
+    BmpMorphologyJob job = {.source = mask, .radius_x = radius_x, .radius_y = radius_y};
+    if (mask->width == 0 || mask->height == 0 || (radius_x == 0 && radius_y == 0)) {
+        return bmp_mask_copy(mask);
+    }
+
+    job.result = bmp_mask_create(mask->width, mask->height);
+    if (element == BMP_ELEMENT_DISK) {
+        // a disk is a threshold of the distance transform, also linear in the pixels
+        job.limit = (double)radius_x * radius_x;
+        job.distances = malloc((uint64_t)mask->width * mask->height * sizeof(float));
+        bmp_mask_distance_run(&job);
+        free(job.distances);
+        return job.result;
+    }
+
+    bmp_parallel(mask->height, 64, bmp_mask_dilate_rows, &job);
+    if (radius_y > 0) {
+        int64_t stripes = (mask->stride + BMP_MORPHOLOGY_SPAN - 1) / BMP_MORPHOLOGY_SPAN;
+        bmp_parallel(stripes, 1, bmp_mask_dilate_columns, &job);
+    }
+    return job.result;
+}
+
+/**
+ * @brief Erode a mask, a pixel stays set when the structuring element around it only covers set
+ * pixels. The pixels outside of the mask count as set, so the edges of the mask do not erode.
+ *
+ * @param mask the mask.
+ * @param element the structuring element, see enum BMP_ELEMENT.
+ * @param radius_x the horizontal radius of the element.
+ * @param radius_y the vertical radius of the element, the same as radius_x for a disk.
+ * @return the eroded mask, release with bmp_mask_free. NULL for an unknown element or a disk
+ * with different radii.
+ */
+BmpMask* bmp_mask_erode(BmpMask const* mask, uint8_t element, uint32_t radius_x,
+                        uint32_t radius_y) {
+    BmpMask* inverse = bmp_mask_copy(mask);
+    bmp_mask_invert(inverse);
+
+    BmpMask* result = bmp_mask_dilate(inverse, element, radius_x, radius_y);
+    if (result != NULL) {
+        bmp_mask_invert(result);
+    }
+
+    bmp_mask_free(inverse);
+    return result;
+}
+
+/**
+ * @brief Open a mask, an erosion then a dilation, it removes the parts that are smaller than the
+ * structuring element.
+ *
+ * @return the opened mask, release with bmp_mask_free. NULL like bmp_mask_dilate.
+ */
+BmpMask* bmp_mask_open(BmpMask const* mask, uint8_t element, uint32_t radius_x,
+                       uint32_t radius_y) {
+    BmpMask* eroded = bmp_mask_erode(mask, element, radius_x, radius_y);
+    if (eroded == NULL) {
+        return NULL;
+    }
+
+    BmpMask* result = bmp_mask_dilate(eroded, element, radius_x, radius_y);
+    bmp_mask_free(eroded);
+    return result;
+}
+
+/**
+ * @brief Close a mask, a dilation then an erosion, it fills the gaps that are smaller than the
+ * structuring element.
+ *
+ * @return the closed mask, release with bmp_mask_free. NULL like bmp_mask_dilate.
+ */
+BmpMask* bmp_mask_close(BmpMask const* mask, uint8_t element, uint32_t radius_x,
+                        uint32_t radius_y) {
+    BmpMask* dilated = bmp_mask_dilate(mask, element, radius_x, radius_y);
+    if (dilated == NULL) {
+        return NULL;
+    }
+
+    BmpMask* result = bmp_mask_erode(dilated, element, radius_x, radius_y);
+    bmp_mask_free(dilated);
+    return result;
+}
+// #endregion
+
+// #region Layers.
+enum BMP_BLEND {
+    BMP_BLEND_NORMAL = 0,
+    BMP_BLEND_MULTIPLY,
+    BMP_BLEND_SCREEN,
+    BMP_BLEND_ADD,
+};
+
+typedef struct BmpLayer {
+    /** The pixels of the layer, transparent when the layer is added. */
+    BMP*    bmp;
+    /** The opacity of the whole layer, multiplied with the alpha of every pixel. */
+    uint8_t opacity;
+    uint8_t mode;
+    bool    visible;
+} BmpLayer;
+
+typedef struct BmpLayers {
+    uint32_t  width;
+    uint32_t  height;
+    uint32_t  count;
+    uint32_t  capacity;
+    /** From the bottom to the top. */
+    BmpLayer* layers;
+} BmpLayers;
+
+/**
+ * @brief Create an empty layer stack.
+ *
+ * @param width the width of every layer
+ * @param height the height of every layer
+ * @return the layer stack
+ */
+BmpLayers* bmp_layers_create(uint32_t width, uint32_t height) {
+    BmpLayers* stack = calloc(1, sizeof(BmpLayers));
+    stack->width = width, stack->height = height;
+    return stack;
+}
+
+/**
+ * @brief Add a transparent layer on top of the stack, the layer is owned by the stack.
+ *
+ * @param stack the layer stack
+ * @param opacity the opacity of the layer
+ * @param mode the blend mode of the layer, one of BMP_BLEND
+ * @return the image of the layer to draw on
+ */
+BMP* bmp_layers_add(BmpLayers* stack, uint8_t opacity, uint8_t mode) {
+    if (stack->count == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 4;
+        stack->layers = realloc(stack->layers, stack->capacity * sizeof(BmpLayer));
+    }
+
+    BMP* bmp = create_bmp(stack->width, stack->height, PIXEL_TRANSPARENT);
+    stack->layers[stack->count++] = (BmpLayer){bmp, opacity, mode, true};
+    return bmp;
+}
+
+/**
+ * @brief Free a layer stack and all of its layers.
+ *
+ * @param stack the layer stack
+ * @return true if the stack was freed
+ */
+bool bmp_layers_free(BmpLayers* stack) {
+    if (stack == NULL) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < stack->count; i++) {
+        bmp_free(stack->layers[i].bmp);
+    }
+    free(stack->layers);
+    free(stack);
+    return true;
+}
+
+static inline uint32_t bmp_blend_channel(uint8_t mode, uint32_t back, uint32_t front) {
+    switch (mode) {
+        case BMP_BLEND_MULTIPLY:
+            return bmp_div255(back * front);
+        case BMP_BLEND_SCREEN:
+            return back + front - bmp_div255(back * front);
+        case BMP_BLEND_ADD:
+            return back + front > 0xFF ? 0xFF : back + front;
+        default:
+            return front;
+    }
+}
+
+/**
+ * @brief Composite a pixel over another one with a blend mode, the blended color is used where
+ * the back is opaque and the front color where it is transparent.
+ *
+ * @param front the front pixel
+ * @param back the back pixel
+ * @param mode the blend mode, one of BMP_BLEND
+ * @return the composited pixel
+ */
+static inline Pixel bmp_blend(Pixel front, Pixel back, uint8_t mode) {
+    if (mode != BMP_BLEND_NORMAL && back.alpha != 0) {
+        uint32_t keep = 0xFF - back.alpha;
+        front.red = bmp_div255(front.red * keep +
+                               bmp_blend_channel(mode, back.red, front.red) * back.alpha);
+        front.green = bmp_div255(front.green * keep +
+                                 bmp_blend_channel(mode, back.green, front.green) * back.alpha);
+        front.blue = bmp_div255(front.blue * keep +
+                                bmp_blend_channel(mode, back.blue, front.blue) * back.alpha);
+    }
+
+    return bmp_over(front, back);
+}
+
+enum BMP_TILE_STATE {
+    BMP_TILE_EMPTY = 0,
+    BMP_TILE_PARTIAL,
+    BMP_TILE_OPAQUE,
+};
+
+/** Classify a tile of a layer by the alpha of its pixels. */
+static inline uint8_t bmp_tile_state(BMP* bmp, int64_t x, int64_t y, int64_t width,
+                                     int64_t height) {
+    uint32_t any = 0, all = 0xFF;
+    for (int64_t row = y; row < y + height; row++) {
+        Pixel const* pixels = bmp_row(bmp, row) + x;
+        int64_t      i = 0;
+#if defined(BMP_SSE2)
+        __m128i ors = _mm_setzero_si128(), ands = _mm_set1_epi32(-1);
+        for (; i + 4 <= width; i += 4) {
+            __m128i value = _mm_loadu_si128((__m128i const*)(pixels + i));
+            ors = _mm_or_si128(ors, value), ands = _mm_and_si128(ands, value);
+        }
+        uint32_t or_lanes[4], and_lanes[4];
+        _mm_storeu_si128((__m128i*)or_lanes, ors), _mm_storeu_si128((__m128i*)and_lanes, ands);
+        any |= (or_lanes[0] | or_lanes[1] | or_lanes[2] | or_lanes[3]) >> 24;
+        all &= (and_lanes[0] & and_lanes[1] & and_lanes[2] & and_lanes[3]) >> 24;
+#endif
+        for (; i < width; i++) {
+            any |= pixels[i].alpha, all &= pixels[i].alpha;
+        }
+    }
+
+    return any == 0 ? BMP_TILE_EMPTY : all == 0xFF ? BMP_TILE_OPAQUE : BMP_TILE_PARTIAL;
+}
+
+typedef struct BmpFlattenJob {
+    BmpLayers const* stack;
+    BMP*             result;
+    int64_t          columns;
+} BmpFlattenJob;
+
+static void bmp_flatten_tiles(void* context, int64_t from, int64_t to) {
+    BmpFlattenJob const* job = (BmpFlattenJob*)context;
+    BmpLayers const*     stack = job->stack;
+    uint8_t*             states = malloc(stack->count ? stack->count : 1);
+
+    for (int64_t tile = from; tile < to; tile++) {
+        int64_t x = tile % job->columns * BMP_TILE_SIZE, y = tile / job->columns * BMP_TILE_SIZE;
+        int64_t width = stack->width - x < BMP_TILE_SIZE ? stack->width - x : BMP_TILE_SIZE;
+        int64_t height = stack->height - y < BMP_TILE_SIZE ? stack->height - y : BMP_TILE_SIZE;
+
+        // walk down until a layer hides everything below it in this tile
+        int64_t bottom = 0;
+        for (int64_t i = (int64_t)stack->count - 1; i >= 0; i--) {
+            BmpLayer const* layer = &stack->layers[i];
+            states[i] = layer->visible && layer->opacity > 0
+                            ? bmp_tile_state(layer->bmp, x, y, width, height)
+                            : BMP_TILE_EMPTY;
+            if (states[i] == BMP_TILE_OPAQUE && layer->opacity == 0xFF &&
+                layer->mode == BMP_BLEND_NORMAL) {
+                bottom = i;
+                break;
+            }
+        }
+
+        for (int64_t row = y; row < y + height; row++) {
+            memset(bmp_row(job->result, row) + x, 0, width * sizeof(Pixel));
+        }
+
+        for (int64_t i = bottom; i < stack->count; i++) {
+            BmpLayer const* layer = &stack->layers[i];
+            if (states[i] == BMP_TILE_EMPTY) {
+                continue;
+            }
+
+            for (int64_t row = y; row < y + height; row++) {
+                Pixel const* src = bmp_row(layer->bmp, row) + x;
+                Pixel*       dst = bmp_row(job->result, row) + x;
+                if (layer->mode == BMP_BLEND_NORMAL && layer->opacity == 0xFF &&
+                    states[i] == BMP_TILE_OPAQUE) {
+                    memcpy(dst, src, width * sizeof(Pixel));
+                    continue;
+                }
+                for (int64_t column = 0; column < width; column++) {
+                    Pixel front = src[column];
+                    if (front.alpha == 0) {
+                        continue;
+                    }
+                    if (layer->bmp->premultiplied) {
+                        front = bmp_unpremultiply_pixel(front);
+                    }
+                    if (layer->opacity != 0xFF) {
+                        front.alpha = bmp_div255(front.alpha * layer->opacity);
+                    }
+                    dst[column] = bmp_blend(front, dst[column], layer->mode);
+                }
+            }
+        }
+    }
+
+    free(states);
+}
+
+/**
+ * @brief Flatten a layer stack into a new image in one pass over 64x64 tiles. Every tile reads
+ * each layer once, skipping layers that are transparent in the tile and layers hidden below an
+ * opaque normal layer.
+ *
+ * @param stack the layer stack
+ * @return the flattened straight alpha image, transparent where no layer is drawn
+ */
+BMP* bmp_layers_flatten(BmpLayers const* stack) {
+    BMP*          result = bmp_alloc(stack->width, stack->height);
+    BmpFlattenJob job = {stack, result, (stack->width + BMP_TILE_SIZE - 1) / BMP_TILE_SIZE};
+    int64_t       rows = (stack->height + BMP_TILE_SIZE - 1) / BMP_TILE_SIZE;
+    bmp_parallel(job.columns * rows, 4, bmp_flatten_tiles, &job);
+    return result;
+}
+// #endregion
+
+// #region Analysis.
+typedef struct BmpHistogram {
+    uint64_t red[256];
+    uint64_t green[256];
+    uint64_t blue[256];
+    uint64_t alpha[256];
+} BmpHistogram;
+
+typedef struct BmpStats {
+    Pixel    min;
+    Pixel    max;
+    /** Mean and standard deviation of the red, green, blue and alpha channels. */
+    double   mean[4];
+    double   deviation[4];
+    uint64_t count;
+} BmpStats;
+
+typedef struct BmpDiff {
+    /** Sum of absolute differences over the color channels. */
+    uint64_t sad;
+    /** Mean squared error per color channel, and the peak signal-to-noise ratio in dB. */
+    double   mse;
+    double   psnr;
+    /** The largest difference of a color channel, and the number of pixels that differ. */
+    uint8_t  max;
+    uint64_t different;
+} BmpDiff;
+
+typedef struct BmpHistogramJob {
+    BMP*            bmp;
+    BmpHistogram*   histogram;
+    pthread_mutex_t lock;
+} BmpHistogramJob;
+
+static void bmp_histogram_rows(void* context, int64_t from, int64_t to) {
+    BmpHistogramJob* job = (BmpHistogramJob*)context;
+    int64_t          width = job->bmp->header->info_header.width;
+
+    // 4 interleaved sub-histograms per channel, so that runs of equal pixels do not serialize
+    // on the same counter, flushed into 64-bit totals before the 32-bit counters can overflow
+    uint32_t (*counts)[4][256] = calloc(4, sizeof(*counts));
+    uint64_t(*totals)[256] = calloc(4, sizeof(*totals));
+    int64_t chunk = width > 0 ? ((int64_t)1 << 30) / width : 1;
+    chunk = chunk > 0 ? chunk : 1;
+
+    for (int64_t start = from; start < to; start += chunk) {
+        int64_t end = start + chunk < to ? start + chunk : to;
+        for (int64_t y = start; y < end; y++) {
+            Pixel const* row = bmp_row(job->bmp, y);
+            int64_t      x = 0;
+            for (; x + 4 <= width; x += 4) {
+                for (int32_t lane = 0; lane < 4; lane++) {
+                    Pixel pixel = row[x + lane];
+                    counts[lane][0][pixel.red]++, counts[lane][1][pixel.green]++;
+                    counts[lane][2][pixel.blue]++, counts[lane][3][pixel.alpha]++;
+                }
+            }
+            for (; x < width; x++) {
+                counts[0][0][row[x].red]++, counts[0][1][row[x].green]++;
+                counts[0][2][row[x].blue]++, counts[0][3][row[x].alpha]++;
+            }
+        }
+
+        for (int32_t channel = 0; channel < 4; channel++) {
+            for (int32_t bin = 0; bin < 256; bin++) {
+                totals[channel][bin] += (uint64_t)counts[0][channel][bin] +
+                                        counts[1][channel][bin] + counts[2][channel][bin] +
+                                        counts[3][channel][bin];
+            }
+        }
+        memset(counts, 0, 4 * sizeof(*counts));
+    }
+
+    pthread_mutex_lock(&job->lock);
+    uint64_t* channels[4] = {job->histogram->red, job->histogram->green, job->histogram->blue,
+                             job->histogram->alpha};
+    for (int32_t channel = 0; channel < 4; channel++) {
+        for (int32_t bin = 0; bin < 256; bin++) {
+            channels[channel][bin] += totals[channel][bin];
+        }
+    }
+    pthread_mutex_unlock(&job->lock);
+
+    free(counts), free(totals);
+}
+
+/**
+ * @brief Count the values of every channel of the image, each thread fills its own
+ * sub-histograms which are merged at the end.
+ *
+ * @param bmp the image.
+ * @param histogram the histogram to fill, it is cleared first.
+ * @return the count of pixels.
+ */
+uint64_t bmp_histogram(BMP* bmp, BmpHistogram* histogram) {
+    int64_t width = bmp->header->info_header.width;
+    int64_t height = bmp->header->info_header.height;
+    memset(histogram, 0, sizeof(BmpHistogram));
+
+    BmpHistogramJob job = {bmp, histogram, PTHREAD_MUTEX_INITIALIZER};
+    bmp_parallel(height, 64, bmp_histogram_rows, &job);
+    pthread_mutex_destroy(&job.lock);
+    return width * height;
+}
+
+/**
+ * @brief Compute the minimum, maximum, mean and standard deviation of every channel, derived from
+ * the histogram in a single pass over the pixels.
+ *
+ * @param bmp the image.
+ * @param stats the statistics to fill.
+ * @return the count of pixels.
+ */
+uint64_t bmp_stats(BMP* bmp, BmpStats* stats) {
+    BmpHistogram* histogram = malloc(sizeof(BmpHistogram));
+    uint64_t      count = bmp_histogram(bmp, histogram);
+    uint64_t*     channels[4] = {histogram->red, histogram->green, histogram->blue,
+                                 histogram->alpha};
+    uint8_t       minimum[4] = {0}, maximum[4] = {0};
+
+    memset(stats, 0, sizeof(BmpStats));
+    stats->count = count;
+    for (int32_t channel = 0; channel < 4 && count > 0; channel++) {
+        double sum = 0, squares = 0;
+        bool   found = false;
+        for (int32_t bin = 0; bin < 256; bin++) {
+            uint64_t n = channels[channel][bin];
+            if (n == 0) {
+                continue;
+            }
+            minimum[channel] = found ? minimum[channel] : bin;
+            maximum[channel] = bin;
+            found = true;
+            sum += (double)n * bin;
+            squares += (double)n * bin * bin;
+        }
+
+        double mean = sum / count, variance = squares / count - mean * mean;
+        stats->mean[channel] = mean;
+        stats->deviation[channel] = variance > 0 ? sqrt(variance) : 0;
+    }
+
+    stats->min = (Pixel){minimum[0], minimum[1], minimum[2], minimum[3]};
+    stats->max = (Pixel){maximum[0], maximum[1], maximum[2], maximum[3]};
+    free(histogram);
+    return count;
+}
+
+typedef struct BmpDiffJob {
+    BMP*            a;
+    BMP*            b;
+    BmpDiff*        diff;
+    pthread_mutex_t lock;
+} BmpDiffJob;
+
+static void bmp_diff_rows(void* context, int64_t from, int64_t to) {
+    BmpDiffJob* job = (BmpDiffJob*)context;
+    int64_t     width = job->a->header->info_header.width;
+    uint64_t    sad = 0, squares = 0, different = 0;
+    uint32_t    max = 0;
+
+    for (int64_t y = from; y < to; y++) {
+        Pixel const* a = bmp_row(job->a, y);
+        Pixel const* b = bmp_row(job->b, y);
+        int64_t      x = 0;
+#if defined(BMP_SSE2)
+        __m128i const colors = _mm_set1_epi32(0x00FFFFFF), zero = _mm_setzero_si128();
+        __m128i       sums = zero, square_sums = zero, peak = zero;
+        for (; x + 4 <= width; x += 4) {
+            __m128i first = _mm_and_si128(_mm_loadu_si128((__m128i const*)(a + x)), colors);
+            __m128i second = _mm_and_si128(_mm_loadu_si128((__m128i const*)(b + x)), colors);
+            __m128i delta =
+                _mm_or_si128(_mm_subs_epu8(first, second), _mm_subs_epu8(second, first));
+            sums = _mm_add_epi64(sums, _mm_sad_epu8(delta, zero));
+            peak = _mm_max_epu8(peak, delta);
+
+            __m128i low = _mm_unpacklo_epi8(delta, zero), high = _mm_unpackhi_epi8(delta, zero);
+            square_sums = _mm_add_epi32(square_sums, _mm_add_epi32(_mm_madd_epi16(low, low),
+                                                                   _mm_madd_epi16(high, high)));
+
+            // a pixel differs when any byte of its 32-bit lane is set
+            __m128i same = _mm_cmpeq_epi32(delta, zero);
+            different += 4 - __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(same)));
+
+            // every 32-bit lane grows by at most 4 * 255^2 per step, flush well before overflow
+            if (((x / 4) & 0xFFF) == 0xFFF) {
+                uint32_t lanes[4];
+                _mm_storeu_si128((__m128i*)lanes, square_sums);
+                squares += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+                square_sums = zero;
+            }
+        }
+
+        uint64_t sad_lanes[2];
+        uint32_t square_lanes[4];
+        uint8_t  peak_lanes[16];
+        _mm_storeu_si128((__m128i*)sad_lanes, sums);
+        _mm_storeu_si128((__m128i*)square_lanes, square_sums);
+        _mm_storeu_si128((__m128i*)peak_lanes, peak);
+        sad += sad_lanes[0] + sad_lanes[1];
+        squares += (uint64_t)square_lanes[0] + square_lanes[1] + square_lanes[2] + square_lanes[3];
+        for (int32_t i = 0; i < 16; i++) {
+            max = peak_lanes[i] > max ? peak_lanes[i] : max;
+        }
+#endif
+        for (; x < width; x++) {
+            uint32_t red = abs(a[x].red - b[x].red), green = abs(a[x].green - b[x].green);
+            uint32_t blue = abs(a[x].blue - b[x].blue);
+            sad += red + green + blue;
+            squares += red * red + green * green + blue * blue;
+            max = red > max ? red : max, max = green > max ? green : max;
+            max = blue > max ? blue : max;
+            different += (red | green | blue) != 0;
+        }
+    }
+
+    pthread_mutex_lock(&job->lock);
+    job->diff->sad += sad;
+    job->diff->mse += squares;
+    job->diff->max = max > job->diff->max ? max : job->diff->max;
+    job->diff->different += different;
+    pthread_mutex_unlock(&job->lock);
+}
+
+/**
+ * @brief Compare the color channels of two images of the same size and pixel format.
+ *
+ * @param a the first image.
+ * @param b the second image.
+ * @param diff the differences, the PSNR is INFINITY for equal images.
+ * @return the error code.
+ */
+uint8_t bmp_diff(BMP* a, BMP* b, BmpDiff* diff) {
+    int64_t width = a->header->info_header.width;
+    int64_t height = a->header->info_header.height;
+    memset(diff, 0, sizeof(BmpDiff));
+    if (width != b->header->info_header.width || height != b->header->info_header.height ||
+        a->premultiplied != b->premultiplied) {
+        return BMP_ERROR_NOT_SUPPORTED;
+    }
+
+    BmpDiffJob job = {a, b, diff, PTHREAD_MUTEX_INITIALIZER};
+    bmp_parallel(height, 64, bmp_diff_rows, &job);
+    pthread_mutex_destroy(&job.lock);
+
+    // mse holds the sum of squares until here
+    uint64_t samples = (uint64_t)width * height * 3;
+    diff->mse = samples > 0 ? diff->mse / samples : 0;
+    diff->psnr = diff->mse > 0 ? 10.0 * log10(255.0 * 255.0 / diff->mse) : INFINITY;
+    return BMP_ERROR_NONE;
+}
+
+/**
+ * @brief Check if two images have the same size, pixel format and pixels, returning at the first
+ * row that differs.
+ *
+ * @param a the first image.
+ * @param b the second image.
+ * @return true if the images are equal.
+ */
+bool bmp_equal(BMP* a, BMP* b) {
+    int64_t width = a->header->info_header.width;
+    int64_t height = a->header->info_header.height;
+    if (width != b->header->info_header.width || height != b->header->info_header.height ||
+        a->premultiplied != b->premultiplied) {
+        return false;
+    }
+
+    for (int64_t y = 0; y < height; y++) {
+        if (memcmp(bmp_row(a, y), bmp_row(b, y), width * sizeof(Pixel)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+// #endregion
+
+// #region Color spaces.
+enum BMP_YUV {
+    BMP_YUV_601 = 0,
+    BMP_YUV_709,
+};
+
+/** Fixed-point precision of the color space coefficients. */
+#define BMP_COLOR_BITS 14
+
+typedef struct BmpColorJob {
+    BMP*     bmp;
+    /** Gray, Y U V or H S V planes, tightly packed. */
+    uint8_t* planes[3];
+    bool     subsampled;
+    /** Red, green and blue coefficients of every output plane, and the offset added to it. */
+    int32_t  coefficients[3][3];
+    int32_t  offsets[3];
+} BmpColorJob;
+
+/**
+ * @brief Weigh the color channels of pixels into one plane, with saturation.
+ *
+ * @param src the pixels.
+ * @param dst the plane.
+ * @param count the number of pixels.
+ * @param coefficients the red, green and blue coefficients, with BMP_COLOR_BITS bits of fraction,
+ * within 16 bits.
+ * @param offset added before the fraction is shifted out, including the rounding.
+ */
+static inline void bmp_weigh_row(Pixel const* src, uint8_t* dst, uint64_t count,
+                                 int32_t const* coefficients, int32_t offset) {
+    uint64_t x = 0;
+
+#if defined(BMP_SSE2)
+    __m128i const zero = _mm_setzero_si128(), bias = _mm_set1_epi32(offset);
+    __m128i const weights =
+        _mm_setr_epi16((int16_t)coefficients[0], (int16_t)coefficients[1], (int16_t)coefficients[2],
+                       0, (int16_t)coefficients[0], (int16_t)coefficients[1],
+                       (int16_t)coefficients[2], 0);
+    for (; x + 8 <= count; x += 8) {
+        __m128i sums[2];
+        for (int half = 0; half < 2; half++) {
+            __m128i const p = _mm_loadu_si128((__m128i const*)(src + x + half * 4));
+            // red * r + green * g and blue * b of every pixel, then added in pairs
+            __m128i const low = _mm_madd_epi16(_mm_unpacklo_epi8(p, zero), weights);
+            __m128i const high = _mm_madd_epi16(_mm_unpackhi_epi8(p, zero), weights);
+            __m128i const even = _mm_castps_si128(_mm_shuffle_ps(
+                _mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(2, 0, 2, 0)));
+            __m128i const odd = _mm_castps_si128(_mm_shuffle_ps(
+                _mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(3, 1, 3, 1)));
+            sums[half] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(even, odd), bias),
+                                        BMP_COLOR_BITS);
+        }
+        __m128i const packed = _mm_packs_epi32(sums[0], sums[1]);
+        _mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(packed, packed));
+    }
+#endif
+
+    for (; x < count; x++) {
+        int32_t const value = (coefficients[0] * src[x].red + coefficients[1] * src[x].green +
+                               coefficients[2] * src[x].blue + offset) >>
+                              BMP_COLOR_BITS;
+        dst[x] = value < 0 ? 0 : (value > 0xFF ? 0xFF : value);
+    }
+}
+
+/**
+ * @brief Set up the coefficients of the gray or the studio range YUV conversion.
+ *
+ * @param job the job to set up.
+ * @param matrix one of BMP_YUV.
+ * @param gray whether to set up the full range luma only.
+ */
+static void bmp_color_setup(BmpColorJob* job, uint8_t matrix, bool gray) {
+    double const kr = matrix == BMP_YUV_709 ? 0.2126 : 0.299;
+    double const kb = matrix == BMP_YUV_709 ? 0.0722 : 0.114;
+    double const kg = 1.0 - kr - kb;
+    double const scale = 1 << BMP_COLOR_BITS;
+
+    double const luma = gray ? 1.0 : 219.0 / 255.0, chroma = 224.0 / 255.0;
+    double const rows[3][3] = {
+        {kr * luma, kg * luma, kb * luma},
+        {-kr / (2 * (1 - kb)) * chroma, -kg / (2 * (1 - kb)) * chroma, 0.5 * chroma},
+        {0.5 * chroma, -kg / (2 * (1 - kr)) * chroma, -kb / (2 * (1 - kr)) * chroma},
+    };
+    for (int plane = 0; plane < 3; plane++) {
+        for (int channel = 0; channel < 3; channel++) {
+            job->coefficients[plane][channel] = (int32_t)lround(rows[plane][channel] * scale);
+        }
+    }
+
+    int32_t const half = 1 << (BMP_COLOR_BITS - 1);
+    job->offsets[0] = (gray ? 0 : 16 << BMP_COLOR_BITS) + half;
+    job->offsets[1] = job->offsets[2] = (128 << BMP_COLOR_BITS) + half;
+}
+
+static void bmp_gray_rows(void* context, int64_t from, int64_t to) {
+    BmpColorJob const* job = (BmpColorJob*)context;
+    uint64_t const     width = job->bmp->header->info_header.width;
+    for (int64_t y = from; y < to; y++) {
+        bmp_weigh_row(bmp_row(job->bmp, y), job->planes[0] + y * width, width,
+                      job->coefficients[0], job->offsets[0]);
+    }
+}
+
+/**
+ * @brief Convert the image to a full range BT.601 luma plane. Alpha is ignored, so premultiplied
+ * images convert as if composited over black.
+ *
+ * @param bmp the image.
+ * @param gray the plane, width x height bytes.
+ * @return the number of pixels converted.
+ */
+uint64_t bmp_to_gray(BMP* bmp, uint8_t* gray) {
+    BmpColorJob job = {bmp, {gray, NULL, NULL}, false, {{0}}, {0}};
+    bmp_color_setup(&job, BMP_YUV_601, true);
+    bmp_parallel(bmp->header->info_header.height, 16, bmp_gray_rows, &job);
+    return (uint64_t)bmp->header->info_header.width * bmp->header->info_header.height;
+}
+
+static void bmp_from_gray_rows(void* context, int64_t from, int64_t to) {
+    BmpColorJob const* job = (BmpColorJob*)context;
+    uint64_t const     width = job->bmp->header->info_header.width;
+    for (int64_t y = from; y < to; y++) {
+        uint8_t const* src = job->planes[0] + y * width;
+        Pixel*         dst = bmp_row(job->bmp, y);
+        uint64_t       x = 0;
+
+#if defined(BMP_SSE2)
+        __m128i const opaque = _mm_set1_epi8((char)0xFF);
+        for (; x + 16 <= width; x += 16) {
+            __m128i const g = _mm_loadu_si128((__m128i const*)(src + x));
+            __m128i const gg_low = _mm_unpacklo_epi8(g, g), gg_high = _mm_unpackhi_epi8(g, g);
+            __m128i const ga_low = _mm_unpacklo_epi8(g, opaque);
+            __m128i const ga_high = _mm_unpackhi_epi8(g, opaque);
+            _mm_storeu_si128((__m128i*)(dst + x), _mm_unpacklo_epi16(gg_low, ga_low));
+            _mm_storeu_si128((__m128i*)(dst + x + 4), _mm_unpackhi_epi16(gg_low, ga_low));
+            _mm_storeu_si128((__m128i*)(dst + x + 8), _mm_unpacklo_epi16(gg_high, ga_high));
+            _mm_storeu_si128((__m128i*)(dst + x + 12), _mm_unpackhi_epi16(gg_high, ga_high));
+        }
+#endif
+
+        for (; x < width; x++) {
+            dst[x] = (Pixel){src[x], src[x], src[x], 0xFF};
+        }
+    }
+}
+
+/**
+ * @brief Fill the image with opaque gray pixels.
+ *
+ * @param bmp the image, its size is the size of the plane.
+ * @param gray the plane, width x height bytes.
+ * @return the number of pixels converted.
+ */
+uint64_t bmp_from_gray(BMP* bmp, uint8_t const* gray) {
+    BmpColorJob job = {bmp, {(uint8_t*)gray, NULL, NULL}, false, {{0}}, {0}};
+    bmp_parallel(bmp->header->info_header.height, 16, bmp_from_gray_rows, &job);
+    return (uint64_t)bmp->header->info_header.width * bmp->header->info_header.height;
+}
+
+static void bmp_yuv_rows(void* context, int64_t from, int64_t to) {
+    BmpColorJob const* job = (BmpColorJob*)context;
+    uint64_t const     width = job->bmp->header->info_header.width;
+    int64_t const      height = job->bmp->header->info_header.height;
+    uint64_t const     chroma_width = (width + 1) / 2;
+    Pixel*             reduced = job->subsampled ? malloc(chroma_width * sizeof(Pixel)) : NULL;
+
+    for (int64_t y = from; y < to; y++) {
+        Pixel const* row = bmp_row(job->bmp, y);
+        bmp_weigh_row(row, job->planes[0] + y * width, width, job->coefficients[0],
+                      job->offsets[0]);
+        if (!job->subsampled) {
+            bmp_weigh_row(row, job->planes[1] + y * width, width, job->coefficients[1],
+                          job->offsets[1]);
+            bmp_weigh_row(row, job->planes[2] + y * width, width, job->coefficients[2],
+                          job->offsets[2]);
+            continue;
+        }
+
+        // the chroma of a 2x2 block is converted from its average color
+        if (y % 2 == 1 || y == height - 1) {
+            Pixel const* top = bmp_row(job->bmp, y - y % 2);
+            bmp_reduce_row(top, row, reduced, width, false);
+            bmp_weigh_row(reduced, job->planes[1] + y / 2 * chroma_width, chroma_width,
+                          job->coefficients[1], job->offsets[1]);
+            bmp_weigh_row(reduced, job->planes[2] + y / 2 * chroma_width, chroma_width,
+                          job->coefficients[2], job->offsets[2]);
+        }
+    }
+
+    free(reduced);
+}
+
+static void bmp_yuv_pairs(void* context, int64_t from, int64_t to) {
+    // bands of row pairs, so both rows of a chroma row are in the same band
+    BmpColorJob const* job = (BmpColorJob*)context;
+    int64_t const      height = job->bmp->header->info_header.height;
+    bmp_yuv_rows(context, 2 * from, 2 * to < height ? 2 * to : height);
+}
+
+/**
+ * @brief Convert the image to studio range (16-235) planar YUV. Alpha is ignored, so
+ * premultiplied images convert as if composited over black.
+ *
+ * @param bmp the image.
+ * @param y the luma plane, width x height bytes.
+ * @param u the blue difference plane, width x height bytes, or (width + 1) / 2 x (height + 1) / 2
+ * bytes when subsampled.
+ * @param v the red difference plane, the same size as u.
+ * @param matrix one of BMP_YUV.
+ * @param subsampled whether to write 4:2:0 chroma instead of 4:4:4.
+ * @return the error code.
+ */
+uint8_t bmp_to_yuv(BMP* bmp, uint8_t* y, uint8_t* u, uint8_t* v, uint8_t matrix,
+                   bool subsampled) {
+    if (matrix != BMP_YUV_601 && matrix != BMP_YUV_709) {
+        return BMP_ERROR_NOT_SUPPORTED;
+    }
+
+    BmpColorJob job = {bmp, {y, u, v}, subsampled, {{0}}, {0}};
+    bmp_color_setup(&job, matrix, false);
+    bmp_parallel((bmp->header->info_header.height + 1) / 2, 8, bmp_yuv_pairs, &job);
+    return BMP_ERROR_NONE;
+}
+
+static inline uint8_t bmp_clamp_color(int32_t value) {
+    value >>= BMP_COLOR_BITS;
+    return value < 0 ? 0 : (value > 0xFF ? 0xFF : value);
+}
+
+static void bmp_from_yuv_rows(void* context, int64_t from, int64_t to) {
+    BmpColorJob const* job = (BmpColorJob*)context;
+    uint64_t const     width = job->bmp->header->info_header.width;
+    uint64_t const     chroma_width = job->subsampled ? (width + 1) / 2 : width;
+    int32_t const      luma = job->coefficients[0][0], red_v = job->coefficients[0][1];
+    int32_t const      green_u = job->coefficients[0][2], green_v = job->coefficients[1][0];
+    int32_t const      blue_u = job->coefficients[1][1], half = 1 << (BMP_COLOR_BITS - 1);
+
+    for (int64_t y = from; y < to; y++) {
+        uint8_t const* y_plane = job->planes[0] + y * width;
+        uint64_t const chroma_row = (job->subsampled ? y / 2 : y) * chroma_width;
+        uint8_t const* u = job->planes[1] + chroma_row;
+        uint8_t const* v = job->planes[2] + chroma_row;
+        Pixel*         dst = bmp_row(job->bmp, y);
+
+        for (uint64_t x = 0; x < width; x++) {
+            uint64_t const i = job->subsampled ? x / 2 : x;
+            int32_t const  l = luma * (y_plane[x] - 16) + half;
+            int32_t const  cb = u[i] - 128, cr = v[i] - 128;
+            dst[x] = (Pixel){bmp_clamp_color(l + red_v * cr),
+                             bmp_clamp_color(l - green_u * cb - green_v * cr),
+                             bmp_clamp_color(l + blue_u * cb), 0xFF};
+        }
+    }
+}
+
+/**
+ * @brief Fill the image with opaque pixels converted from studio range planar YUV.
+ *
+ * @param bmp the image, its size is the size of the luma plane.
+ * @param y the luma plane.
+ * @param u the blue difference plane.
+ * @param v the red difference plane.
+ * @param matrix one of BMP_YUV.
+ * @param subsampled whether the chroma is 4:2:0 instead of 4:4:4.
+ * @return the error code.
+ */
+uint8_t bmp_from_yuv(BMP* bmp, uint8_t const* y, uint8_t const* u, uint8_t const* v,
+                     uint8_t matrix, bool subsampled) {
+    if (matrix != BMP_YUV_601 && matrix != BMP_YUV_709) {
+        return BMP_ERROR_NOT_SUPPORTED;
+    }
+
+    double const kr = matrix == BMP_YUV_709 ? 0.2126 : 0.299;
+    double const kb = matrix == BMP_YUV_709 ? 0.0722 : 0.114;
+    double const kg = 1.0 - kr - kb;
+    double const scale = 1 << BMP_COLOR_BITS, luma = 255.0 / 219.0, chroma = 255.0 / 224.0;
+
+    // the luma, red from v and green from u, then green from v and blue from u
+    BmpColorJob job = {bmp, {(uint8_t*)y, (uint8_t*)u, (uint8_t*)v}, subsampled, {{0}}, {0}};
+    job.coefficients[0][0] = (int32_t)lround(luma * scale);
+    job.coefficients[0][1] = (int32_t)lround(2 * (1 - kr) * chroma * scale);
+    job.coefficients[0][2] = (int32_t)lround(2 * (1 - kb) * kb / kg * chroma * scale);
+    job.coefficients[1][0] = (int32_t)lround(2 * (1 - kr) * kr / kg * chroma * scale);
+    job.coefficients[1][1] = (int32_t)lround(2 * (1 - kb) * chroma * scale);
+    bmp_parallel(bmp->header->info_header.height, 16, bmp_from_yuv_rows, &job);
+    return BMP_ERROR_NONE;
+}
+
+/** ceil(2^32 / d) for every divisor of the hue and the saturation, the quotient of n < 2^20 by d
+ * is (n * reciprocal) >> 32, exactly. */
+static uint64_t       bmp_hsv_reciprocal[6 * 255 + 1];
+static pthread_once_t bmp_hsv_once = PTHREAD_ONCE_INIT;
+
+static void bmp_hsv_init(void) {
+    for (uint64_t d = 1; d <= 6 * 255; d++) {
+        bmp_hsv_reciprocal[d] = ((1ULL << 32) + d - 1) / d;
+    }
+}
+
+static void bmp_hsv_rows(void* context, int64_t from, int64_t to) {
+    BmpColorJob const* job = (BmpColorJob*)context;
+    uint64_t const     width = job->bmp->header->info_header.width;
+    for (int64_t y = from; y < to; y++) {
+        Pixel const* src = bmp_row(job->bmp, y);
+        uint8_t*     hue = job->planes[0] + y * width;
+        uint8_t*     saturation = job->planes[1] + y * width;
+        uint8_t*     value = job->planes[2] + y * width;
+
+        for (uint64_t x = 0; x < width; x++) {
+            int32_t const r = src[x].red, g = src[x].green, b = src[x].blue;
+            int32_t const max = r > g ? (r > b ? r : b) : (g > b ? g : b);
+            int32_t const min = r < g ? (r < b ? r : b) : (g < b ? g : b);
+            int32_t const delta = max - min;
+
+            value[x] = max;
+            if (delta == 0) {
+                hue[x] = saturation[x] = 0;
+                continue;
+            }
+
+            // a full turn of hue is 256, every sixth of it is 256 / 6
+            saturation[x] = ((255 * delta + max / 2) * bmp_hsv_reciprocal[max]) >> 32;
+            int32_t const h = max == r ? 256 * (g - b)
+                                       : (max == g ? 512 * delta + 256 * (b - r)
+                                                   : 1024 * delta + 256 * (r - g));
+            uint64_t const turn = ((uint64_t)abs(h) + 3 * delta) * bmp_hsv_reciprocal[6 * delta];
+            hue[x] = (uint8_t)(h >= 0 ? turn >> 32 : -(turn >> 32));
+        }
+    }
+}
+
+/**
+ * @brief Convert the image to planar HSV, a full turn of hue is 256. Alpha is ignored.
+ *
+ * @param bmp the image.
+ * @param h the hue plane, width x height bytes.
+ * @param s the saturation plane, width x height bytes.
+ * @param v the value plane, width x height bytes.
+ * @return the number of pixels converted.
+ */
+uint64_t bmp_to_hsv(BMP* bmp, uint8_t* h, uint8_t* s, uint8_t* v) {
+    pthread_once(&bmp_hsv_once, bmp_hsv_init);
+    BmpColorJob job = {bmp, {h, s, v}, false, {{0}}, {0}};
+    bmp_parallel(bmp->header->info_header.height, 16, bmp_hsv_rows, &job);
+    return (uint64_t)bmp->header->info_header.width * bmp->header->info_header.height;
+}
+
+static void bmp_from_hsv_rows(void* context, int64_t from, int64_t to) {
+    BmpColorJob const* job = (BmpColorJob*)context;
+    uint64_t const     width = job->bmp->header->info_header.width;
+    for (int64_t y = from; y < to; y++) {
+        uint8_t const* hue = job->planes[0] + y * width;
+        uint8_t const* saturation = job->planes[1] + y * width;
+        uint8_t const* value = job->planes[2] + y * width;
+        Pixel*         dst = bmp_row(job->bmp, y);
+
+        for (uint64_t x = 0; x < width; x++) {
+            uint32_t const v = value[x], s = saturation[x];
+            // the position in the sixth of the turn, 0 to 255
+            uint32_t const turn = hue[x] * 6, sector = turn >> 8, f = turn & 0xFF;
+            uint8_t const  p = bmp_div255(v * (255 - s));
+            uint8_t const  q = bmp_div255(v * (255 - bmp_div255(s * f)));
+            uint8_t const  t = bmp_div255(v * (255 - bmp_div255(s * (255 - f))));
+
+            switch (sector) {
+                case 0:
+                    dst[x] = (Pixel){v, t, p, 0xFF};
+                    break;
+                case 1:
+                    dst[x] = (Pixel){q, v, p, 0xFF};
+                    break;
+                case 2:
+                    dst[x] = (Pixel){p, v, t, 0xFF};
+                    break;
+                case 3:
+                    dst[x] = (Pixel){p, q, v, 0xFF};
+                    break;
+                case 4:
+                    dst[x] = (Pixel){t, p, v, 0xFF};
+                    break;
+                default:
+                    dst[x] = (Pixel){v, p, q, 0xFF};
+                    break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Fill the image with opaque pixels converted from planar HSV.
+ *
+ * @param bmp the image, its size is the size of the planes.
+ * @param h the hue plane, a full turn is 256.
+ * @param s the saturation plane.
+ * @param v the value plane.
+ * @return the number of pixels converted.
+ */
+uint64_t bmp_from_hsv(BMP* bmp, uint8_t const* h, uint8_t const* s, uint8_t const* v) {
+    BmpColorJob job = {bmp, {(uint8_t*)h, (uint8_t*)s, (uint8_t*)v}, false, {{0}}, {0}};
+    bmp_parallel(bmp->header->info_header.height, 16, bmp_from_hsv_rows, &job);
+    return (uint64_t)bmp->header->info_header.width * bmp->header->info_header.height;
+}
+// #endregion
+
+// #region Tiled canvas.
+/**
+ * A tiled canvas keeps only a budget of its tiles in memory, the other tiles are paged out to a
+ * backing file as raw pixels. Tiles are straight alpha, edge tiles have the remaining size.
+ */
+typedef struct BmpTile {
+    BMP*            bmp;
+    uint64_t        index;
+    bool            dirty;
+    /** Neighbours in the LRU list, towards the most and the least recently used tile. */
+    struct BmpTile* prev;
+    struct BmpTile* next;
+} BmpTile;
+
+typedef struct BmpTiled {
+    uint32_t  width;
+    uint32_t  height;
+    uint32_t  tile_size;
+    uint32_t  columns;
+    uint32_t  rows;
+    FILE*     file;
+    /** The path of the backing file, NULL for an anonymous temporary file. */
+    char*     path;
+    /** The bytes that resident tiles may take, at least one tile is always resident. */
+    uint64_t  budget;
+    uint64_t  resident;
+    /** The resident tile of every index, or NULL. */
+    BmpTile** slots;
+    /** A bit for every index, set once the tile has been written to the backing file. */
+    uint64_t* stored;
+    BmpTile*  head;
+    BmpTile*  tail;
+    /** The color of tiles that have never been drawn on. */
+    Pixel     background;
+    /** The count of tiles read from and written to the backing file. */
+    uint64_t  reads;
+    uint64_t  writes;
+} BmpTiled;
+
+/**
+ * @brief Create a tiled canvas, no memory is used for tiles until they are drawn on.
+ *
+ * @param width the width of the canvas
+ * @param height the height of the canvas
+ * @param tile_size the width and height of a tile
+ * @param budget the bytes that resident tiles may take
+ * @param path the path of the backing file, which is removed when the canvas is freed, NULL for
+ * an anonymous temporary file
+ * @param pixel the color of the canvas
+ * @return the canvas, NULL if the backing file can not be created
+ */
+BmpTiled* bmp_tiled_create(uint32_t width, uint32_t height, uint32_t tile_size, uint64_t budget,
+                           char const* path, Pixel pixel) {
+    if (width == 0 || height == 0 || tile_size == 0) {
+        return NULL;
+    }
+
+    FILE* file = path != NULL ? fopen(path, "w+b") : tmpfile();
+    if (file == NULL) {
+        return NULL;
+    }
+
+    BmpTiled* canvas = calloc(1, sizeof(BmpTiled));
+    canvas->width = width, canvas->height = height, canvas->tile_size = tile_size;
+    canvas->columns = (width + tile_size - 1) / tile_size;
+    canvas->rows = (height + tile_size - 1) / tile_size;
+    canvas->file = file;
+    canvas->budget = budget;
+    canvas->background = pixel;
+
+    uint64_t const count = (uint64_t)canvas->columns * canvas->rows;
+    canvas->slots = calloc(count, sizeof(BmpTile*));
+    canvas->stored = calloc((count + 63) / 64, sizeof(uint64_t));
+    if (path != NULL) {
+        canvas->path = malloc(strlen(path) + 1);
+        strcpy(canvas->path, path);
+    }
+
+    return canvas;
+}
+
+static inline uint64_t bmp_tile_bytes(BMP const* tile) {
+    // the pixels and the pointer table of bmp_alloc
+    return (uint64_t)tile->header->info_header.width * tile->header->info_header.height *
+           (sizeof(Pixel) + sizeof(Pixel*));
+}
+
+static inline void bmp_tile_unlink(BmpTiled* canvas, BmpTile* tile) {
+    *(tile->prev != NULL ? &tile->prev->next : &canvas->head) = tile->next;
+    *(tile->next != NULL ? &tile->next->prev : &canvas->tail) = tile->prev;
+    tile->prev = tile->next = NULL;
+}
+
+static inline void bmp_tile_push(BmpTiled* canvas, BmpTile* tile) {
+    tile->next = canvas->head;
+    *(canvas->head != NULL ? &canvas->head->prev : &canvas->tail) = tile;
+    canvas->head = tile;
+}
+
+/**
+ * @brief Write a dirty tile to its slot in the backing file.
+ *
+ * @param canvas the canvas
+ * @param tile the tile
+ * @return the error code
+ */
+static uint8_t bmp_tile_store(BmpTiled* canvas, BmpTile* tile) {
+    if (!tile->dirty) {
+        return BMP_ERROR_NONE;
+    }
+
+    uint64_t const size = (uint64_t)tile->bmp->header->info_header.width *
+                          tile->bmp->header->info_header.height;
+    off_t const    offset =
+        (off_t)(tile->index * canvas->tile_size * canvas->tile_size * sizeof(Pixel));
+    if (fseeko(canvas->file, offset, SEEK_SET) != 0 ||
+        fwrite(tile->bmp->data, sizeof(Pixel), size, canvas->file) != size) {
+        return BMP_ERROR_FILE_ERROR;
+    }
+
+    canvas->stored[tile->index / 64] |= 1ULL << (tile->index % 64);
+    canvas->writes++;
+    tile->dirty = false;
+    return BMP_ERROR_NONE;
+}
+
+/**
+ * @brief Page out the least recently used tile.
+ *
+ * @param canvas the canvas
+ * @return whether a tile was paged out, a tile that can not be written stays resident
+ */
+static bool bmp_tile_evict(BmpTiled* canvas) {
+    BmpTile* tile = canvas->tail;
+    if (tile == NULL || bmp_tile_store(canvas, tile) != BMP_ERROR_NONE) {
+        return false;
+    }
+
+    bmp_tile_unlink(canvas, tile);
+    canvas->slots[tile->index] = NULL;
+    canvas->resident -= bmp_tile_bytes(tile->bmp);
+    bmp_free(tile->bmp), free(tile);
+    return true;
+}
+
+/**
+ * @brief Make a tile resident and the most recently used, evicting tiles over the budget.
+ *
+ * @param canvas the canvas
+ * @param column the column of the tile
+ * @param row the row of the tile
+ * @return the tile, NULL if it can not be read from the backing file
+ */
+static BmpTile* bmp_tile_page(BmpTiled* canvas, uint32_t column, uint32_t row) {
+    uint64_t const index = (uint64_t)row * canvas->columns + column;
+    BmpTile*       tile = canvas->slots[index];
+    if (tile != NULL) {
+        if (tile != canvas->head) {
+            bmp_tile_unlink(canvas, tile);
+            bmp_tile_push(canvas, tile);
+        }
+        return tile;
+    }
+
+    uint32_t const width = canvas->width - column * canvas->tile_size < canvas->tile_size
+                               ? canvas->width - column * canvas->tile_size
+                               : canvas->tile_size;
+    uint32_t const height = canvas->height - row * canvas->tile_size < canvas->tile_size
+                                ? canvas->height - row * canvas->tile_size
+                                : canvas->tile_size;
+    uint64_t const bytes = (uint64_t)width * height * (sizeof(Pixel) + sizeof(Pixel*));
+    while (canvas->head != NULL && canvas->resident + bytes > canvas->budget) {
+        if (!bmp_tile_evict(canvas)) {
+            break;
+        }
+    }
+
+    BMP* bmp = bmp_alloc(width, height);
+    if (canvas->stored[index / 64] & (1ULL << (index % 64))) {
+        uint64_t const size = (uint64_t)width * height;
+        off_t const    offset =
+            (off_t)(index * canvas->tile_size * canvas->tile_size * sizeof(Pixel));
+        if (fseeko(canvas->file, offset, SEEK_SET) != 0 ||
+            fread(bmp->data, sizeof(Pixel), size, canvas->file) != size) {
+            bmp_free(bmp);
+            return NULL;
+        }
+        canvas->reads++;
+    } else {
+        bmp_fill(bmp, canvas->background);
+    }
+
+    tile = calloc(1, sizeof(BmpTile));
+    tile->bmp = bmp;
+    tile->index = index;
+    bmp_tile_push(canvas, tile);
+    canvas->slots[index] = tile;
+    canvas->resident += bytes;
+    return tile;
+}
+
+/**
+ * @brief Get a tile of the canvas to work on directly, the image is only valid until another tile
+ * is paged in.
+ *
+ * @param canvas the canvas
+ * @param column the column of the tile
+ * @param row the row of the tile
+ * @param write whether the tile will be changed and has to be written back
+ * @return the image of the tile, NULL if it is out of the canvas or can not be read
+ */
+BMP* bmp_tiled_tile(BmpTiled* canvas, uint32_t column, uint32_t row, bool write) {
+    if (column >= canvas->columns || row >= canvas->rows) {
+        return NULL;
+    }
+
+    BmpTile* tile = bmp_tile_page(canvas, column, row);
+    if (tile == NULL) {
+        return NULL;
+    }
+    tile->dirty |= write;
+    return tile->bmp;
+}
+
+/**
+ * @brief Draw on the tiles that intersect a region of the canvas, other tiles are not paged in.
+ *
+ * @param canvas the canvas
+ * @param from_x the x coordinate of the top left corner of the region
+ * @param from_y the y coordinate of the top left corner of the region
+ * @param width the width of the region
+ * @param height the height of the region
+ * @param draw draws on a tile with the canvas coordinates offset by (dx, dy), and returns the
+ * count of pixels that were drawn
+ * @param ctx the context passed to draw
+ * @return the count of pixels that were drawn
+ */
+uint64_t bmp_tiled_draw(BmpTiled* canvas, int64_t from_x, int64_t from_y, int64_t width,
+                        int64_t height,
+                        uint64_t (*draw)(BMP* tile, int64_t dx, int64_t dy, void* ctx),
+                        void* ctx) {
+    int64_t const size = canvas->tile_size;
+    int64_t const to_x = from_x + width < canvas->width ? from_x + width : canvas->width;
+    int64_t const to_y = from_y + height < canvas->height ? from_y + height : canvas->height;
+    from_x = from_x < 0 ? 0 : from_x;
+    from_y = from_y < 0 ? 0 : from_y;
+    if (from_x >= to_x || from_y >= to_y) {
+        return 0;
+    }
+
+    uint64_t count = 0;
+    for (int64_t row = from_y / size; row <= (to_y - 1) / size; row++) {
+        for (int64_t column = from_x / size; column <= (to_x - 1) / size; column++) {
+            BmpTile* tile = bmp_tile_page(canvas, column, row);
+            if (tile == NULL) {
+                continue;
+            }
+
+            uint64_t const drawn = draw(tile->bmp, -column * size, -row * size, ctx);
+            tile->dirty |= drawn > 0;
+            count += drawn;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * A drawing call and the box it draws in, so it can be run only on the tiles that the box
+ * intersects. The draw function adds (dx, dy) to the coordinates of the shape.
+ */
+typedef struct BmpShape {
+    uint64_t (*draw)(BMP* bmp, int64_t dx, int64_t dy, void* shape);
+    /** The x, y, width and height of the box. */
+    int64_t     box[4];
+    int64_t     x[2];
+    int64_t     y[2];
+    int64_t     size;
+    Pixel       pixel;
+    BmpFont*    font;
+    char const* text;
+} BmpShape;
+
+static uint64_t bmp_shape_rect_draw(BMP* bmp, int64_t dx, int64_t dy, void* ctx) {
+    BmpShape const* shape = ctx;
+    return bmp_rect(bmp, shape->x[0] + dx, shape->y[0] + dy, shape->x[1], shape->y[1],
+                    shape->pixel);
+}
+
+static uint64_t bmp_shape_circle_draw(BMP* bmp, int64_t dx, int64_t dy, void* ctx) {
+    BmpShape const* shape = ctx;
+    return bmp_circle(bmp, shape->x[0] + dx, shape->y[0] + dy, shape->size, shape->pixel);
+}
+
+static uint64_t bmp_shape_line_draw(BMP* bmp, int64_t dx, int64_t dy, void* ctx) {
+    BmpShape const* shape = ctx;
+    return bmp_line(bmp, shape->x[0] + dx, shape->y[0] + dy, shape->x[1] + dx, shape->y[1] + dy,
+                    shape->size, shape->pixel);
+}
+
+static uint64_t bmp_shape_text_draw(BMP* bmp, int64_t dx, int64_t dy, void* ctx) {
+    BmpShape const* shape = ctx;
+    return bmp_text(bmp, shape->font, shape->x[0] + dx, shape->y[0] + dy, shape->size,
+                    shape->pixel, shape->text);
+}
+
+static inline BmpShape bmp_shape_rect(int64_t from_x, int64_t from_y, int64_t width,
+                                      int64_t height, Pixel pixel) {
+    return (BmpShape){bmp_shape_rect_draw, {from_x, from_y, width, height}, {from_x, width},
+                      {from_y, height}, 0, pixel, NULL, NULL};
+}
+
+static inline BmpShape bmp_shape_circle(int64_t center_x, int64_t center_y, int64_t radius,
+                                        Pixel pixel) {
+    return (BmpShape){bmp_shape_circle_draw,
+                      {center_x - radius, center_y - radius, 2 * radius + 1, 2 * radius + 1},
+                      {center_x, 0},
+                      {center_y, 0},
+                      radius,
+                      pixel,
+                      NULL,
+                      NULL};
+}
+
+static inline BmpShape bmp_shape_line(int64_t from_x, int64_t from_y, int64_t to_x, int64_t to_y,
+                                      uint64_t width, Pixel pixel) {
+    // every point of the line is a circle of radius width
+    int64_t const radius = (int64_t)width;
+    int64_t const left = (from_x < to_x ? from_x : to_x) - radius;
+    int64_t const top = (from_y < to_y ? from_y : to_y) - radius;
+    return (BmpShape){bmp_shape_line_draw,
+                      {left, top, llabs(to_x - from_x) + 2 * radius + 1,
+                       llabs(to_y - from_y) + 2 * radius + 1},
+                      {from_x, to_x},
+                      {from_y, to_y},
+                      radius,
+                      pixel,
+                      NULL,
+                      NULL};
+}
+
+static inline BmpShape bmp_shape_text(BmpFont* font, int64_t x, int64_t y, uint32_t size,
+                                      Pixel pixel, char const* text) {
+    BmpGlyphAtlas const* atlas = bmp_glyph_atlas(font != NULL ? font : &bmp_font_embedded, size);
+
+    // the box covers the ink, the last glyph can be wider than the advance at scaled sizes
+    int64_t columns, lines;
+    bmp_text_columns(text, &columns, &lines);
+    int64_t width = columns > 0 ? (columns - 1) * atlas->advance + atlas->width : 0;
+    width = width > columns * (int64_t)atlas->advance ? width : columns * atlas->advance;
+    int64_t height = (lines - 1) * atlas->line + atlas->height;
+    return (BmpShape){bmp_shape_text_draw, {x, y, width, height}, {x, 0}, {y, 0}, size, pixel,
+                      font, text};
+}
+
+static inline uint64_t bmp_tiled_shape(BmpTiled* canvas, BmpShape* shape) {
+    return bmp_tiled_draw(canvas, shape->box[0], shape->box[1], shape->box[2], shape->box[3],
+                          shape->draw, shape);
+}
+
+/**
+ * @brief Draw a rectangle on the canvas, see bmp_rect.
+ */
+uint64_t bmp_tiled_rect(BmpTiled* canvas, int64_t from_x, int64_t from_y, int64_t width,
+                        int64_t height, Pixel pixel) {
+    BmpShape shape = bmp_shape_rect(from_x, from_y, width, height, pixel);
+    return bmp_tiled_shape(canvas, &shape);
+}
+
+/**
+ * @brief Draw a circle on the canvas, see bmp_circle.
+ */
+uint64_t bmp_tiled_circle(BmpTiled* canvas, int64_t center_x, int64_t center_y, int64_t radius,
+                          Pixel pixel) {
+    BmpShape shape = bmp_shape_circle(center_x, center_y, radius, pixel);
+    return bmp_tiled_shape(canvas, &shape);
+}
+
+/**
+ * @brief Draw a line on the canvas, see bmp_line.
+ */
+uint64_t bmp_tiled_line(BmpTiled* canvas, int64_t from_x, int64_t from_y, int64_t to_x,
+                        int64_t to_y, uint64_t width, Pixel pixel) {
+    BmpShape shape = bmp_shape_line(from_x, from_y, to_x, to_y, width, pixel);
+    return bmp_tiled_shape(canvas, &shape);
+}
+
+/**
+ * @brief Draw a text on the canvas, see bmp_text.
+ */
+uint64_t bmp_tiled_text(BmpTiled* canvas, BmpFont* font, int64_t x, int64_t y, uint32_t size,
+                        Pixel pixel, char const* text) {
+    BmpShape shape = bmp_shape_text(font, x, y, size, pixel, text);
+    return bmp_tiled_shape(canvas, &shape);
+}
+
+/**
+ * @brief Get a pixel of the canvas.
+ *
+ * @param canvas the canvas
+ * @param x the x coordinate of the pixel
+ * @param y the y coordinate of the pixel
+ * @return the pixel, transparent if it is out of the canvas
+ */
+Pixel bmp_tiled_get(BmpTiled* canvas, int64_t x, int64_t y) {
+    if (x < 0 || y < 0 || x >= canvas->width || y >= canvas->height) {
+        return PIXEL_TRANSPARENT;
+    }
+
+    BMP* tile = bmp_tiled_tile(canvas, x / canvas->tile_size, y / canvas->tile_size, false);
+    return tile != NULL ? bmp_row(tile, y % canvas->tile_size)[x % canvas->tile_size]
+                        : PIXEL_TRANSPARENT;
+}
+
+/**
+ * @brief Set a pixel of the canvas, without blending.
+ *
+ * @param canvas the canvas
+ * @param x the x coordinate of the pixel
+ * @param y the y coordinate of the pixel
+ * @param pixel the pixel
+ * @return whether the pixel is in the canvas
+ */
+bool bmp_tiled_set(BmpTiled* canvas, int64_t x, int64_t y, Pixel pixel) {
+    if (x < 0 || y < 0 || x >= canvas->width || y >= canvas->height) {
+        return false;
+    }
 
+    BMP* tile = bmp_tiled_tile(canvas, x / canvas->tile_size, y / canvas->tile_size, true);
+    if (tile == NULL) {
+        return false;
+    }
+    bmp_row(tile, y % canvas->tile_size)[x % canvas->tile_size] = pixel;
     return true;
 }
 
-uint8_t write_bmp(BMP* bmp, char const* path, uint8_t red_bits, uint8_t green_bits,
-                  uint8_t blue_bits, uint8_t alpha_bits) {
-    uint16_t bpp = red_bits + green_bits + blue_bits + alpha_bits;
-    Mask     mask;
-
-    if (red_bits == 5 && green_bits == 5 && blue_bits == 5 && alpha_bits == 0) {
-        mask = Mask_555;
-        bpp = 16;
-    } else if (red_bits == 5 && green_bits == 6 && blue_bits == 5 && alpha_bits == 0) {
-        mask = Mask_565;
-    } else if (red_bits == 8 && green_bits == 8 && blue_bits == 8 && alpha_bits == 0) {
-        mask = Mask_888;
-    } else if (red_bits == 8 && green_bits == 8 && blue_bits == 8 && alpha_bits == 8) {
-        mask = Mask_8888;
-    } else {
-        return BMP_ERROR_NOT_SUPPORTED;
+/**
+ * @brief Write all dirty resident tiles to the backing file, tiles stay resident.
+ *
+ * @param canvas the canvas
+ * @return the error code
+ */
+uint8_t bmp_tiled_flush(BmpTiled* canvas) {
+    for (BmpTile* tile = canvas->head; tile != NULL; tile = tile->next) {
+        uint8_t const error = bmp_tile_store(canvas, tile);
+        if (error != BMP_ERROR_NONE) {
+            return error;
+        }
     }
+    return fflush(canvas->file) == 0 ? BMP_ERROR_NONE : BMP_ERROR_FILE_ERROR;
+}
 
-    FILE* file = fopen(path, "w");
-    if (file == NULL) {
-        return BMP_ERROR_FILE_ERROR;
+/**
+ * @brief Save the canvas with the streaming writer, one band of tiles at a time from the bottom.
+ * Tiles that have never been drawn on are written as the background without being paged in.
+ *
+ * @param canvas the canvas
+ * @param path the path of the file
+ * @param red_bits the number of bits for the red channel.
+ * @param green_bits the number of bits for the green channel.
+ * @param blue_bits the number of bits for the blue channel.
+ * @param alpha_bits the number of bits for the alpha channel.
+ * @return the error code
+ */
+uint8_t bmp_tiled_save(BmpTiled* canvas, char const* path, uint8_t red_bits, uint8_t green_bits,
+                       uint8_t blue_bits, uint8_t alpha_bits) {
+    BmpWriter* writer;
+    uint8_t    error = bmp_writer_open(&writer, path, canvas->width, canvas->height, red_bits,
+                                       green_bits, blue_bits, alpha_bits, false);
+    if (error != BMP_ERROR_NONE) {
+        return error;
     }
 
-    int32_t  width = bmp->header->info_header.width;
-    int32_t  height = bmp->header->info_header.height;
-    int32_t  row_size = ((width * bpp + 31) / 32) * 4;
-    uint8_t  pixel_size = bpp / 8;
+    uint32_t const size = canvas->tile_size;
+    Pixel*         band = malloc((uint64_t)canvas->width * size * sizeof(Pixel));
+    for (int64_t row = canvas->rows - 1; row >= 0 && error == BMP_ERROR_NONE; row--) {
+        uint32_t const top = row * size;
+        uint32_t const height = canvas->height - top < size ? canvas->height - top : size;
 
-    BITMAPV3INFOHEADER* header = calloc(1, sizeof(BITMAPV3INFOHEADER));
-    BITMAP_HEADER*      file_header = (BITMAP_HEADER*)header;
-    BITMAPINFOHEADER*   info_header = (BITMAPINFOHEADER*)header;
+        for (uint32_t column = 0; column < canvas->columns; column++) {
+            uint32_t const left = column * size;
+            uint32_t const width = canvas->width - left < size ? canvas->width - left : size;
+            uint64_t const index = (uint64_t)row * canvas->columns + column;
 
-    header->mask = mask;
+            if (canvas->slots[index] == NULL &&
+                !(canvas->stored[index / 64] & (1ULL << (index % 64)))) {
+                for (uint32_t y = 0; y < height; y++) {
+                    Pixel* dst = band + (uint64_t)y * canvas->width + left;
+                    for (uint32_t x = 0; x < width; x++) {
+                        dst[x] = canvas->background;
+                    }
+                }
+                continue;
+            }
 
-    info_header->header_size = sizeof(BITMAPV3INFOHEADER) - sizeof(BITMAP_HEADER);
-    info_header->width = width;
-    info_header->height = height;
-    info_header->planes = 1;
-    info_header->bpp = bpp;
-    info_header->compression = 3;
-    info_header->bitmap_size = abs(height) * row_size;
-    info_header->res_height = 9449;
-    info_header->res_width = 9449;
+            BmpTile* tile = bmp_tile_page(canvas, column, row);
+            if (tile == NULL) {
+                error = BMP_ERROR_FILE_ERROR;
+                break;
+            }
+            for (uint32_t y = 0; y < height; y++) {
+                memcpy(band + (uint64_t)y * canvas->width + left, bmp_row(tile->bmp, y),
+                       width * sizeof(Pixel));
+            }
+        }
 
-    file_header->magic = BMP_MAGIC;
-    file_header->offset = sizeof(BITMAPV3INFOHEADER);
-    file_header->size = sizeof(BITMAPV3INFOHEADER) + info_header->bitmap_size;
+        for (int64_t y = height - 1; y >= 0 && error == BMP_ERROR_NONE; y--) {
+            error = bmp_writer_row(writer, band + (uint64_t)y * canvas->width);
+        }
+    }
 
-    if (alpha_bits == 0 && bpp == 24) {
-        info_header->compression = 0;
+    free(band);
+    uint8_t const closed = bmp_writer_close(writer);
+    return error != BMP_ERROR_NONE ? error : closed;
+}
+
+/**
+ * @brief Free the canvas and its tiles, and remove the backing file.
+ *
+ * @param canvas the canvas
+ */
+void bmp_tiled_free(BmpTiled* canvas) {
+    if (canvas == NULL) {
+        return;
+    }
+
+    while (canvas->head != NULL) {
+        BmpTile* tile = canvas->head;
+        canvas->head = tile->next;
+        bmp_free(tile->bmp), free(tile);
+    }
+
+    fclose(canvas->file);
+    if (canvas->path != NULL) {
+        remove(canvas->path);
     }
+    free(canvas->path), free(canvas->slots), free(canvas->stored), free(canvas);
+}
+// #endregion
+
+// #region Frames.
+/** Width of the strips that changes are tracked in, so distant objects get their own rectangles. */
+#define BMP_FRAME_STRIP 256
 
-    fwrite(header, sizeof(BITMAPV3INFOHEADER), 1, file);
+/** "BMPD", the magic of a delta stream. */
+#define BMP_FRAMES_MAGIC 0x44504D42
 
-    uint64_t padding_size = row_size - (width * pixel_size);
-    uint8_t* padding = calloc(padding_size, sizeof(uint8_t));
-    for (int32_t y = info_header->height - 1; y >= 0; y--) {
-        for (int32_t x = 0; x < info_header->width; x++) {
-            uint32_t pixel_data = 0;
+typedef struct BmpRect {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+} BmpRect;
 
-            pixel_data |=
-                (uint32_t)((double)bmp->pixels[y][x]->blue / 0xFF * ((1UL << blue_bits) - 1));
-            pixel_data |=
-                (uint32_t)((double)bmp->pixels[y][x]->green / 0xFF * ((1UL << green_bits) - 1))
-                << blue_bits;
-            pixel_data |=
-                (uint32_t)((double)bmp->pixels[y][x]->red / 0xFF * ((1UL << red_bits) - 1))
-                << (blue_bits + green_bits);
-            pixel_data |=
-                (uint32_t)((double)bmp->pixels[y][x]->alpha / 0xFF * ((1UL << alpha_bits) - 1))
-                << (blue_bits + green_bits + red_bits);
+/**
+ * A frame sequence draws every frame on the same canvas, and commits the rectangles that changed
+ * since the previous frame. The delta stream starts with the magic, the width, the height and the
+ * background, then every frame is the count of rectangles followed by every rectangle and its rows.
+ */
+typedef struct BmpFrames {
+    /** The image to draw the next frame on, it keeps the content of the committed frame. */
+    BMP*      canvas;
+    BMP*      previous;
+    /** The count of committed frames. */
+    uint64_t  count;
+    /** The rectangles that changed in the last committed frame. */
+    BmpRect*  changes;
+    uint32_t  change_count;
+    uint32_t  capacity;
+    /** The first and last + 1 changed column of every row in every strip. */
+    uint32_t* spans;
+    FILE*     stream;
+    /** The bytes written to the delta stream. */
+    uint64_t  bytes;
+} BmpFrames;
 
-            fwrite(&pixel_data, pixel_size, 1, file);
+/**
+ * @brief Create a frame sequence.
+ *
+ * @param width the width of the frames
+ * @param height the height of the frames
+ * @param pixel the background, the previous frame of the first frame
+ * @param path the path of the delta stream, NULL to only track the changes
+ * @return the frame sequence, NULL if the stream can not be created
+ */
+BmpFrames* bmp_frames_create(uint32_t width, uint32_t height, Pixel pixel, char const* path) {
+    FILE* stream = NULL;
+    if (path != NULL) {
+        stream = fopen(path, "wb");
+        if (stream == NULL) {
+            return NULL;
         }
 
-        fwrite(padding, padding_size, 1, file);
+        uint32_t const header[3] = {BMP_FRAMES_MAGIC, width, height};
+        fwrite(header, sizeof(header), 1, stream);
+        fwrite(&pixel, sizeof(Pixel), 1, stream);
     }
 
-    fclose(file);
-    free(padding), free(header);
-    return BMP_ERROR_NONE;
+    uint64_t const strips = (width + BMP_FRAME_STRIP - 1) / BMP_FRAME_STRIP;
+    BmpFrames*     frames = calloc(1, sizeof(BmpFrames));
+    frames->canvas = create_bmp(width, height, pixel);
+    frames->previous = create_bmp(width, height, pixel);
+    frames->spans = malloc((height * strips * 2 + 1) * sizeof(uint32_t));
+    frames->stream = stream;
+    frames->bytes = stream != NULL ? 3 * sizeof(uint32_t) + sizeof(Pixel) : 0;
+    return frames;
 }
 
-BMP* create_bmp(uint32_t width, uint32_t height, Pixel pixel) {
-    uint16_t bpp = 24;
-    uint16_t pixel_size = bpp / 8;
+/**
+ * @brief Find the first and the last changed pixel of a row.
+ *
+ * @param a the pixels of the row.
+ * @param b the pixels to compare with.
+ * @param length the number of pixels.
+ * @param span where to store the first and the last + 1 changed column, both 0 when nothing
+ * changed.
+ */
+static inline void bmp_row_changes(Pixel const* a, Pixel const* b, uint32_t length,
+                                   uint32_t* span) {
+    uint32_t first = 0, last = length;
 
-    BMP* bmp = calloc(1, sizeof(BMP));
-    bmp->header = calloc(1, sizeof(BITMAPV3INFOHEADER));
+#if defined(BMP_SSE2)
+    while (first + 4 <= length &&
+           _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((__m128i const*)(a + first)),
+                                             _mm_loadu_si128((__m128i const*)(b + first)))) ==
+               0xFFFF) {
+        first += 4;
+    }
+#endif
+    while (first < length && memcmp(a + first, b + first, sizeof(Pixel)) == 0) {
+        first++;
+    }
+    if (first == length) {
+        span[0] = span[1] = 0;
+        return;
+    }
 
-    BITMAP_HEADER* file_header = (BITMAP_HEADER*)bmp->header;
-    file_header->magic = BMP_MAGIC;
-    file_header->size = sizeof(BITMAPV3INFOHEADER) + pixel_size * width * height;
-    file_header->offset = sizeof(BITMAPV3INFOHEADER);
+#if defined(BMP_SSE2)
+    while (last >= first + 4 &&
+           _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((__m128i const*)(a + last - 4)),
+                                             _mm_loadu_si128((__m128i const*)(b + last - 4)))) ==
+               0xFFFF) {
+        last -= 4;
+    }
+#endif
+    while (memcmp(a + last - 1, b + last - 1, sizeof(Pixel)) == 0) {
+        last--;
+    }
 
-    BITMAPINFOHEADER* info_header = (BITMAPINFOHEADER*)bmp->header;
-    info_header->header_size = sizeof(BITMAPV3INFOHEADER) - sizeof(BITMAP_HEADER);
-    info_header->width = width;
-    info_header->height = height;
-    info_header->planes = 1;
-    info_header->bpp = bpp;
-    info_header->bitmap_size = pixel_size * width * height;
-    info_header->res_height = 9449;
-    info_header->res_width = 9449;
+    span[0] = first, span[1] = last;
+}
 
-    bmp->header->mask = Mask_888;
+static void bmp_frames_compare(void* context, int64_t from, int64_t to) {
+    BmpFrames const* frames = (BmpFrames*)context;
+    uint32_t const   width = frames->canvas->header->info_header.width;
+    uint32_t const   strips = (width + BMP_FRAME_STRIP - 1) / BMP_FRAME_STRIP;
+    for (int64_t y = from; y < to; y++) {
+        Pixel const* a = bmp_row(frames->canvas, y);
+        Pixel const* b = bmp_row(frames->previous, y);
+        for (uint32_t strip = 0; strip < strips; strip++) {
+            uint32_t const left = strip * BMP_FRAME_STRIP;
+            uint32_t const length = width - left < BMP_FRAME_STRIP ? width - left : BMP_FRAME_STRIP;
+            uint32_t*      span = frames->spans + ((uint64_t)y * strips + strip) * 2;
+            bmp_row_changes(a + left, b + left, length, span);
+            if (span[0] != span[1]) {
+                span[0] += left, span[1] += left;
+            }
+        }
+    }
+}
 
-    bmp->pixels = calloc(height, sizeof(Pixel**));
-    for (uint64_t y = 0; y < height; y++) {
-        bmp->pixels[y] = malloc(width * sizeof(Pixel*));
-        for (uint64_t x = 0; x < width; x++) {
-            bmp->pixels[y][x] = malloc(sizeof(Pixel));
-            bmp->pixels[y][x]->blue = pixel.blue;
-            bmp->pixels[y][x]->green = pixel.green;
-            bmp->pixels[y][x]->red = pixel.red;
-            bmp->pixels[y][x]->alpha = pixel.alpha;
+/**
+ * @brief Commit the canvas as the next frame. The rectangles that changed since the previous
+ * frame are stored in `changes` and appended to the delta stream, unchanged rows and strips cost
+ * nothing.
+ *
+ * @param frames the frame sequence
+ * @return the error code
+ */
+uint8_t bmp_frames_commit(BmpFrames* frames) {
+    uint32_t const width = frames->canvas->header->info_header.width;
+    uint32_t const height = frames->canvas->header->info_header.height;
+    uint32_t const strips = (width + BMP_FRAME_STRIP - 1) / BMP_FRAME_STRIP;
+    bmp_parallel(height, 16, bmp_frames_compare, frames);
+
+    // consecutive changed rows of a strip are merged into one rectangle
+    frames->change_count = 0;
+    for (uint32_t strip = 0; strip < strips; strip++) {
+        BmpRect* open = NULL;
+        for (uint32_t y = 0; y < height; y++) {
+            uint32_t const* span = frames->spans + ((uint64_t)y * strips + strip) * 2;
+            if (span[0] == span[1]) {
+                open = NULL;
+                continue;
+            }
+
+            if (open == NULL) {
+                if (frames->change_count == frames->capacity) {
+                    frames->capacity = frames->capacity > 0 ? frames->capacity * 2 : 16;
+                    frames->changes = realloc(frames->changes, frames->capacity * sizeof(BmpRect));
+                }
+                open = frames->changes + frames->change_count++;
+                *open = (BmpRect){span[0], y, span[1] - span[0], 1};
+                continue;
+            }
+
+            uint32_t const right = open->x + open->width > span[1] ? open->x + open->width
+                                                                    : span[1];
+            open->x = open->x < span[0] ? open->x : span[0];
+            open->width = right - open->x;
+            open->height++;
         }
     }
 
-    return bmp;
+    uint8_t error = BMP_ERROR_NONE;
+    if (frames->stream != NULL && fwrite(&frames->change_count, sizeof(uint32_t), 1,
+                                         frames->stream) != 1) {
+        error = BMP_ERROR_FILE_ERROR;
+    }
+    frames->bytes += sizeof(uint32_t);
+
+    for (uint32_t i = 0; i < frames->change_count; i++) {
+        BmpRect const* rect = frames->changes + i;
+        if (frames->stream != NULL && fwrite(rect, sizeof(BmpRect), 1, frames->stream) != 1) {
+            error = BMP_ERROR_FILE_ERROR;
+        }
+        frames->bytes += sizeof(BmpRect) + (uint64_t)rect->width * rect->height * sizeof(Pixel);
+
+        for (uint32_t y = rect->y; y < rect->y + rect->height; y++) {
+            Pixel const* row = bmp_row(frames->canvas, y) + rect->x;
+            if (frames->stream != NULL &&
+                fwrite(row, sizeof(Pixel), rect->width, frames->stream) != rect->width) {
+                error = BMP_ERROR_FILE_ERROR;
+            }
+            memcpy(bmp_row(frames->previous, y) + rect->x, row, rect->width * sizeof(Pixel));
+        }
+    }
+
+    frames->count++;
+    return error;
 }
 
-static inline uint8_t get_shift(uint32_t mask) {
-    if (mask == 0) {
-        return 0;
+/**
+ * @brief Replay a delta stream, the frames are rebuilt on one image in order.
+ *
+ * @param path the path of the delta stream
+ * @param frame called with the image of every frame and the rectangles that changed, return false
+ * to stop
+ * @param ctx the context passed to frame
+ * @return the error code
+ */
+uint8_t bmp_frames_replay(char const* path,
+                          bool (*frame)(BMP* bmp, uint64_t index, BmpRect const* changes,
+                                        uint32_t count, void* ctx),
+                          void* ctx) {
+    FILE* stream = fopen(path, "rb");
+    if (stream == NULL) {
+        return BMP_ERROR_FILE_ERROR;
     }
-    uint8_t shift = 0;
-    while (mask ^ 0x1) {
-        mask >>= 1;
-        shift++;
+
+    uint32_t header[3];
+    Pixel    background;
+    if (fread(header, sizeof(header), 1, stream) != 1 || header[0] != BMP_FRAMES_MAGIC ||
+        fread(&background, sizeof(Pixel), 1, stream) != 1) {
+        fclose(stream);
+        return BMP_ERROR_INVALID_HEADER;
+    }
+
+    uint32_t const width = header[1], height = header[2];
+    BMP*           bmp = create_bmp(width, height, background);
+    BmpRect*       changes = NULL;
+    uint32_t       capacity = 0, count;
+    uint8_t        error = BMP_ERROR_NONE;
+    for (uint64_t index = 0; fread(&count, sizeof(uint32_t), 1, stream) == 1; index++) {
+        if (count > capacity) {
+            capacity = count;
+            changes = realloc(changes, capacity * sizeof(BmpRect));
+        }
+
+        for (uint32_t i = 0; i < count && error == BMP_ERROR_NONE; i++) {
+            BmpRect* rect = changes + i;
+            if (fread(rect, sizeof(BmpRect), 1, stream) != 1) {
+                error = BMP_ERROR_FILE_ERROR;
+            } else if (rect->x > width || rect->width > width - rect->x || rect->y > height ||
+                       rect->height > height - rect->y) {
+                error = BMP_ERROR_INVALID_HEADER;
+            }
+
+            for (uint32_t y = rect->y; y < rect->y + rect->height && error == BMP_ERROR_NONE;
+                 y++) {
+                if (fread(bmp_row(bmp, y) + rect->x, sizeof(Pixel), rect->width, stream) !=
+                    rect->width) {
+                    error = BMP_ERROR_FILE_ERROR;
+                }
+            }
+        }
+
+        if (error != BMP_ERROR_NONE || !frame(bmp, index, changes, count, ctx)) {
+            break;
+        }
     }
-    return shift;
+
+    fclose(stream);
+    free(changes), bmp_free(bmp);
+    return error;
 }
 
-uint8_t read_bmp(char const* path, BMP** bmp) {
-    FILE* bmp_file = fopen(path, "rb");
-    if (bmp_file == NULL) {
-        return BMP_ERROR_FILE_ERROR;
+/**
+ * @brief Free the frame sequence and close the delta stream.
+ *
+ * @param frames the frame sequence
+ * @return the error code of closing the stream
+ */
+uint8_t bmp_frames_free(BmpFrames* frames) {
+    uint8_t error = BMP_ERROR_NONE;
+    if (frames->stream != NULL && fclose(frames->stream) != 0) {
+        error = BMP_ERROR_FILE_ERROR;
     }
+    bmp_free(frames->canvas), bmp_free(frames->previous);
+    free(frames->changes), free(frames->spans), free(frames);
+    return error;
+}
+// #endregion
 
-    uint64_t file_size = 0;
-    fseek(bmp_file, 0, SEEK_END);
-    file_size = ftell(bmp_file);
-    fseek(bmp_file, 0, SEEK_SET);
+// #region Shared canvas.
+/**
+ * A shared canvas lets many threads draw into one image. The image is split into tiles with a
+ * lock each, and a drawing call holds the locks of the tiles its box intersects, so calls on
+ * distant parts of the image run at the same time.
+ */
+typedef struct BmpShared {
+    BMP*             bmp;
+    uint32_t         tile_size;
+    uint32_t         columns;
+    uint32_t         rows;
+    pthread_mutex_t* locks;
+} BmpShared;
 
-    uint16_t magic = 0;
-    fread(&magic, sizeof(uint16_t), 1, bmp_file);
-    fseek(bmp_file, 0, SEEK_SET);
-    if (file_size < 2 || magic != BMP_MAGIC) {
-        fclose(bmp_file);
-        return BMP_ERROR_NOT_BMP;
+/**
+ * @brief Share an image between threads, the image is not copied and is still owned by the
+ * caller.
+ *
+ * @param bmp the image
+ * @param tile_size the width and height of a tile
+ * @return the shared canvas, NULL if the image is NULL or the tile size is 0
+ */
+BmpShared* bmp_shared_create(BMP* bmp, uint32_t tile_size) {
+    if (bmp == NULL || tile_size == 0) {
+        return NULL;
     }
 
-    uint8_t* file = malloc(file_size);
-    fread(file, file_size, 1, bmp_file);
-    fclose(bmp_file);
+    BmpShared* shared = malloc(sizeof(BmpShared));
+    shared->bmp = bmp;
+    shared->tile_size = tile_size;
+    shared->columns = (bmp->header->info_header.width + tile_size - 1) / tile_size;
+    shared->rows = (bmp->header->info_header.height + tile_size - 1) / tile_size;
 
-    *bmp = calloc(1, sizeof(BMP));
-    (*bmp)->header = calloc(1, sizeof(BITMAPV3INFOHEADER));
+    uint64_t const count = (uint64_t)shared->columns * shared->rows;
+    shared->locks = malloc(count * sizeof(pthread_mutex_t));
+    for (uint64_t i = 0; i < count; i++) {
+        pthread_mutex_init(&shared->locks[i], NULL);
+    }
 
-    uint32_t header_size = ((BITMAPINFOHEADER*)file)->header_size + sizeof(BITMAP_HEADER);
-    uint32_t max_header_size = sizeof(BITMAPV3INFOHEADER) - sizeof(BITMAP_HEADER);
-    memcpy((*bmp)->header, file, header_size > max_header_size ? max_header_size : header_size);
-    BITMAPINFOHEADER const* info_header = (BITMAPINFOHEADER*)(*bmp)->header;
+    return shared;
+}
 
-    Mask mask = (*bmp)->header->mask;
-    if (info_header->compression == 0) {
-        switch (info_header->bpp) {
-            case 16:
-                mask = Mask_555;
-                break;
-            case 24:
-                mask = Mask_888;
-                break;
-            case 32:
-                mask = Mask_8888;
-                break;
-            default:
-                free(file), free((*bmp)->header), free((*bmp));
-                return BMP_ERROR_INVALID_HEADER;
-                break;
+/**
+ * @brief Run a drawing call on the image while holding the tiles of its box. The call must not
+ * draw outside of the box.
+ *
+ * Locks are taken in ascending tile order and all are held until the call returns, so two calls
+ * can not deadlock, and calls that overlap are applied in the same order on every tile they share,
+ * as if they had been made one after the other. Calls from one thread keep their order.
+ *
+ * @param shared the shared canvas
+ * @param from_x the left of the box
+ * @param from_y the top of the box
+ * @param width the width of the box
+ * @param height the height of the box
+ * @param draw the drawing call, with the image and an offset of (0, 0)
+ * @param ctx passed to draw
+ * @return the return of draw, 0 if the box is outside of the image
+ */
+uint64_t bmp_shared_draw(BmpShared* shared, int64_t from_x, int64_t from_y, int64_t width,
+                         int64_t height, uint64_t (*draw)(BMP* bmp, int64_t dx, int64_t dy,
+                                                          void* ctx),
+                         void* ctx) {
+    int64_t const image_width = shared->bmp->header->info_header.width;
+    int64_t const image_height = shared->bmp->header->info_header.height;
+    int64_t const left = from_x > 0 ? from_x : 0;
+    int64_t const top = from_y > 0 ? from_y : 0;
+    int64_t const right = from_x + width < image_width ? from_x + width : image_width;
+    int64_t const bottom = from_y + height < image_height ? from_y + height : image_height;
+    if (width <= 0 || height <= 0 || left >= right || top >= bottom) {
+        return 0;
+    }
+
+    uint32_t const first_column = left / shared->tile_size;
+    uint32_t const last_column = (right - 1) / shared->tile_size;
+    uint32_t const first_row = top / shared->tile_size;
+    uint32_t const last_row = (bottom - 1) / shared->tile_size;
+
+    for (uint32_t row = first_row; row <= last_row; row++) {
+        for (uint32_t column = first_column; column <= last_column; column++) {
+            pthread_mutex_lock(&shared->locks[(uint64_t)row * shared->columns + column]);
         }
     }
 
-    uint8_t red_shift = get_shift(mask.red);
-    uint8_t green_shift = get_shift(mask.green);
-    uint8_t blue_shift = get_shift(mask.blue);
-    uint8_t alpha_shift = get_shift(mask.alpha);
-    if (mask.alpha == 0) {
-        red_shift -= blue_shift;
-        green_shift -= blue_shift;
-        blue_shift = 0;
+    uint64_t const count = draw(shared->bmp, 0, 0, ctx);
+
+    for (uint32_t row = first_row; row <= last_row; row++) {
+        for (uint32_t column = first_column; column <= last_column; column++) {
+            pthread_mutex_unlock(&shared->locks[(uint64_t)row * shared->columns + column]);
+        }
+    }
+
+    return count;
+}
+
+static inline uint64_t bmp_shared_shape(BmpShared* shared, BmpShape* shape) {
+    return bmp_shared_draw(shared, shape->box[0], shape->box[1], shape->box[2], shape->box[3],
+                           shape->draw, shape);
+}
+
+/**
+ * @brief Draw a rectangle on the shared canvas, see bmp_rect.
+ */
+uint64_t bmp_shared_rect(BmpShared* shared, int64_t from_x, int64_t from_y, int64_t width,
+                         int64_t height, Pixel pixel) {
+    BmpShape shape = bmp_shape_rect(from_x, from_y, width, height, pixel);
+    return bmp_shared_shape(shared, &shape);
+}
+
+/**
+ * @brief Draw a circle on the shared canvas, see bmp_circle.
+ */
+uint64_t bmp_shared_circle(BmpShared* shared, int64_t center_x, int64_t center_y,
+                           int64_t radius, Pixel pixel) {
+    BmpShape shape = bmp_shape_circle(center_x, center_y, radius, pixel);
+    return bmp_shared_shape(shared, &shape);
+}
+
+/**
+ * @brief Draw a line on the shared canvas, see bmp_line.
+ */
+uint64_t bmp_shared_line(BmpShared* shared, int64_t from_x, int64_t from_y, int64_t to_x,
+                         int64_t to_y, uint64_t width, Pixel pixel) {
+    BmpShape shape = bmp_shape_line(from_x, from_y, to_x, to_y, width, pixel);
+    return bmp_shared_shape(shared, &shape);
+}
+
+/**
+ * @brief Draw a text on the shared canvas, see bmp_text. The box includes the ink of the last
+ * glyph past its advance, so the text only draws into tiles whose locks are held.
+ */
+uint64_t bmp_shared_text(BmpShared* shared, BmpFont* font, int64_t x, int64_t y, uint32_t size,
+                         Pixel pixel, char const* text) {
+    BmpShape shape = bmp_shape_text(font, x, y, size, pixel, text);
+    return bmp_shared_shape(shared, &shape);
+}
+
+/**
+ * @brief Free the shared canvas, the image is not freed. No thread may be drawing.
+ *
+ * @param shared the shared canvas
+ */
+void bmp_shared_free(BmpShared* shared) {
+    if (shared == NULL) {
+        return;
     }
 
-    (*bmp)->pixels = calloc(info_header->height, sizeof(Pixel**));
-    for (int32_t i = 0; i < info_header->height; i++) {
-        (*bmp)->pixels[i] = calloc(info_header->width, sizeof(Pixel*));
+    uint64_t const count = (uint64_t)shared->columns * shared->rows;
+    for (uint64_t i = 0; i < count; i++) {
+        pthread_mutex_destroy(&shared->locks[i]);
     }
+    free(shared->locks), free(shared);
+}
+// #endregion
+
+// #region Asset cache.
+/**
+ * A decoded image in an asset cache, shared read-only by every holder of the handle.
+ */
+typedef struct BmpAsset {
+    BMP*             bmp;
+    char*            path;
+    /** The modification time and size of the file it was decoded from. */
+    struct timespec  mtime;
+    off_t            size;
+    uint64_t         hash;
+    uint64_t         bytes;
+    uint32_t         refs;
+    /** Set once the asset left the cache, it is freed with the last handle. */
+    bool             evicted;
+    /** Neighbours in the LRU list, towards the most and the least recently used asset. */
+    struct BmpAsset* prev;
+    struct BmpAsset* next;
+} BmpAsset;
+
+/**
+ * A thread-safe cache of decoded images keyed by path, modification time and size, so a file is
+ * decoded again only when it changes. Unused assets are evicted least recently used first once
+ * they take more than the budget.
+ */
+typedef struct BmpCache {
+    pthread_mutex_t lock;
+    uint64_t        budget;
+    uint64_t        used;
+    BmpAsset*       head;
+    BmpAsset*       tail;
+    /** The count of lookups that were served from the cache and that decoded the file. */
+    uint64_t        hits;
+    uint64_t        misses;
+} BmpCache;
+
+/**
+ * @brief Create an asset cache, usually one per process shared by every thread.
+ *
+ * @param budget the bytes that decoded images may take, images that are in use are never evicted
+ * @return the cache
+ */
+BmpCache* bmp_cache_create(uint64_t budget) {
+    BmpCache* cache = calloc(1, sizeof(BmpCache));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->budget = budget;
+    return cache;
+}
 
-    uint8_t* data = file + ((BITMAP_HEADER*)(*bmp)->header)->offset;
-    int32_t  offset = 0;
-    int32_t  row_size = ((info_header->width * info_header->bpp + 31) / 32) * 4;
-    for (int32_t y = 0; y < info_header->height; y++) {
-        for (int32_t x = 0; x < info_header->width; x++) {
-            Pixel* pixel = calloc(1, sizeof(Pixel));
+static void bmp_cache_unlink(BmpCache* cache, BmpAsset* asset) {
+    *(asset->prev != NULL ? &asset->prev->next : &cache->head) = asset->next;
+    *(asset->next != NULL ? &asset->next->prev : &cache->tail) = asset->prev;
+    asset->prev = asset->next = NULL;
+}
 
-            uint32_t pixel_data = *(uint32_t*)(data + offset);
+static void bmp_cache_push(BmpCache* cache, BmpAsset* asset) {
+    asset->next = cache->head;
+    *(cache->head != NULL ? &cache->head->prev : &cache->tail) = asset;
+    cache->head = asset;
+}
 
-            pixel->blue = (pixel_data & mask.blue) >> blue_shift;
-            pixel->green = (pixel_data & mask.green) >> green_shift;
-            pixel->red = (pixel_data & mask.red) >> red_shift;
-            pixel->alpha = mask.alpha ? ((pixel_data & mask.alpha) >> alpha_shift) : 0xFF;
+static void bmp_cache_drop(BmpCache* cache, BmpAsset* asset) {
+    bmp_cache_unlink(cache, asset);
+    cache->used -= asset->bytes;
+    asset->evicted = true;
+    if (asset->refs == 0) {
+        bmp_free(asset->bmp), free(asset->path), free(asset);
+    }
+}
 
-            (*bmp)->pixels[info_header->height - 1 - y][x] = pixel;
-            offset += info_header->bpp / 8;
+static void bmp_cache_trim(BmpCache* cache) {
+    BmpAsset* asset = cache->tail;
+    while (asset != NULL && cache->used > cache->budget) {
+        BmpAsset* prev = asset->prev;
+        if (asset->refs == 0) {
+            bmp_cache_drop(cache, asset);
         }
+        asset = prev;
+    }
+}
 
-        if (offset % row_size != 0) {
-            offset += row_size - (offset % row_size);
+static BmpAsset* bmp_cache_find(BmpCache* cache, char const* path, uint64_t hash,
+                                struct stat const* file) {
+    for (BmpAsset* asset = cache->head; asset != NULL; asset = asset->next) {
+        if (asset->hash != hash || strcmp(asset->path, path) != 0) {
+            continue;
+        }
+        if (asset->size != file->st_size || asset->mtime.tv_sec != BMP_MTIME(file).tv_sec ||
+            asset->mtime.tv_nsec != BMP_MTIME(file).tv_nsec) {
+            // the file changed, holders keep the old image
+            bmp_cache_drop(cache, asset);
+            return NULL;
         }
+        bmp_cache_unlink(cache, asset);
+        bmp_cache_push(cache, asset);
+        asset->refs++;
+        return asset;
     }
+    return NULL;
+}
+
+/**
+ * @brief Get the decoded image of a file, decoding it only if it is not cached or the file has
+ * changed. Files are decoded outside of the lock, so threads loading different files do not wait
+ * for each other.
+ *
+ * @param cache the cache
+ * @param path the path of the file
+ * @param asset where to store the handle, its image must not be modified, release it with
+ * bmp_cache_release
+ * @return the error code of reading the file
+ */
+uint8_t bmp_cache_acquire(BmpCache* cache, char const* path, BmpAsset** asset) {
+    *asset = NULL;
+    struct stat file;
+    if (stat(path, &file) != 0) {
+        return BMP_ERROR_FILE_ERROR;
+    }
+
+    uint64_t const hash = bmp_hash_bytes(path, strlen(path), 0);
+    pthread_mutex_lock(&cache->lock);
+    *asset = bmp_cache_find(cache, path, hash, &file);
+    cache->hits += *asset != NULL;
+    pthread_mutex_unlock(&cache->lock);
+    if (*asset != NULL) {
+        return BMP_ERROR_NONE;
+    }
+
+    BMP*          bmp;
+    uint8_t const error = read_bmp(path, &bmp);
+    if (error != BMP_ERROR_NONE) {
+        return error;
+    }
+
+    BmpAsset* loaded = calloc(1, sizeof(BmpAsset));
+    loaded->bmp = bmp;
+    loaded->path = malloc(strlen(path) + 1);
+    strcpy(loaded->path, path);
+    loaded->mtime = BMP_MTIME(&file);
+    loaded->size = file.st_size;
+    loaded->hash = hash;
+    // bmp_alloc keeps a Pixel* per pixel besides the pixels, and a Pixel** per row
+    loaded->bytes =
+        bmp_tile_bytes(bmp) + (uint64_t)bmp->header->info_header.height * sizeof(Pixel**);
+    loaded->refs = 1;
 
-    free(file);
+    pthread_mutex_lock(&cache->lock);
+    cache->misses++;
+    // another thread may have decoded the same file meanwhile
+    *asset = bmp_cache_find(cache, path, hash, &file);
+    if (*asset == NULL) {
+        bmp_cache_push(cache, loaded);
+        cache->used += loaded->bytes;
+        bmp_cache_trim(cache);
+        *asset = loaded, loaded = NULL;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    if (loaded != NULL) {
+        bmp_free(loaded->bmp), free(loaded->path), free(loaded);
+    }
     return BMP_ERROR_NONE;
 }
+
+/**
+ * @brief Release a handle, the image stays cached until it is evicted.
+ *
+ * @param cache the cache
+ * @param asset the handle, NULL is ignored
+ */
+void bmp_cache_release(BmpCache* cache, BmpAsset* asset) {
+    if (asset == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    asset->refs--;
+    if (asset->refs == 0 && asset->evicted) {
+        bmp_free(asset->bmp), free(asset->path), free(asset);
+    } else {
+        bmp_cache_trim(cache);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * @brief Free the cache and its images, every handle must have been released.
+ *
+ * @param cache the cache
+ */
+void bmp_cache_free(BmpCache* cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    while (cache->head != NULL) {
+        bmp_cache_drop(cache, cache->head);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
 // #endregion
 
 struct {
     BMP* (*create)(uint32_t width, uint32_t height, Pixel pixel);
     uint8_t (*read)(char const* path, BMP** bmp);
+    /** Read image reduced by 1, 2, 4 or 8 while decoding. */
+    uint8_t (*read_scaled)(char const* path, BMP** bmp, uint8_t scale);
+    /** Read image into premultiplied alpha. */
+    uint8_t (*read_premultiplied)(char const* path, BMP** bmp);
     bool (*safe)(BMP* bmp, int64_t x, int64_t y);
     /** Save image. Use 8,8,8,0 for bits if you don't know what they mean. */
     uint8_t (*save)(struct BMP* bmp, char const* path, uint8_t red_bits, uint8_t green_bits,
@@ -695,10 +8071,40 @@ struct {
                      bool (*condition)(struct BMP* bmp, int64_t x, int64_t y));
     uint64_t (*turtle)(struct BMP* bmp, int64_t start_x, int64_t start_y,
                        bool (*turtle)(struct BMP* bmp, int64_t* x, int64_t* y, uint64_t count));
+    /** Fill the region around a point, tolerance per channel, connectivity 4 or 8. */
+    uint64_t (*flood)(struct BMP* bmp, int64_t x, int64_t y, Pixel pixel, uint8_t tolerance,
+                      uint8_t connectivity);
+    uint64_t (*polygon)(struct BMP* bmp, BmpPoint const* points, uint32_t count, uint8_t rule,
+                        Pixel pixel);
+    /** Anti-aliased shapes, pixel (x, y) covers the square from (x, y) to (x + 1, y + 1). */
+    uint64_t (*rect_aa)(struct BMP* bmp, double from_x, double from_y, double width, double height,
+                        Pixel pixel);
+    uint64_t (*circle_aa)(struct BMP* bmp, double center_x, double center_y, double radius,
+                          Pixel pixel);
+    uint64_t (*line_aa)(struct BMP* bmp, double from_x, double from_y, double to_x, double to_y,
+                        double width, Pixel pixel);
+    BMP* (*resize)(struct BMP* bmp, uint32_t width, uint32_t height, uint8_t filter);
+    /** Rotate clockwise into a new image, by a multiple of 90 degrees. */
+    BMP* (*rotate)(struct BMP* bmp, int32_t degrees);
+    bool (*flip)(struct BMP* bmp, bool horizontal, bool vertical);
+    /** Gaussian blur in place. */
+    uint64_t (*blur)(struct BMP* bmp, double sigma);
+    /** Batched turtle, every step stamps a width x height rectangle, overlaps are drawn once. */
+    uint64_t (*turtle_batch)(struct BMP* bmp, int64_t start_x, int64_t start_y, int64_t width,
+                             int64_t height, Pixel pixel,
+                             uint64_t (*turtle)(struct BMP* bmp, int64_t* x, int64_t* y,
+                                                BmpStep* steps, uint64_t capacity,
+                                                uint64_t count));
+    uint64_t (*text)(struct BMP* bmp, BmpFont* font, int64_t x, int64_t y, uint32_t size,
+                     Pixel pixel, char const* text);
+    uint64_t (*gradient)(struct BMP* bmp, BmpGradient const* gradient, int64_t from_x,
+                         int64_t from_y, int64_t width, int64_t height);
     bool (*free)(struct BMP* bmp);
 } Bmp = {
     .create = create_bmp,
     .read = read_bmp,
+    .read_scaled = read_bmp_scaled,
+    .read_premultiplied = read_bmp_premultiplied,
     .safe = bmp_safe,
     .save = write_bmp,
     .fill = bmp_fill,
@@ -707,6 +8113,18 @@ struct {
     .line = bmp_line,
     .draw = bmp_draw,
     .turtle = bmp_turtle,
+    .turtle_batch = bmp_turtle_batch,
+    .text = bmp_text,
+    .gradient = bmp_gradient_rect,
+    .flood = bmp_flood_fill,
+    .polygon = bmp_polygon,
+    .rect_aa = bmp_rect_aa,
+    .circle_aa = bmp_circle_aa,
+    .line_aa = bmp_line_aa,
+    .resize = bmp_resize,
+    .rotate = bmp_rotate,
+    .flip = bmp_flip,
+    .blur = bmp_gaussian_blur,
     .free = bmp_free,
 };
 